@@ -0,0 +1,967 @@
+/*
+ * @file connection.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "connection.h"
+
+
+/*
+ * write every byte described by iov to fd without raising SIGPIPE
+ *
+ */
+static bool sendAll(int fd, struct iovec* iov, int count, int flags = 0) {
+    while (count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        auto sent = sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // sockets the server reads are non-blocking, wait until this one drains
+            struct pollfd writable = {fd, POLLOUT, 0};
+            poll(&writable, 1, -1);
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        while (count > 0 && static_cast<size_t>(sent) >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+
+void frameQueue::deliver(string data, bool last, bool coded) {
+    unique_lock<mutex> lk(m);
+    // stop reading the connection until the request catches up
+    cv.wait(lk, [this]{ return buffered < MAXBUFFERED || closed || failed; });
+    if (closed) {
+        return;
+    }
+    if (!data.empty()) {
+        buffered += data.size();
+        chunks.emplace_back(move(data), coded);
+    }
+    if (last) {
+        ended = true;
+    }
+    cv.notify_all();
+}
+
+
+bool frameQueue::tryDeliver(string& data, bool last, bool coded) {
+    function<void()> startNow;
+    {
+        lock_guard<mutex> lk(m);
+        if (closed) {
+            return true;
+        }
+        if (buffered < MAXBUFFERED || failed) {
+            if (!data.empty()) {
+                buffered += data.size();
+                chunks.emplace_back(move(data), coded);
+            }
+            if (last) {
+                ended = true;
+            }
+            cv.notify_all();
+            return true;
+        }
+        stalled = true;
+        if (!started) {
+            startNow.swap(onStall);
+        }
+    }
+    if (startNow) {
+        startNow();
+    }
+    return false;
+}
+
+
+void frameQueue::drained(unique_lock<mutex>& lk) {
+    if (!stalled || (buffered >= MAXBUFFERED && !closed)) {
+        return;
+    }
+    stalled = false;
+    auto callback = onDrain;
+    lk.unlock();
+    if (callback) {
+        callback();
+    }
+}
+
+
+void frameQueue::fail() {
+    lock_guard<mutex> lk(m);
+    failed = true;
+    cv.notify_all();
+}
+
+
+request::request(shared_ptr<connection> conn, uint32_t id, bool inbound, int node)
+: node{node}, id{id}, conn{conn}, queue{make_shared<frameQueue>()}, inbound{inbound}, finished{false},
+  frames{0}, compressing{false}, backoff{0} {
+}
+
+
+request::~request() {
+    if (!finished) {
+        // the other side may be waiting for us, let it know we are done
+        conn->writeFrame(id, (inbound ? FRAME_REPLY : 0) | FRAME_END, nullptr, 0);
+    }
+    bool peerEnded;
+    {
+        unique_lock<mutex> lk(queue->m);
+        peerEnded = queue->ended || queue->failed;
+        queue->closed = true;
+        queue->chunks.clear();
+        queue->buffered = 0;
+        queue->cv.notify_all();
+        queue->drained(lk);
+    }
+    conn->forget(id, inbound, peerEnded);
+}
+
+
+ssize_t request::read(char* buf, size_t len) {
+    unique_lock<mutex> lk(queue->m);
+    waitForFrame(lk);
+
+    if (queue->chunks.empty()) {
+        return queue->ended ? 0 : -1;
+    }
+
+    if (queue->chunks.front().second && !decodeFront()) {
+        queue->failed = true;
+        queue->chunks.clear();
+        queue->buffered = 0;
+        queue->cv.notify_all();
+        return -1;
+    }
+
+    auto& front = queue->chunks.front().first;
+    auto numBytes = min(len, front.size() - queue->readOffset);
+    memcpy(buf, &front[queue->readOffset], numBytes);
+    queue->readOffset += numBytes;
+    if (queue->readOffset == front.size()) {
+        queue->chunks.pop_front();
+        queue->readOffset = 0;
+    }
+    queue->buffered -= numBytes;
+    queue->cv.notify_all();
+    queue->drained(lk);
+    return numBytes;
+}
+
+
+ssize_t request::readFrame(string& frame, size_t len) {
+    unique_lock<mutex> lk(queue->m);
+    waitForFrame(lk);
+
+    if (queue->chunks.empty()) {
+        return queue->ended ? 0 : -1;
+    }
+
+    if (queue->chunks.front().second && !decodeFront()) {
+        queue->failed = true;
+        queue->chunks.clear();
+        queue->buffered = 0;
+        queue->cv.notify_all();
+        return -1;
+    }
+
+    auto& front = queue->chunks.front().first;
+    size_t numBytes;
+    if (queue->readOffset == 0 && front.size() <= len) {
+        numBytes = front.size();
+        frame = move(front);
+        queue->chunks.pop_front();
+    } else {
+        numBytes = min(len, front.size() - queue->readOffset);
+        frame.assign(front, queue->readOffset, numBytes);
+        queue->readOffset += numBytes;
+        if (queue->readOffset == front.size()) {
+            queue->chunks.pop_front();
+            queue->readOffset = 0;
+        }
+    }
+    queue->buffered -= numBytes;
+    queue->cv.notify_all();
+    queue->drained(lk);
+    return numBytes;
+}
+
+
+void request::waitForFrame(unique_lock<mutex>& lk) {
+    auto ready = [this]{ return !queue->chunks.empty() || queue->ended || queue->failed; };
+    if (ready()) {
+        return;
+    }
+    // the reply may need a worker of the peer that waits for this node in turn
+    if (!inbound) {
+        workerPool::blocked();
+    }
+    queue->cv.wait(lk, ready);
+    if (!inbound) {
+        workerPool::unblocked();
+    }
+}
+
+
+bool request::readAll(char* buf, size_t len) {
+    while (len > 0) {
+        auto numBytes = read(buf, len);
+        if (numBytes <= 0) {
+            return false;
+        }
+        buf += numBytes;
+        len -= numBytes;
+    }
+    return true;
+}
+
+
+bool request::write(const char* buf, size_t len, bool last) {
+    if (finished) {
+        return false;
+    }
+    if (frames == 0) {
+        bind(buf, min(len, MAXFRAMESIZE), last && len <= MAXFRAMESIZE);
+    }
+    uint32_t flags = inbound ? FRAME_REPLY : 0;
+    do {
+        auto frameLen = min(len, MAXFRAMESIZE);
+        bool lastFrame = last && frameLen == len;
+        if (!writeFrame(flags | (lastFrame ? FRAME_END : 0), buf, frameLen)) {
+            finished = true;
+            return false;
+        }
+        buf += frameLen;
+        len -= frameLen;
+    } while (len > 0);
+
+    if (last) {
+        finished = true;
+    }
+    return true;
+}
+
+
+bool request::sendFile(int fd, uint64_t offset, uint64_t length) {
+    if (finished) {
+        return false;
+    }
+    if (frames == 0) {
+        bind(nullptr, 0, false);
+    }
+    uint32_t flags = inbound ? FRAME_REPLY : 0;
+    while (length > 0) {
+        auto frameLen = min(length, static_cast<uint64_t>(MAXFRAMESIZE));
+        frames++;
+        conn->manager.countSent(frameLen, frameLen);
+        if (!conn->writeFileFrame(id, flags, fd, offset, frameLen)) {
+            finished = true;
+            return false;
+        }
+        offset += frameLen;
+        length -= frameLen;
+    }
+    return true;
+}
+
+
+bool request::finish() {
+    return write(nullptr, 0, true);
+}
+
+
+void request::compress(bool on) {
+    compressing = on;
+    backoff = 0;
+}
+
+
+void request::bind(const char* firstFrame, size_t len, bool last) {
+    if (inbound || !conn->manager.isBulk(string(firstFrame ? firstFrame : "", len), last)) {
+        return;
+    }
+    auto bulkConn = conn->manager.connectionTo(node, true);
+    if (!bulkConn || bulkConn == conn) {
+        return;
+    }
+    // nothing has been sent yet, the request only has to be known under its new id
+    conn->forget(id, false, true);
+    {
+        lock_guard<mutex> lk(bulkConn->requestsMutex);
+        id = bulkConn->nextId++;
+        bulkConn->outbound[id] = queue;
+        if (!bulkConn->alive) {
+            queue->fail();
+        }
+    }
+    conn = bulkConn;
+}
+
+
+bool request::writeFrame(uint32_t flags, const char* buf, size_t len) {
+    // the server picks the workers of a request by its first frame, keep that one readable
+    bool first = frames++ == 0;
+    if (!compressing || first || len < MINCODED || !conn->coding) {
+        return conn->writeFrame(id, flags, buf, len);
+    }
+
+    if (backoff > 0) {
+        backoff--;
+    } else {
+        uint32_t rawLen = htonl(len);
+        coded.resize(sizeof(rawLen) + lzBound(len));
+        auto codedLen = lzCompress(buf, len, &coded[sizeof(rawLen)], coded.size() - sizeof(rawLen));
+        if (codedLen > 0 && sizeof(rawLen) + codedLen <= len - len / CODEDCUTOFF) {
+            memcpy(&coded[0], &rawLen, sizeof(rawLen));
+            conn->manager.countSent(len, sizeof(rawLen) + codedLen);
+            return conn->writeFrame(id, flags | FRAME_CODED, &coded[0], sizeof(rawLen) + codedLen);
+        }
+        // probably compressed or random data, don't spend time on the next frames
+        backoff = CODEDBACKOFF;
+    }
+    conn->manager.countSent(len, len);
+    return conn->writeFrame(id, flags, buf, len);
+}
+
+
+bool request::decodeFront() {
+    auto& front = queue->chunks.front();
+    uint32_t rawLen;
+    if (front.first.size() < sizeof(rawLen)) {
+        return false;
+    }
+    memcpy(&rawLen, &front.first[0], sizeof(rawLen));
+    rawLen = ntohl(rawLen);
+    if (rawLen > MAXFRAMESIZE) {
+        return false;
+    }
+
+    string raw(rawLen, '\0');
+    if (!lzDecompress(&front.first[sizeof(rawLen)], front.first.size() - sizeof(rawLen), &raw[0], rawLen)) {
+        return false;
+    }
+    queue->buffered = queue->buffered - front.first.size() + raw.size();
+    front.first = move(raw);
+    front.second = false;
+    return true;
+}
+
+
+connection::connection(int fd, int node, bool inbound, connectionManager& manager)
+: node{node}, fd{fd}, coding{false}, inbound{inbound}, alive{true}, manager(manager), nextId{1},
+  readOffset{0}, heldLast{false}, heldCoded{false} {
+}
+
+
+connection::~connection() {
+    close(fd);
+}
+
+
+shared_ptr<request> connection::open() {
+    lock_guard<mutex> lk(requestsMutex);
+    auto req = make_shared<request>(shared_from_this(), nextId++, false, node);
+    outbound[req->id] = req->queue;
+    if (!alive) {
+        req->queue->fail();
+    }
+    return req;
+}
+
+
+bool connection::writeFrame(uint32_t id, uint32_t flags, const char* buf, size_t len) {
+    if (!alive) {
+        return false;
+    }
+    char header[FRAMEHEADERSIZE];
+    uint32_t sentId = htonl(id);
+    uint32_t sentFlags = htonl(flags);
+    uint32_t sentLen = htonl(len);
+    memcpy(header, &sentId, sizeof(sentId));
+    memcpy(header+4, &sentFlags, sizeof(sentFlags));
+    memcpy(header+8, &sentLen, sizeof(sentLen));
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAMEHEADERSIZE;
+    iov[1].iov_base = const_cast<char*>(buf);
+    iov[1].iov_len = len;
+
+    bool sent;
+    {
+        lock_guard<mutex> lk(writeMutex);
+        sent = sendAll(fd, iov, len > 0 ? 2 : 1);
+    }
+    if (!sent) {
+        manager.log(ERROR) << "connection/ lost connection to " << node;
+        markDead();
+    }
+    return sent;
+}
+
+
+bool connection::writeFileFrame(uint32_t id, uint32_t flags, int fileFd, off_t offset, size_t len) {
+    if (!alive) {
+        return false;
+    }
+    char header[FRAMEHEADERSIZE];
+    uint32_t sentId = htonl(id);
+    uint32_t sentFlags = htonl(flags);
+    uint32_t sentLen = htonl(len);
+    memcpy(header, &sentId, sizeof(sentId));
+    memcpy(header+4, &sentFlags, sizeof(sentFlags));
+    memcpy(header+8, &sentLen, sizeof(sentLen));
+
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = FRAMEHEADERSIZE;
+
+    // the header promised len bytes, a file that ends early leaves the stream unusable
+    bool sent;
+    {
+        lock_guard<mutex> lk(writeMutex);
+        sent = sendAll(fd, &iov, 1, MSG_MORE);
+        while (sent && len > 0) {
+            auto numSent = sendfile(fd, fileFd, &offset, len);
+            if (numSent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (numSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                struct pollfd writable = {fd, POLLOUT, 0};
+                poll(&writable, 1, -1);
+                continue;
+            }
+            sent = numSent > 0;
+            len -= max(numSent, static_cast<ssize_t>(0));
+        }
+    }
+    if (!sent) {
+        manager.log(ERROR) << "connection/ lost connection to " << node << " sending a file";
+        markDead();
+    }
+    return sent;
+}
+
+
+void connection::readFrames() {
+    char header[FRAMEHEADERSIZE];
+
+    while (readAll(fd, header, FRAMEHEADERSIZE)) {
+        uint32_t id, flags, length;
+        memcpy(&id, header, sizeof(id));
+        memcpy(&flags, header+4, sizeof(flags));
+        memcpy(&length, header+8, sizeof(length));
+        id = ntohl(id);
+        flags = ntohl(flags);
+        length = ntohl(length);
+
+        if (length > MAXFRAMESIZE) {
+            manager.log(ERROR) << "connection/ frame of " << length << " bytes from " << node;
+            break;
+        }
+        string payload(length, '\0');
+        if (length > 0 && !readAll(fd, &payload[0], length)) {
+            break;
+        }
+        if (flags & FRAME_HELLO) {
+            recvHello(payload);
+            continue;
+        }
+
+        shared_ptr<request> newRequest;
+        auto queue = route(id, flags, newRequest);
+        if (!queue) {   // request has already been closed on this side
+            continue;
+        }
+        queue->deliver(move(payload), flags & FRAME_END, flags & FRAME_CODED);
+    }
+    markDead();
+}
+
+
+bool connection::readAvailable() {
+    while (!heldQueue) {
+        auto oldSize = readBuf.size();
+        readBuf.resize(oldSize + READSIZE);
+        auto numBytes = ::read(fd, &readBuf[oldSize], READSIZE);
+        readBuf.resize(oldSize + max(numBytes, static_cast<ssize_t>(0)));
+
+        if (numBytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (numBytes <= 0) {
+            return false;
+        }
+        parseFrames();
+    }
+    return true;
+}
+
+
+bool connection::resume() {
+    if (heldQueue) {
+        if (!heldQueue->tryDeliver(heldPayload, heldLast, heldCoded)) {
+            return false;
+        }
+        heldQueue.reset();
+        heldPayload.clear();
+    }
+    return parseFrames();
+}
+
+
+bool connection::isPaused() {
+    return heldQueue != nullptr;
+}
+
+
+shared_ptr<frameQueue> connection::route(uint32_t id, uint32_t flags, shared_ptr<request>& newRequest) {
+    lock_guard<mutex> lk(requestsMutex);
+    if (flags & FRAME_REPLY) {
+        auto it = outbound.find(id);
+        return it != outbound.end() ? it->second : nullptr;
+    }
+
+    auto it = inboundRequests.find(id);
+    if (it != inboundRequests.end()) {
+        return it->second;
+    }
+    if (!inbound) {
+        return nullptr;
+    }
+    auto closed = closedInbound.find(id);
+    if (closed != closedInbound.end()) {
+        if (flags & FRAME_END) {
+            closedInbound.erase(closed);
+        }
+        return nullptr;
+    }
+    newRequest = make_shared<request>(shared_from_this(), id, true, node);
+    weak_ptr<connection> self = shared_from_this();
+    auto& serverManager = manager;
+    newRequest->queue->onDrain = [self, &serverManager]{
+        if (auto conn = self.lock()) {
+            serverManager.resumeLater(conn);
+        }
+    };
+    inboundRequests[id] = newRequest->queue;
+    return newRequest->queue;
+}
+
+
+bool connection::parseFrames() {
+    bool handedOut = true;
+
+    while (readBuf.size() - readOffset >= FRAMEHEADERSIZE) {
+        uint32_t id, flags, length;
+        memcpy(&id, &readBuf[readOffset], sizeof(id));
+        memcpy(&flags, &readBuf[readOffset+4], sizeof(flags));
+        memcpy(&length, &readBuf[readOffset+8], sizeof(length));
+        id = ntohl(id);
+        flags = ntohl(flags);
+        length = ntohl(length);
+
+        if (length > MAXFRAMESIZE) {
+            manager.log(ERROR) << "connection/ frame of " << length << " bytes from " << node;
+            markDead();
+            readOffset = readBuf.size();
+            break;
+        }
+        if (readBuf.size() - readOffset < FRAMEHEADERSIZE + length) {
+            break;
+        }
+        string payload(readBuf, readOffset + FRAMEHEADERSIZE, length);
+        readOffset += FRAMEHEADERSIZE + length;
+
+        if (flags & FRAME_HELLO) {
+            recvHello(payload);
+            continue;
+        }
+
+        shared_ptr<request> newRequest;
+        auto queue = route(id, flags, newRequest);
+        if (!queue) {   // request has already been closed on this side
+            continue;
+        }
+        bool last = flags & FRAME_END;
+        bool coded = flags & FRAME_CODED;
+        bool bulk = newRequest && manager.isBulk(payload, last);
+        if (!queue->tryDeliver(payload, last, coded)) {
+            // keep the order of frames, nothing else is read until this one fits. Requests that move
+            // a lot of data come on a connection of their own, this holds up no control request
+            heldQueue = queue;
+            heldPayload = move(payload);
+            heldLast = last;
+            heldCoded = coded;
+            handedOut = false;
+            break;
+        }
+        if (newRequest) {
+            manager.dispatch(newRequest, bulk);
+        }
+    }
+    readBuf.erase(0, readOffset);
+    readOffset = 0;
+    return handedOut;
+}
+
+
+void connection::forget(uint32_t id, bool inbound, bool peerEnded) {
+    lock_guard<mutex> lk(requestsMutex);
+    if (inbound) {
+        inboundRequests.erase(id);
+        if (!peerEnded) {
+            closedInbound.insert(id);
+        }
+    } else {
+        outbound.erase(id);
+    }
+}
+
+
+void connection::markDead() {
+    if (!alive.exchange(false)) {
+        return;
+    }
+    shutdown(fd, SHUT_RDWR);
+
+    {
+        lock_guard<mutex> lk(requestsMutex);
+        for (auto& it : outbound) {
+            it.second->fail();
+        }
+        for (auto& it : inboundRequests) {
+            it.second->fail();
+        }
+    }
+    if (!inbound) {
+        manager.dropConnection(node, this);
+    }
+}
+
+
+bool connection::isAlive() {
+    return alive;
+}
+
+
+void connection::hello() {
+    uint32_t features = htonl(manager.features);
+    writeFrame(0, FRAME_HELLO | (inbound ? FRAME_REPLY : 0), reinterpret_cast<char*>(&features), sizeof(features));
+}
+
+
+void connection::recvHello(const string& payload) {
+    uint32_t features = 0;
+    if (payload.size() >= sizeof(features)) {
+        memcpy(&features, &payload[0], sizeof(features));
+        features = ntohl(features);
+    }
+    coding = (features & manager.features & FEATURE_LZ) != 0;
+    manager.log(DEBUG) << "connection/ " << node << " offers features " << features;
+    if (inbound) {
+        hello();
+    }
+}
+
+
+connectionManager::connectionManager(uint16_t port, logger& logg, function<uint32_t(int)> ipOf,
+                                     function<int(uint32_t)> nodeOf)
+: log(logg), features{FEATURE_LZ}, rawBytes{0}, wireBytes{0}, port{port}, ipOf{ipOf}, nodeOf{nodeOf}, wakeFd{-1} {
+}
+
+
+shared_ptr<request> connectionManager::open(int node) {
+    auto conn = connectionTo(node);
+    return conn ? conn->open() : nullptr;
+}
+
+
+shared_ptr<connection> connectionManager::connectionTo(int node, bool bulk) {
+    auto& conns = bulk ? bulkPeers : peers;
+    {
+        lock_guard<mutex> lk(peersMutex);
+        auto it = conns.find(node);
+        if (it != conns.end() && it->second->isAlive()) {
+            return it->second;
+        }
+    }
+
+    int fd = connectToServer(node);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto fresh = make_shared<connection>(fd, node, false, *this);
+    shared_ptr<connection> conn;
+    {
+        // another thread may have connected in the meantime
+        lock_guard<mutex> lk(peersMutex);
+        auto it = conns.find(node);
+        if (it != conns.end() && it->second->isAlive()) {
+            conn = it->second;
+        } else {
+            conns[node] = fresh;
+            conn = fresh;
+        }
+    }
+    if (conn == fresh) {
+        log(INFO) << "connection/ connected to " << node << (bulk ? " for bulk transfers" : "");
+        fresh->hello();
+        thread readFramesThread(&connection::readFrames, fresh);
+        readFramesThread.detach();  // let this run on its own
+    }
+    return conn;
+}
+
+
+bool connectionManager::send(int node, const char* message, size_t len) {
+    // a connection can go stale when the peer restarts, retry once on a fresh one
+    for (int attempt = 0; attempt < 2; attempt++) {
+        auto req = open(node);
+        if (!req) {
+            return false;
+        }
+        if (req->write(message, len, true)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void connectionManager::serve(int listenFd, function<void(shared_ptr<request>)> handler,
+                              function<bool(const string&, bool)> isBulk) {
+    this->handler = handler;
+    bulkClassifier = isBulk;
+
+    // control messages are short, bulk transfers mostly wait on disks and peers
+    size_t cores = max(thread::hardware_concurrency(), 1u);
+    controlWorkers.reset(new workerPool(max(cores, static_cast<size_t>(4)), "control", true));
+    bulkWorkers.reset(new workerPool(max(2 * cores, static_cast<size_t>(8)), "bulk", true));
+
+    listen(listenFd, SOMAXCONN);
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+    int epollFd = epoll_create1(0);
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (epollFd < 0 || wakeFd < 0) {
+        perror("Cannot create epoll instance");
+        exit(1);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    // connections peers opened to this node, by socket
+    map<int, shared_ptr<connection>> inboundConns;
+
+    auto watch = [&](int fd, uint32_t events) {
+        struct epoll_event change;
+        memset(&change, 0, sizeof(change));
+        change.events = events;
+        change.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &change);
+    };
+
+    auto drop = [&](shared_ptr<connection> conn) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        inboundConns.erase(conn->fd);
+        conn->markDead();
+        log(DEBUG) << "connection/ closed connection from " << conn->node;
+    };
+
+    struct epoll_event events[MAXEVENTS];
+
+    // keep listening for incoming connections and frames
+    while(1) {
+        int ready = epoll_wait(epollFd, events, MAXEVENTS, -1);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait failed");
+            }
+            continue;
+        }
+
+        for (int i=0; i < ready; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == listenFd) {
+                while (1) {
+                    struct sockaddr_in theirAddr;
+                    socklen_t theirAddrLen = sizeof(theirAddr);
+                    int newConnFd = accept4(listenFd, (struct sockaddr *) &theirAddr, &theirAddrLen, SOCK_NONBLOCK);
+
+                    if (newConnFd < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            perror("Cannot accept incoming connection");
+                        }
+                        break;
+                    }
+                    int YES = 1;
+                    setsockopt(newConnFd, IPPROTO_TCP, TCP_NODELAY, &YES, sizeof(int));
+
+                    auto node = nodeOf(ntohl(theirAddr.sin_addr.s_addr));
+                    log(DEBUG) << "connection/ accepted connection from " << node;
+
+                    inboundConns[newConnFd] = make_shared<connection>(newConnFd, node, true, *this);
+                    struct epoll_event added;
+                    memset(&added, 0, sizeof(added));
+                    added.events = EPOLLIN;
+                    added.data.fd = newConnFd;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, newConnFd, &added);
+                }
+
+            } else if (fd == wakeFd) {
+                uint64_t count;
+                while (::read(wakeFd, &count, sizeof(count)) < 0 && errno == EINTR) {}
+
+                vector<shared_ptr<connection>> resumed;
+                {
+                    lock_guard<mutex> lk(resumableMutex);
+                    resumed.swap(resumable);
+                }
+                for (auto& conn : resumed) {
+                    auto it = inboundConns.find(conn->fd);
+                    if (it == inboundConns.end() || it->second != conn) {
+                        continue;
+                    }
+                    if (conn->resume()) {
+                        watch(conn->fd, EPOLLIN);
+                    }
+                }
+
+            } else {
+                auto it = inboundConns.find(fd);
+                if (it == inboundConns.end()) {
+                    continue;
+                }
+                auto conn = it->second;
+
+                if (conn->isPaused()) {
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        drop(conn);
+                    }
+                } else if (!conn->readAvailable()) {
+                    drop(conn);
+                } else if (conn->isPaused()) {
+                    // a request is full, stop reading until it catches up. Bulk transfers have their
+                    // own connections, only the transfers sharing this one wait with it
+                    watch(fd, 0);
+                }
+            }
+        }
+    }
+}
+
+
+void connectionManager::dispatch(shared_ptr<request> req, bool bulk) {
+    auto start = [this](shared_ptr<request> req) {
+        {
+            lock_guard<mutex> lk(req->queue->m);
+            if (req->queue->started) {
+                return;
+            }
+            req->queue->started = true;
+            req->queue->onStall = nullptr;
+        }
+        handler(req);
+    };
+    // a request that fills its queue before a worker is free stops its connection from being
+    // read, it gets a thread of its own instead of waiting behind requests that may need that
+    weak_ptr<request> queued = req;
+    {
+        lock_guard<mutex> lk(req->queue->m);
+        req->queue->onStall = [start, queued]{
+            if (auto req = queued.lock()) {
+                thread startThread(start, req);
+                startThread.detach();  // let this run on its own
+            }
+        };
+    }
+    auto& workers = bulk ? bulkWorkers : controlWorkers;
+    workers->submit([start, req]{ start(req); });
+}
+
+
+bool connectionManager::isBulk(const string& firstFrame, bool ended) {
+    return bulkClassifier ? bulkClassifier(firstFrame, ended) : !ended;
+}
+
+
+void connectionManager::countSent(size_t raw, size_t wire) {
+    rawBytes += raw;
+    wireBytes += wire;
+}
+
+
+void connectionManager::resumeLater(shared_ptr<connection> conn) {
+    {
+        lock_guard<mutex> lk(resumableMutex);
+        resumable.push_back(conn);
+    }
+    uint64_t one = 1;
+    while (::write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+
+void connectionManager::dropConnection(int node, connection* conn) {
+    lock_guard<mutex> lk(peersMutex);
+    for (auto conns : {&peers, &bulkPeers}) {
+        auto it = conns->find(node);
+        if (it != conns->end() && it->second.get() == conn) {
+            conns->erase(it);
+        }
+    }
+}
+
+
+int connectionManager::connectToServer(int node) {
+    int connFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connFd < 0) {
+        log(ERROR) << "connection/ cannot open socket";
+        return -1;
+    }
+    // requests are written frame by frame, don't hold small frames back
+    int YES = 1;
+    setsockopt(connFd, IPPROTO_TCP, TCP_NODELAY, &YES, sizeof(int));
+
+    struct sockaddr_in servAddr;
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_port = htons(port);
+    servAddr.sin_addr.s_addr = htonl(ipOf(node));
+
+    if (connect(connFd, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0) {
+        log(INFO) << "connection/ cannot connect to " << node;
+        close(connFd);
+        return -1;
+    }
+    return connFd;
+}
@@ -0,0 +1,588 @@
+/*
+ * @file connection.h
+ * @date Oct 18, 2026
+ *
+ */
+
+#pragma once
+
+#include "../logger/logger.h"
+#include "../util/lz.h"
+#include "../util/util.h"
+#include "../util/worker_pool.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t FRAME_END = 1;       // last frame one side sends for a request
+constexpr uint32_t FRAME_REPLY = 2;     // frame goes back to the node that opened the request
+constexpr uint32_t FRAME_HELLO = 4;     // first frame of a connection, carries the features of its sender
+constexpr uint32_t FRAME_CODED = 8;     // payload is the raw length (32 bit) and an lz block
+constexpr uint32_t FEATURE_LZ = 1;      // node decodes FRAME_CODED frames
+constexpr size_t MINCODED = 512;        // smaller frames are never compressed
+constexpr size_t CODEDCUTOFF = 8;       // a frame is sent coded only if that saves 1/CODEDCUTOFF of it
+constexpr int CODEDBACKOFF = 16;        // frames sent raw after one did not compress
+constexpr int FRAMEHEADERSIZE = 12;     // request id, flags, payload length
+constexpr size_t MAXBUFFERED = 1 << 20; // bytes a request buffers before its connection stops reading
+constexpr size_t MAXFRAMESIZE = 1 << 20; // larger writes are split into several frames
+constexpr size_t READSIZE = 64 * 1024;  // bytes the server reads from a connection at a time
+constexpr int MAXEVENTS = 64;           // epoll events the server handles per wakeup
+
+class connection;
+class connectionManager;
+
+
+/*
+ * Data received for one request, filled by the reader of the connection and
+ * drained by the thread working on the request.
+ *
+ */
+struct frameQueue {
+    mutex m;
+    condition_variable cv;
+    deque<pair<string, bool>> chunks;  // payloads and whether they are still coded
+    size_t readOffset = 0;  // bytes of chunks.front() already read
+    size_t buffered = 0;    // bytes waiting in chunks
+    bool ended = false;     // other side sent FRAME_END
+    bool failed = false;    // connection broke
+    bool closed = false;    // nobody reads this request anymore
+    bool started = false;   // a worker is running the request
+    bool stalled = false;   // a frame was refused, call onDrain once there is room
+
+    /*
+     * tells the server it can read the connection again
+     *
+     */
+    function<void()> onDrain;
+
+    /*
+     * runs the request at once, called when it refuses a frame before a worker took it
+     *
+     */
+    function<void()> onStall;
+
+    /*
+     * append a frame, blocks while too much data is waiting to be read.
+     *
+     */
+    void deliver(string data, bool last, bool coded);
+
+    /*
+     * append a frame unless too much data is waiting. A request still waiting for a
+     * worker is started by onStall when it refuses one, the requests that run may be
+     * waiting for the connection it holds up.
+     * @return false if the frame was refused, onDrain is called when it fits
+     *
+     */
+    bool tryDeliver(string& data, bool last, bool coded);
+
+    /*
+     * call onDrain if a frame was refused and the request can take data again
+     *
+     */
+    void drained(unique_lock<mutex>& lk);
+
+    /*
+     * wake up every reader, no more data will arrive
+     *
+     */
+    void fail();
+};
+
+
+/*
+ * One framed request multiplexed with others over a long lived peer connection.
+ * The node that opens a request writes it and reads the reply, the node that receives it
+ * reads the request and writes the reply. read() behaves like read() on a socket: it returns
+ * what is available, 0 once the other side has finished and -1 if the connection broke.
+ *
+ */
+class request {
+
+public:
+
+request(shared_ptr<connection> conn, uint32_t id, bool inbound, int node);
+
+/*
+ * close the request, frames that arrive for it later are dropped
+ *
+ */
+~request();
+
+/*
+ * read up to len bytes of the request (or of the reply for the opener)
+ *
+ */
+ssize_t read(char* buf, size_t len);
+
+/*
+ * read exactly len bytes
+ *
+ */
+bool readAll(char* buf, size_t len);
+
+/*
+ * like read() but hands over the next frame as it is instead of copying it, unless it
+ * is longer than len or partly read already
+ *
+ */
+ssize_t readFrame(string& frame, size_t len);
+
+/*
+ * send buf as one frame, last marks the end of what this side sends
+ *
+ */
+bool write(const char* buf, size_t len, bool last = false);
+
+/*
+ * send length bytes of file fd from offset with sendfile, the kernel copies them from the
+ * page cache to the socket. The frames are never compressed.
+ *
+ */
+bool sendFile(int fd, uint64_t offset, uint64_t length);
+
+/*
+ * tell the other side that nothing more will be sent
+ *
+ */
+bool finish();
+
+/*
+ * compress the frames written from now on if the peer can decode them. Frames that
+ * do not shrink by 1/CODEDCUTOFF are sent as they are and the next CODEDBACKOFF
+ * frames are not tried, the first frame of a request is always sent raw.
+ *
+ */
+void compress(bool on);
+
+/*
+ * node on the other side of the request
+ *
+ */
+int node;
+
+/*
+ * id of the request on its connection
+ *
+ */
+uint32_t id;
+
+private:
+
+shared_ptr<connection> conn;
+
+shared_ptr<frameQueue> queue;
+
+/*
+ * true if the other node opened this request
+ *
+ */
+bool inbound;
+
+/*
+ * FRAME_END has been sent
+ *
+ */
+bool finished;
+
+/*
+ * frames written so far
+ *
+ */
+uint64_t frames;
+
+bool compressing;
+
+/*
+ * frames left to send raw before compression is tried again
+ *
+ */
+int backoff;
+
+/*
+ * compressed frame, kept to reuse its memory
+ *
+ */
+string coded;
+
+/*
+ * move a request this node opens to the bulk connection of its node before its first
+ * frame goes out if that frame starts a bulk transfer, so the server pausing a full
+ * transfer does not hold up the control requests of the same peer
+ *
+ */
+void bind(const char* firstFrame, size_t len, bool last);
+
+/*
+ * write one frame, coded if that is worth it
+ *
+ */
+bool writeFrame(uint32_t flags, const char* buf, size_t len);
+
+/*
+ * decode the frame at the front of the queue, queue->m must be held
+ *
+ */
+bool decodeFront();
+
+/*
+ * wait until a frame arrives or the request ends, queue->m must be held. Waiting for
+ * the reply of another node does not take up a worker of the server.
+ *
+ */
+void waitForFrame(unique_lock<mutex>& lk);
+
+friend class connection;
+friend class connectionManager;
+};
+
+
+/*
+ * A TCP connection to a peer carrying many requests at once. Every frame is
+ * id, flags, length followed by length bytes of payload. Requests are only opened
+ * by the node that connected. Its replies are read by a thread per connection,
+ * connections peers open are read by the server's epoll loop.
+ *
+ */
+class connection : public enable_shared_from_this<connection> {
+
+public:
+
+connection(int fd, int node, bool inbound, connectionManager& manager);
+
+~connection();
+
+/*
+ * start a new request on this connection
+ *
+ */
+shared_ptr<request> open();
+
+/*
+ * write one frame, frames of different requests never interleave mid frame
+ *
+ */
+bool writeFrame(uint32_t id, uint32_t flags, const char* buf, size_t len);
+
+/*
+ * write one frame whose payload is len bytes of file fd from offset
+ *
+ */
+bool writeFileFrame(uint32_t id, uint32_t flags, int fileFd, off_t offset, size_t len);
+
+/*
+ * read frames until the connection breaks
+ *
+ */
+void readFrames();
+
+/*
+ * read what the non-blocking socket has and hand out every complete frame,
+ * stops early when a request refuses a frame
+ * @return false if the connection broke
+ *
+ */
+bool readAvailable();
+
+/*
+ * hand out the refused frame and the ones read after it
+ * @return false if a request still refuses its frame
+ *
+ */
+bool resume();
+
+/*
+ * a frame is waiting for its request to make room
+ *
+ */
+bool isPaused();
+
+/*
+ * drop the queue of a request that has been closed
+ * @param peerEnded false when the peer may still send frames of an inbound request
+ *
+ */
+void forget(uint32_t id, bool inbound, bool peerEnded);
+
+/*
+ * connection broke, fail every request on it
+ *
+ */
+void markDead();
+
+bool isAlive();
+
+/*
+ * write the features of this node to the peer, the connecting side starts with it
+ *
+ */
+void hello();
+
+int node;
+
+int fd;
+
+/*
+ * the peer decodes FRAME_CODED frames, known once its hello has arrived
+ *
+ */
+atomic<bool> coding;
+
+private:
+
+/*
+ * take the features of the peer from its hello, the server answers with its own
+ *
+ */
+void recvHello(const string& payload);
+
+/*
+ * find the queue of a frame, a new request is created for a new id
+ * @return nullptr if the request has been closed on this side
+ *
+ */
+shared_ptr<frameQueue> route(uint32_t id, uint32_t flags, shared_ptr<request>& newRequest);
+
+/*
+ * hand out complete frames of readBuf
+ * @return false if a request refused its frame
+ *
+ */
+bool parseFrames();
+
+/*
+ * true if the peer opened this connection
+ *
+ */
+bool inbound;
+
+atomic<bool> alive;
+
+connectionManager& manager;
+
+mutex writeMutex;
+
+/*
+ * guards the request maps and ids
+ *
+ */
+mutex requestsMutex;
+
+/*
+ * requests opened by this node waiting for replies
+ *
+ */
+map<uint32_t, shared_ptr<frameQueue>> outbound;
+
+/*
+ * requests opened by the peer
+ *
+ */
+map<uint32_t, shared_ptr<frameQueue>> inboundRequests;
+
+uint32_t nextId;
+
+/*
+ * requests of the peer closed here before it ended them, their remaining frames are
+ * dropped. Ids are never reused but concurrent requests can reach the wire out of order,
+ * so an unknown id is always a new request unless it is listed here.
+ *
+ */
+set<uint32_t> closedInbound;
+
+/*
+ * bytes read by the server that do not make a whole frame yet, starting at readOffset
+ *
+ */
+string readBuf;
+
+size_t readOffset;
+
+/*
+ * frame a request refused, it goes first once the request makes room
+ *
+ */
+shared_ptr<frameQueue> heldQueue;
+
+string heldPayload;
+
+bool heldLast;
+
+bool heldCoded;
+
+friend class request;
+};
+
+
+/*
+ * Keeps two long lived connections to every peer, one for control messages and one for
+ * bulk transfers, and reconnects after a failure. Outgoing messages are sent as requests
+ * over these connections instead of a new connect() for every message. serve() accepts connections from peers and
+ * reads all of them from one epoll loop. Requests they open run on two bounded
+ * worker pools, one for short control messages and one for bulk transfers, so a
+ * few large files cannot hold up metadata requests.
+ *
+ */
+class connectionManager {
+
+public:
+
+/*
+ * @param port port of the peers' servers
+ * @param ipOf IP address of a node
+ * @param nodeOf number of the node with an IP address
+ *
+ */
+connectionManager(uint16_t port, logger& logg, function<uint32_t(int)> ipOf, function<int(uint32_t)> nodeOf);
+
+/*
+ * open a request to node, connecting first if there is no live connection
+ * @return nullptr if node cannot be reached
+ *
+ */
+shared_ptr<request> open(int node);
+
+/*
+ * send a message that fits in one frame and expects no reply
+ *
+ */
+bool send(int node, const char* message, size_t len);
+
+/*
+ * the live control or bulk connection to node, connecting first if there is none
+ * @return nullptr if node cannot be reached
+ *
+ */
+shared_ptr<connection> connectionTo(int node, bool bulk = false);
+
+/*
+ * accept connections on listenFd and read them forever, handler is run on a
+ * worker for every request peers open
+ * @param isBulk true if a request moves a lot of data given its first frame and
+ *        whether the sender finished with it, by default requests that span
+ *        several frames are bulk
+ *
+ */
+void serve(int listenFd, function<void(shared_ptr<request>)> handler,
+           function<bool(const string&, bool)> isBulk = nullptr);
+
+/*
+ * run handler for a new request on one of the worker pools
+ *
+ */
+void dispatch(shared_ptr<request> req, bool bulk);
+
+/*
+ * true if a new request with this first frame goes to the bulk workers, and a request
+ * this node opens to the bulk connection
+ *
+ */
+bool isBulk(const string& firstFrame, bool ended);
+
+/*
+ * count a frame of raw bytes that went out as wire bytes
+ *
+ */
+void countSent(size_t raw, size_t wire);
+
+/*
+ * ask the server loop to hand out the refused frame of conn
+ *
+ */
+void resumeLater(shared_ptr<connection> conn);
+
+/*
+ * forget a broken connection so the next open() reconnects
+ *
+ */
+void dropConnection(int node, connection* conn);
+
+logger& log;
+
+/*
+ * features this node offers in its hello
+ *
+ */
+const uint32_t features;
+
+/*
+ * bytes written by requests that compress and what went over the wire for them
+ *
+ */
+atomic<uint64_t> rawBytes;
+
+atomic<uint64_t> wireBytes;
+
+private:
+
+/*
+ * connect to node
+ * @return socket or -1
+ *
+ */
+int connectToServer(int node);
+
+uint16_t port;
+
+function<uint32_t(int)> ipOf;
+
+function<int(uint32_t)> nodeOf;
+
+function<void(shared_ptr<request>)> handler;
+
+function<bool(const string&, bool)> bulkClassifier;
+
+/*
+ * workers for control messages and bulk transfers, created by serve()
+ *
+ */
+unique_ptr<workerPool> controlWorkers;
+
+unique_ptr<workerPool> bulkWorkers;
+
+/*
+ * eventfd waking the server loop when paused connections can be read again
+ *
+ */
+int wakeFd;
+
+vector<shared_ptr<connection>> resumable;
+
+mutex resumableMutex;
+
+/*
+ * live connections to peers, for control messages and for bulk transfers
+ *
+ */
+map<int, shared_ptr<connection>> peers;
+
+map<int, shared_ptr<connection>> bulkPeers;
+
+mutex peersMutex;
+};
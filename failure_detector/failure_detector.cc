@@ -12,7 +12,9 @@ const string VMPREFIX ="shahzad-";
 
 
 failureDetector::failureDetector(int number, logger &logg, sdfs* fs)
-: myNumber{number}, log(logg) {
+: mjConns{PORT3, logg, [this](int node){ return IPAddrs[node]; },
+          [this](uint32_t IP){ return getNodeNumber(IP); }},
+  myNumber{number}, log(logg) {
 
     myBirthTime = timeNow();
     log(INFO) << "My VM Number is " << myNumber;
@@ -58,7 +60,7 @@ void failureDetector::recvMessages() {
             offset += sizeof(theirIP);
 
             log(INFO) << "New node asking to join the system with ID " << theirBirthTime;
-            list[theirBirthTime] = theirIP;  // update list
+            addMember(theirBirthTime, theirIP);  // update list
             log(INFO) << "Added " << theirBirthTime << " to the membership list";
             strcpy(sendBuf, "LIST");
             size = 4;
@@ -110,7 +112,7 @@ void failureDetector::recvMessages() {
             auto it = list.find(theirBirthTime);
             if(it == list.end()) {  // if new then gossip about it
                 log(INFO) << "New node with id " << theirBirthTime << " joined the system.";
-                list[theirBirthTime] = theirIP;  // update list
+                addMember(theirBirthTime, theirIP);  // update list
                 log(INFO) << "Added new node " << theirBirthTime << " to the list.";
 
                 fileSystem->newNode(getNodeNumber(theirIP));    // tell sdfs of new node
@@ -154,11 +156,12 @@ void failureDetector::recvMessages() {
                 memcpy(&IP, recvBuf+offset, sizeof(IP));
                 offset += sizeof(IP);
                 IP = ntohl(IP);
-                list[ntohll(birthTime)] = IP;
+                addMember(ntohll(birthTime), IP);
 
-                fileSystem->newNode(getNodeNumber(IP));    // tell sdfs of new node
+                fileSystem->newNode(getNodeNumber(IP), false);    // tell sdfs of the members it joins
             }
             log(INFO) << "Seccessfully joined the system.";
+            fileSystem->joined();
 
         } else if(strncmp(recvBuf, "LEAV", 4) == 0 || strncmp(recvBuf, "FAIL", 4) == 0 ) { // leave or fail message
             offset = 4;
@@ -210,6 +213,17 @@ void failureDetector::recvMessages() {
             int node = getNodeNumber(theirIP);
             ackRecvd[node] = true;
 
+            // the ack carries back the time the ping was sent
+            uint64_t sentTime;
+            if (numBytes >= offset + static_cast<int>(sizeof(sentTime))) {
+                memcpy(&sentTime, recvBuf+offset, sizeof(sentTime));
+                sentTime = ntohll(sentTime);
+                auto now = timeNow();
+                if (sentTime <= now) {
+                    fileSystem->peerPinged(node, now - sentTime);
+                }
+            }
+
         } else if(strncmp(recvBuf, "PINR", 4) == 0) { // PING Request
             offset = 4;
             int target;
@@ -261,24 +275,20 @@ void failureDetector::updateSdfs(int node) {
 
 void failureDetector::updateMapleJuice(int node) {
     //MJ: tells MJ one node failed
-    int connToServer;
-    int status = connectToServer(myNumber, &connToServer);
-    if(status) {
-        cout <<"failureDetector cannot connect to MJ " << endl;
+    char message[20];
 
-    } else {
-        char message[20];
-        
-        strcpy(message, "FAMJ");
-        int offset = 4;
+    strcpy(message, "FAMJ");
+    int offset = 4;
 
-        int failNode = htonl(node); 
-        memcpy(message+offset, &failNode, sizeof(failNode));
-        offset += sizeof(failNode);
+    int failNode = htonl(node);
+    memcpy(message+offset, &failNode, sizeof(failNode));
+    offset += sizeof(failNode);
 
-        write(connToServer, message, offset);
+    if (!mjConns.send(myNumber, message, offset)) {
+        cout <<"failureDetector cannot connect to MJ " << endl;
+
+    } else {
         cout << "failureDetector informed MJfailure of " << node <<endl;
-        close(connToServer);
     }
 }
 
@@ -364,6 +374,10 @@ void failureDetector::createSocket() {
     bindAddr.sin_family = AF_INET;
     bindAddr.sin_port = htons(PORT);
     myIP = getIP(myName);
+    if (myIP == 0) {
+        log(ERROR) << "Could not get IP from hostname " << myName;
+        exit(8);
+    }
 
     struct in_addr tmp;
     tmp.s_addr = htonl(myIP);
@@ -399,6 +413,9 @@ void failureDetector::fillAddrs() {
         nodeAddrs[i].sin_family = AF_INET;
         nodeAddrs[i].sin_port = htons(PORT);
         IPAddrs[i] = getIP(hostName);
+        if (IPAddrs[i] != 0) {
+            nodeNumbers.emplace(IPAddrs[i], i);
+        }
 
         struct in_addr tmp;
         tmp.s_addr = htonl(IPAddrs[i]);
@@ -428,7 +445,7 @@ void failureDetector::sendPING() {
             ackRecvd[node] = false;
             sentTime = timeNow();
             sentTime = htonll(sentTime);
-            memcpy(&sentTime, sendBuf+size, sizeof(sentTime));
+            memcpy(sendBuf+size, &sentTime, sizeof(sentTime));
             size += sizeof(sentTime);
 
             sendto(sockFd, sendBuf, size, 0, (struct sockaddr*)&nodeAddrs[node], sizeof(nodeAddrs[node]));
@@ -455,7 +472,7 @@ void failureDetector::sendIndirectPINGS(int target) {
         copyMyID(sendBuf, size);
         uint64_t sentTime = timeNow();
         sentTime = htonll(sentTime);
-        memcpy(&sentTime, sendBuf+size, sizeof(sentTime));
+        memcpy(sendBuf+size, &sentTime, sizeof(sentTime));
         size += sizeof(sentTime);
 
         sendto(sockFd, sendBuf, size, 0, (struct sockaddr*)&nodeAddrs[target], sizeof(nodeAddrs[target]));
@@ -534,6 +551,21 @@ void failureDetector::sendIndirectPINGS(int target) {
 }
 
 
+void failureDetector::addMember(uint64_t birthTime, uint32_t IP) {
+    for (auto it = list.begin(); it != list.end(); ) {
+        if (it->second != IP || it->first == birthTime) {
+            ++it;
+        } else if (it->first > birthTime) {
+            return;     // gossip about an incarnation that was already replaced
+        } else {
+            log(INFO) << it->first << " rejoined as " << birthTime;
+            it = list.erase(it);
+        }
+    }
+    list[birthTime] = IP;
+}
+
+
 void failureDetector::copyMyID(char* buf, int &size) {
     uint64_t copiedBirthTime = htonll(myBirthTime);
     memcpy(buf+size, &copiedBirthTime, sizeof(copiedBirthTime));
@@ -560,11 +592,8 @@ int failureDetector::getRandomNode() {
 
 
 int failureDetector::getNodeNumber(uint32_t IP) {
-    for(int i=1; i<=NODES; ++i) {
-        if (IPAddrs[i]==IP)
-            return i;
-    }
-    return 0;
+    auto it = nodeNumbers.find(IP);
+    return it != nodeNumbers.end() ? it->second : 0;
 }
 
 
@@ -573,9 +602,9 @@ uint32_t failureDetector::getIP(const string &hostname) {
     struct in_addr **addr_list;
 
     if ( !(he = gethostbyname( hostname.c_str() ) )) {
-        // get the host info
-        log(ERROR) << "Could not get IP from hostname";
-        exit(8);
+        // get the host info, with large NODES most names may not exist
+        log(DEBUG) << "Could not get IP from hostname " << hostname;
+        return 0;
     }
     addr_list = (struct in_addr **) he->h_addr_list;
     for(int i = 0; addr_list[i] != nullptr; ++i) {
@@ -617,48 +646,3 @@ void failureDetector::printList() {
         cout << it->first << "   " << inet_ntoa(ipAddr) << endl;
     }
 }
-
-
-int failureDetector::connectToServer(int targetNode, int *connectionFd) {
-    struct in_addr tmp;
-    tmp.s_addr = htonl(IPAddrs[targetNode]);
-    auto IP = inet_ntoa(tmp);
-
-    //create client skt
-    *connectionFd = socket(AF_INET, SOCK_STREAM, 0);
-
-    // allow address reuse
-    int YES = 1;
-    setsockopt(sockFd, SOL_SOCKET, SO_REUSEADDR, &YES, sizeof(int));
-
-    // open socket
-    if(*connectionFd < 0) {
-        cout << "Cannot open socket" << endl;
-        exit(1);
-    }
-
-    //Variables Declaration
-    struct addrinfo hints, * res;
-    int status;
-
-    //clear hints
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    auto portStr = to_string(PORT3);
-    status = getaddrinfo(IP, portStr.c_str(), &hints, &res);
-    if (status != 0) {
-        fprintf(stderr, "[FailureDetector::connectToServer] Error getaddrinfo\n");
-        exit(1);
-    }
-
-    status = connect(*connectionFd, res->ai_addr, res->ai_addrlen);
-    if (status < 0) {
-        cout << "[FailureDetector::connectToServer] Cannot connect to: " << targetNode << endl;
-        cout.flush();
-        return -1;
-    }
-    return 0;
-}
-
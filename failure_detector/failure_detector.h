@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include "../connection/connection.h"
 #include "../logger/logger.h"
 
 #include <algorithm>
@@ -35,7 +36,10 @@ using namespace std;
 
 constexpr int MAXDATASIZE = 5000;
 constexpr uint16_t PORT = 7777;
-constexpr int NODES = 10;   // potential number of nodes in the system
+#ifndef SDFS_NODES
+#define SDFS_NODES 10
+#endif
+constexpr int NODES = SDFS_NODES;   // potential number of nodes in the system, make NODES=<n> to change
 constexpr int K = 3;        // number of nodes to ask for ping, see SWIM protocol paper
 constexpr uint16_t PORT3 = 5555;
 
@@ -106,12 +110,26 @@ uint64_t getBirthTime();
  */
 void printList();
 
+/*
+ * get the number of node given its IP address.
+ * @param IP IP address of the node.
+ * @return number of the node.
+ *
+ */
+int getNodeNumber(uint32_t IP);
+
 /*
  * IPAddrs of all the potential nodes in the system
  *
  */
 array<uint32_t, NODES+1> IPAddrs;
 
+/*
+ * number of the node with an IP address, filled with IPAddrs
+ *
+ */
+map<uint32_t, int> nodeNumbers;
+
 /*
  * membership list containing birth time and IP addresses of alive nodes.
  *
@@ -143,6 +161,14 @@ void fillAddrs();
 
 void sendIndirectPINGS(int target);
 
+/*
+ * add a member to the list. A node restarted with its old state rejoins under a new
+ * birth time before anyone noticed it went away, so older entries with the same IP
+ * are dropped instead of being detected as failed later on.
+ *
+ */
+void addMember(uint64_t birthTime, uint32_t IP);
+
 /*
  * copy the id of the node consisting of birth time and ip address to the buf and update the
  * size variable.
@@ -159,14 +185,6 @@ void copyMyID(char* buf, int &size);
  */
 int getRandomNode();
 
-/*
- * get the number of node given its IP address.
- * @param IP IP address of the node.
- * @return number of the node.
- *
- */
-int getNodeNumber(uint32_t IP);
-
 /*
  * get IP address of host given its name.
  * @param hostname name of the node.
@@ -194,10 +212,10 @@ void updateFileSystem(int node);
 struct sockaddr_in nodeAddrs[NODES+1];
 
 /*
- * connect to server at targetNode
+ * connection to the mapleJuice server of this node
  *
  */
-int connectToServer(int targetNode, int *connectionFd);
+connectionManager mjConns;
 
 /*
  * birthTime of this node
@@ -18,7 +18,10 @@ const string VMPREFIX = "shahzad-";
 
 
 mapleJuice::mapleJuice(int number, logger & logg)
-: fs{number, logg}, log(logg) {
+: fs{number, logg},
+  conns{PORT3, logg, [this](int node){ return fs.fd->IPAddrs[node]; },
+        [this](uint32_t IP){ return fs.getNodeNumber(IP); }},
+  log(logg) {
 
     createSocket();
     isMaster = false;
@@ -26,72 +29,66 @@ mapleJuice::mapleJuice(int number, logger & logg)
 
 
 void mapleJuice::recvMessages() {
-    char recvBuf[MAXDATASIZE];
-    int numBytes, senderNode;
-    struct sockaddr_in theirAddr;
-    socklen_t theirAddrLen = sizeof(theirAddr);
+    conns.serve(sockFd, [this](shared_ptr<request> req){ handleMessage(req); });
+}
 
-    listen(sockFd, 10);
 
-    // keep listening for incoming connections
-    while(1) {
-        int newConnFd = -1;
-        newConnFd = accept(sockFd, (struct sockaddr *) &theirAddr, &theirAddrLen);
-
-        if (newConnFd < 0) {
-            perror("Cannot accept incoming connection");
-        }
+void mapleJuice::handleMessage(shared_ptr<request> req) {
+    char recvBuf[MAXDATASIZE];
+    int numBytes, senderNode;
 
-        numBytes = read(newConnFd, recvBuf, MAXDATASIZE - 1);
-        recvBuf[numBytes] = '\0';
-        senderNode = fs.getNodeNumber(ntohl(theirAddr.sin_addr.s_addr));
+    numBytes = req->read(recvBuf, MAXDATASIZE - 1);
+    if (numBytes <= 0) {
+        return;
+    }
+    recvBuf[numBytes] = '\0';
+    senderNode = req->node;
 
-        if (strncmp(recvBuf, "MAPL", 4) == 0) { // Maple jobs
-            log(INFO) << "mapleJuice/ received a maple job";
+    if (strncmp(recvBuf, "MAPL", 4) == 0) { // Maple jobs
+        log(INFO) << "mapleJuice/ received a maple job";
 
-            handleMapleJob(recvBuf+4, senderNode);
+        handleMapleJob(recvBuf+4, senderNode);
 
-        } else if (strncmp(recvBuf, "MAPD", 4) == 0) { // maple job is done by a worker
-            log(INFO) << "mapleJuice/ node " << senderNode << " has finished maple job";
-            handleMapleJobDone(senderNode);
+    } else if (strncmp(recvBuf, "MAPD", 4) == 0) { // maple job is done by a worker
+        log(INFO) << "mapleJuice/ node " << senderNode << " has finished maple job";
+        handleMapleJobDone(senderNode);
 
-        } else if(strncmp(recvBuf, "JUIC", 4) == 0) { // Juice jobs{
-            log(INFO) << "mapleJuice/ received a juice job";
-            handleJuiceJob(recvBuf+4, senderNode);
+    } else if(strncmp(recvBuf, "JUIC", 4) == 0) { // Juice jobs{
+        log(INFO) << "mapleJuice/ received a juice job";
+        handleJuiceJob(recvBuf+4, senderNode);
+        req->write("ACKJ", 4, true);
 
-        } else if (strncmp(recvBuf, "JUID", 4) == 0)  { //Some Juice job is done by one juicer
-            log(INFO) << "mapleJuice/ node " << senderNode << " has finished juice job";
-            handleJuiceJobDone(senderNode);
+    } else if (strncmp(recvBuf, "JUID", 4) == 0)  { //Some Juice job is done by one juicer
+        log(INFO) << "mapleJuice/ node " << senderNode << " has finished juice job";
+        handleJuiceJobDone(senderNode);
 
-        } else if (strncmp(recvBuf, "FAMJ", 4) == 0)  {
-            int offset = 4;
-            int failNode;
-            memcpy(&failNode, recvBuf+offset, sizeof(failNode));
-            failNode = ntohl(failNode);
+    } else if (strncmp(recvBuf, "FAMJ", 4) == 0)  {
+        int offset = 4;
+        int failNode;
+        memcpy(&failNode, recvBuf+offset, sizeof(failNode));
+        failNode = ntohl(failNode);
 
-            cout<< "node " << failNode << " failed" << endl;
-            if (isMaster) {
-                handleFailure(failNode);
-            }
-            
-        } else {
-        // unrecongnized message
-            log(ERROR) << "Unkown message: " << recvBuf;
-            exit(2);
+        cout<< "node " << failNode << " failed" << endl;
+        if (isMaster) {
+            handleFailure(failNode);
         }
-        close(newConnFd);
 
+    } else { // unrecongnized message, the request ends without an answer and fails at the sender
+        log(ERROR) << "mapleJuice/ unknown message " << string(recvBuf, min(numBytes, 4)) << " from " << senderNode;
     }
 }
 
 
 void mapleJuice::handleFailure(int failNode) {
     cout << "MJ master handing failure " << failNode << endl;
-    if (filesAllottedForMaple.find(failNode) == filesAllottedForMaple.end()) {
-        return; 
+    maple m;
+    {
+        lock_guard<mutex> lk(jobsMutex);
+        if (filesAllottedForMaple.find(failNode) == filesAllottedForMaple.end() || mapleQ.empty()) {
+            return;
+        }
+        m = mapleQ.front();
     }
-    
-    auto m = mapleQ.front();
 
     thread sendMapleJobForFailThread(&mapleJuice::sendMapleJobForFailNode, this, m, failNode);
     sendMapleJobForFailThread.detach();  // let this run on its own    
@@ -99,9 +96,14 @@ void mapleJuice::handleFailure(int failNode) {
 
 
 void mapleJuice::handleMapleJobDone(int node) {
-    filesAllottedForMaple.erase(node);
+    bool done;
+    {
+        lock_guard<mutex> lk(jobsMutex);
+        filesAllottedForMaple.erase(node);
+        done = filesAllottedForMaple.empty();
+    }
 
-    if (filesAllottedForMaple.empty()) {
+    if (done) {
         lock_guard<mutex> lk(cvMapleJobDoneMutex);
         isAllMapleJobsDone = true;
         cout << "Notifying One for Maple Jobs Done" << endl;
@@ -113,14 +115,19 @@ void mapleJuice::handleMapleJobDone(int node) {
 
 
 void mapleJuice::handleJuiceJobDone(int node) {
-    for (auto it = juiceIDs.begin(); it != juiceIDs.end(); it++) {
-        if (it->second == node) {
-            juiceIDs.erase(it);
-            break;
+    bool done;
+    {
+        lock_guard<mutex> lk(jobsMutex);
+        for (auto it = juiceIDs.begin(); it != juiceIDs.end(); it++) {
+            if (it->second == node) {
+                juiceIDs.erase(it);
+                break;
+            }
         }
+        done = juiceIDs.empty();
     }
 
-    if (juiceIDs.empty()) {
+    if (done) {
         lock_guard<mutex> lk(cvJuiceJobDoneMutex);
         isAllJuiceJobsDone = true;
         cout << "Notifying One for Juice Jobs Done" << endl;
@@ -135,11 +142,7 @@ void mapleJuice::handleJuiceJob(char* buf, int senderNode) {
     cout << "mapleJuice/ handleJuiceJob assigned by " << senderNode << endl;
 
     //setting up set for expect sources of juice input files
-    for (int i=1; i < NODES+1; i++) {
-        if (fs.ring[i]) {
-            fs.juiceFilesNotifications.insert(i);
-        }
-    }
+    fs.expectJuiceFiles();
 
     juice j;
     int offset = 0;
@@ -229,15 +232,11 @@ void mapleJuice::sendJuiceDoneMessage(int node) {
     char message[10];
     strcpy(message, "JUID");
     int offset = 4;
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
+    if (!conns.send(node, message, offset)) {
         cout <<"sendJuiceJobDoneMessage: Cannot connect to node "<< node << endl;
 
     } else {
-        log() << "mapleJuice/ sending juice job done message to " << node;
-        write(connToServer, message, offset);
-        close(connToServer);
+        log() << "mapleJuice/ sent juice job done message to " << node;
     }
 }
 
@@ -276,6 +275,7 @@ void mapleJuice::handleMapleJob(char* buf, int node) {
     fileCount = ntohl(fileCount);
     log() << "mapleJuice/ " << fileCount << " file names recvd for maple job " << m.mapleExe;
 
+    set<string> inputFiles;
     for (int i=0; i < fileCount; i++) {
         int fileNameLen;
         memcpy(&fileNameLen, buf+offset, sizeof(fileNameLen));
@@ -285,21 +285,31 @@ void mapleJuice::handleMapleJob(char* buf, int node) {
         string fileName(buf+offset, fileNameLen);
         offset += fileNameLen;
 
-        fs.mapleFiles.insert(fileName);
+        inputFiles.insert(fileName);
     }
     log() << "mapleJuice/ starting maple job thread for maple job " << m.mapleExe;
-    thread runMapleJobThread(&mapleJuice::runMapleJob, this, m, node);
+    thread runMapleJobThread(&mapleJuice::runMapleJob, this, m, node, inputFiles);
     runMapleJobThread.detach();  // let this run on its own
 }
 
 
-void mapleJuice::runMapleJob(maple m, int node) {
-    for (auto it = fs.mapleFiles.begin(); it != fs.mapleFiles.end(); it++) {
-        fs.fetchFile(*it, *it);
+void mapleJuice::runMapleJob(maple m, int node, set<string> inputFiles) {
+    // the input files are fetched at the same time, the job starts once all of them are here
+    vector<pair<string, future<sdfsReply>>> fetches;
+    for (auto& fileName : inputFiles) {
+        uint64_t id;
+        fetches.emplace_back(fileName, fs.getAsync(fileName, fileName, id));
+    }
+    vector<string> recvdMapleFiles;
+    for (auto& fetch : fetches) {
+        if (fetch.second.get().ok) {
+            recvdMapleFiles.push_back(fetch.first);
+        } else {
+            log(ERROR) << "mapleJuice/ could not fetch maple input " << fetch.first;
+        }
     }
-    fs.recvMapleFiles();
     cout << "maple files recvd\n";
-    for (auto it = fs.recvdMapleFiles.begin(); it !=fs.recvdMapleFiles.end(); it++) {
+    for (auto it = recvdMapleFiles.begin(); it != recvdMapleFiles.end(); it++) {
         cout << *it << endl;
     }
     log() << "mapleJuice/ all maple input files recvd for maple job " << m.mapleExe;
@@ -308,9 +318,21 @@ void mapleJuice::runMapleJob(maple m, int node) {
     system (permCmd.c_str());
 
     string sysMap = "./" + m.mapleExe + " ";
-    string outPrefix = m.sdfsIntermediateFileNamePrefix + "_" + to_string(fs.myNumber) + "_";
+    // containers are named by the inputs of the task, a task run again after a failure replaces the
+    // containers of the first run instead of adding to them
+    string task;
+    for (auto& fileName : inputFiles) {
+        task += fileName;
+        task += '\n';
+    }
+    string outPrefix = m.sdfsIntermediateFileNamePrefix + "_" + to_string(checksum(&task[0], task.size())) + "_";
+    vector<string> outFiles;
 
-    for (auto it = fs.recvdMapleFiles.begin(); it != fs.recvdMapleFiles.end(); it++) {
+    // the lines of every key are collected and written to containers instead of a file per key
+    map<string, string> keyLines;
+    uint64_t buffered = 0;
+
+    for (auto it = recvdMapleFiles.begin(); it != recvdMapleFiles.end(); it++) {
         ifstream file(*it);
         if (!file.good()) {
             cout << "mapleJuice/ runMapleJob: can't open" << *it << endl;
@@ -334,57 +356,72 @@ void mapleJuice::runMapleJob(maple m, int node) {
                         key += line[i];
                     }
                 }
-                //storing key value pair in file
-                ofstream outfile(outPrefix + key, ios::app);
-
-                if (!outfile.good()) {
-                    cout << "mapleJuice/ runMapleJob: can't open" << outPrefix + key << endl;
-                    exit(1);
-                }
-                outfile << line << endl;
-                outfile.close();
-                mapleOutFiles.insert(outPrefix+key);
+                auto& values = keyLines[key];
+                values += line;
+                values += '\n';
+                buffered += line.size() + 1;
+                if (buffered >= PACKBYTES) {
+                    writeMaplePack(outPrefix, keyLines, outFiles);
+                    buffered = 0;
                 }
-            
+            }
+
             lines += 10;
         }
     }
-    fs.recvdMapleFiles.clear();
-    unordered_set<string> deleteThese;
-    storeMapleOutFiles(deleteThese);
+    writeMaplePack(outPrefix, keyLines, outFiles);
+    storeMapleOutFiles(outPrefix, outFiles);
     log() << "mapleJuice/ maple task completed for " << m.mapleExe;
     cout << "mapleJuice/ maple task completed for " << m.mapleExe << endl;
     sendMapleDoneMessage(node);
 }
 
 
-void mapleJuice::storeMapleOutFiles(unordered_set<string>& deleteThese) {
-    bool flag = false;
+void mapleJuice::writeMaplePack(const string& outPrefix, map<string, string>& keyLines, vector<string>& outFiles) {
+    if (keyLines.empty()) {
+        return;
+    }
+    auto fileName = outPrefix + to_string(outFiles.size()) + PACKSUFFIX;
+    if (!packFile::write(fileName, keyLines)) {
+        cout << "mapleJuice/ runMapleJob: can't write " << fileName << endl;
+        exit(1);
+    }
+    log() << "mapleJuice/ wrote " << keyLines.size() << " keys to " << fileName;
+    outFiles.push_back(fileName);
+    keyLines.clear();
+}
+
+
+void mapleJuice::storeMapleOutFiles(const string& outPrefix, const vector<string>& outFiles) {
     cout << "storing maple output files in SDFS" << endl;
     log() << "mapleJuice/ storing maple output files in SDFS";
-    deleteThese.clear();
-    for (auto it = mapleOutFiles.begin(); it != mapleOutFiles.end(); it++) {
-        string fileName = *it;
-        if (fs.storeFile(fileName, fileName)) {
-            flag = true;
-            break;
-        }
-        int node = fs.location(fileName);
-        if (fs.myNumber != node && 
-            fs.myNumber != fs.successorNode(node) && 
-            fs.myNumber != fs.successorNode(fs.successorNode(node))) {
-            deleteThese.insert(fileName);
+    size_t stored = 0;
+    while (stored < outFiles.size()) {
+        if (!fs.storeFile(outFiles[stored], outFiles[stored], true)) {
+            this_thread::sleep_for(chrono::milliseconds(3000));
+            continue;
         }
+        // replicas kept here live in the storage root, the local container is not needed
+        string cmd = "rm -f " + outFiles[stored];
+        system(cmd.c_str());
+        stored++;
     }
-    if (flag) {
+
+    // a failed run of this task may have written more parts than this one, they must not reach the juicers
+    unordered_set<string> current(outFiles.begin(), outFiles.end());
+    vector<string> stale;
+    while (!fs.listFiles(outPrefix, [&](const string& fileName) {
+        if (packFile::isPack(fileName) && !current.count(fileName)) {
+            stale.push_back(fileName);
+        }
+    })) {
+        stale.clear();
         this_thread::sleep_for(chrono::milliseconds(3000));
-        storeMapleOutFiles(deleteThese);
     }
-    for (auto it = deleteThese.begin(); it != deleteThese.end(); it++) {
-        string cmd = "rm -f " + *it;
-        system(cmd.c_str());
+    for (auto& fileName : stale) {
+        log() << "mapleJuice/ deleting " << fileName << " left by an earlier run of this task";
+        fs.deleteFile(fileName);
     }
-    deleteThese.clear();
 }
 
 
@@ -392,22 +429,28 @@ void mapleJuice::sendMapleDoneMessage(int node) {
     char message[10];
     strcpy(message, "MAPD");
     int offset = 4;
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
+    if (!conns.send(node, message, offset)) {
         cout <<"sendMapleJobDoneMessage: Cannot connect to sender node "<< node << endl;
 
     } else {
-        log() << "mapleJuice/ sending maple job done message to " << node;
-        write(connToServer, message, offset);
-        close(connToServer);
+        log() << "mapleJuice/ sent maple job done message to " << node;
     }
 }
 
 
 void mapleJuice::master() {
-    while(!mapleQ.empty()) {
-        auto m = mapleQ.front();
+    while(1) {
+        maple m;
+        {
+            // a job queued after the last check starts a new master once this one is done
+            lock_guard<mutex> lk(jobsMutex);
+            if (mapleQ.empty()) {
+                lock_guard<mutex> _(isMasterMutex);
+                isMaster = false;
+                break;
+            }
+            m = mapleQ.front();
+        }
         int nodes = fs.fd->list.size();
         m.numMaples = min(m.numMaples, nodes-1);
 
@@ -424,7 +467,10 @@ void mapleJuice::master() {
         log() << "mapleJuice/ Sending maple jobs for " << m.mapleExe;
         cout << "Sending maple jobs for " << m.mapleExe << endl;
 
-        isAllMapleJobsDone = false;
+        {
+            lock_guard<mutex> lk(cvMapleJobDoneMutex);
+            isAllMapleJobsDone = false;
+        }
         sendMapleJobs(m);
         log() << "mapleJuice/ Maple jobs sent for " << m.mapleExe;
         cout << "Maple jobs sent for " << m.mapleExe << endl;
@@ -439,20 +485,35 @@ void mapleJuice::master() {
             cout << "all maple jobs are completed\n";
         }
 
-        mapleQ.pop();
-        isJuiceTaskIssued = false;
+        {
+            lock_guard<mutex> lk(cvWaitingForJuiceTaskMutex);
+            isJuiceTaskIssued = false;
+        }
+        bool waitForJuice;
+        {
+            lock_guard<mutex> lk(jobsMutex);
+            mapleQ.pop();
+            waitForJuice = juiceQ.empty();
+        }
         // wait if no juice job in the queue.
-        if (juiceQ.empty()) {
+        if (waitForJuice) {
             unique_lock<mutex> lk(cvWaitingForJuiceTaskMutex);
             log() << "mapleJuice/ waiting for juice task to be issued";
             cout << "Waiting for Juice job to be issued... \n";
             cvWaitingForJuiceTask.wait(lk, [this]{return isJuiceTaskIssued;});
         }
-        auto j = juiceQ.front();
+        juice j;
+        {
+            lock_guard<mutex> lk(jobsMutex);
+            j = juiceQ.front();
+        }
         j.numJuices = min(j.numJuices, nodes-1);
 
         cout << "starting juice job\n";
-        isAllJuiceJobsDone = false;
+        {
+            lock_guard<mutex> lk(cvJuiceJobDoneMutex);
+            isAllJuiceJobsDone = false;
+        }
         log() << "mapleJuice/ Sending juice jobs for " << j.juiceExe;
         cout << "Sending juice jobs for " << j.juiceExe << endl;
 
@@ -460,11 +521,16 @@ void mapleJuice::master() {
         sendJuiceJobs(j);
         cout << "all juice jobs sent" << endl;
         int node = fs.myNumber;
+        unordered_map<int, int> juicers;
         for (int i=0; i<j.numJuices; i++) {
             node = fs.successorNode(node);
-            juiceIDs[i] = node;
+            juicers[i] = node;
         }
-        fs.sendJuiceFilesToJuicers(j.sdfsIntermediateFileNamePrefix, j.numJuices, juiceIDs);
+        {
+            lock_guard<mutex> lk(jobsMutex);
+            juiceIDs = juicers;
+        }
+        fs.sendJuiceFilesToJuicers(j.sdfsIntermediateFileNamePrefix, j.numJuices, juicers);
         log() << "mapleJuice/ Juice jobs sent for " << j.juiceExe;
         cout << "Juice jobs sent for " << j.juiceExe << endl;
         
@@ -482,11 +548,10 @@ void mapleJuice::master() {
         log() << "mapleJuice/ all juice jobs are completed.";
         cout << "all juice jobs are completed\n";
         collectJuiceFiles(j.sdfsDestFileName, j.numJuices);
+        lock_guard<mutex> lk(jobsMutex);
         juiceQ.pop();
     }
 
-    lock_guard<mutex> _(isMasterMutex);
-    isMaster = false;
     cout << "all maple juice tasks are completed" << endl;
 }
 
@@ -560,23 +625,22 @@ void mapleJuice::sendJuiceJobs(const juice& j) {
         // send juice exe to worker
         fs.pushFileToNode(node, j.juiceExe, j.juiceExe, "FILE");
 
-        int connToServer;
-        int status = connectToServer(node, &connToServer);
-        if(status) {
-            cout <<"sendMapleJobs: Cannot connect to "<< node << endl;
-
-        } else {
-            write(connToServer, message, innerOffset);
-            close(connToServer);
+        // the juicer must expect its input before any node is told to send it
+        auto req = conns.open(node);
+        char ack[4];
+        if (!req || !req->write(message, innerOffset, true) || !req->readAll(ack, sizeof(ack)) ||
+            strncmp(ack, "ACKJ", 4) != 0) {
+            cout <<"sendJuiceJobs: Cannot connect to "<< node << endl;
         }
         log() << "mapleJuice/ juice task sent to " << node << " for " << j.juiceExe;
+        lock_guard<mutex> lk(jobsMutex);
         juicerNumber.insert({node, i});
     }
 }
 
 
 int mapleJuice::getFreeNode() {
-    
+    lock_guard<mutex> lk(jobsMutex);
     int node = fs.myNumber;
     while(1) {
         node = fs.successorNode(node);
@@ -628,7 +692,11 @@ void mapleJuice::sendMapleJobForFailNode(const maple &m, int failNode) {
     memcpy(message+offset, &fileCount, sizeof(fileCount));
     offset += sizeof(fileCount);
 
-    auto fileRange = filesAllottedForMaple[failNode];
+    pair<string, string> fileRange;
+    {
+        lock_guard<mutex> lk(jobsMutex);
+        fileRange = filesAllottedForMaple[failNode];
+    }
     auto it = fs.fileNames.begin();
     
     while(fileRange.first != *it) {
@@ -666,17 +734,12 @@ void mapleJuice::sendMapleJobForFailNode(const maple &m, int failNode) {
     // send maple exe to worker
     fs.pushFileToNode(node, m.mapleExe, m.mapleExe, "FILE");
 
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
+    if (!conns.send(node, message, offset)) {
         cout <<"sendMapleJobs: Cannot connect to "<< node << endl;
-
-    } else {
-        write(connToServer, message, offset);
-        close(connToServer);
     }
     log() << "mapleJuice/ maple task sent to " << node << " for " << m.mapleExe;
     log(DEBUG) << "mapleJuice/ "<< fileCount << " fileNames sent to " << node;
+    lock_guard<mutex> lk(jobsMutex);
     filesAllottedForMaple.erase(failNode);
     filesAllottedForMaple.insert({node, fileRange});
     cout << "maple job for fail node " << failNode << " sent to " << node << endl;
@@ -691,6 +754,9 @@ void mapleJuice::sendMapleJobs(const maple& m) {
 
     auto it = fs.fileNames.begin();
 
+    // every range is recorded before the first job is sent, a worker done early must not
+    // find the map empty while jobs are still going out
+    vector<pair<int, string>> jobs;
     int node = fs.myNumber;
     for (int i=0; i < m.numMaples; i++) {
         node = fs.successorNode(node);
@@ -755,21 +821,20 @@ void mapleJuice::sendMapleJobs(const maple& m) {
             it++;
         }
 
-        // send maple exe to worker
-        fs.pushFileToNode(node, m.mapleExe, m.mapleExe, "FILE");
+        jobs.emplace_back(node, string(message, offset));
+        log(DEBUG) << "mapleJuice/ "<< fileCount << " fileNames for " << node;
+        lock_guard<mutex> lk(jobsMutex);
+        filesAllottedForMaple.insert({node, fileRange});
+    }
 
-        int connToServer;
-        int status = connectToServer(node, &connToServer);
-        if(status) {
-            cout <<"sendMapleJobs: Cannot connect to "<< node << endl;
+    for (auto& job : jobs) {
+        // send maple exe to worker
+        fs.pushFileToNode(job.first, m.mapleExe, m.mapleExe, "FILE");
 
-        } else {
-            write(connToServer, message, offset);
-            close(connToServer);
+        if (!conns.send(job.first, &job.second[0], job.second.size())) {
+            cout <<"sendMapleJobs: Cannot connect to "<< job.first << endl;
         }
-            log() << "mapleJuice/ maple task sent to " << node << " for " << m.mapleExe;
-            log(DEBUG) << "mapleJuice/ "<< fileCount << " fileNames sent to " << node;
-            filesAllottedForMaple.insert({node, fileRange});
+        log() << "mapleJuice/ maple task sent to " << job.first << " for " << m.mapleExe;
     }
 }
 
@@ -798,17 +863,44 @@ void mapleJuice::handleInput() {
         } else if (input.compare("put") == 0) {
             string localFileName, sdfsFileName;
             cin >> localFileName >> sdfsFileName;
-            fs.storeFile(localFileName, sdfsFileName);
+            uint64_t id;
+            fs.putAsync(localFileName, sdfsFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                fs.showReply("put " + sdfsFileName, reply);
+            });
+
+        } else if (input.compare("append") == 0) {
+            string localFileName, sdfsFileName;
+            cin >> localFileName >> sdfsFileName;
+            uint64_t id;
+            fs.appendAsync(localFileName, sdfsFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                fs.showReply("append " + sdfsFileName, reply);
+            });
 
         } else if (input.compare("get") == 0) {
             string localFileName, sdfsFileName;
             cin >> sdfsFileName >> localFileName;
-            fs.fetchFile(sdfsFileName, localFileName);
+            uint64_t id;
+            fs.getAsync(sdfsFileName, localFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                fs.showReply("get " + sdfsFileName, reply);
+            });
+
+        } else if (input.compare("getrange") == 0) {
+            string localFileName, sdfsFileName;
+            uint64_t start, length;
+            cin >> sdfsFileName >> localFileName >> start >> length;
+            uint64_t id;
+            fs.getRangeAsync(sdfsFileName, localFileName, start, length, id,
+                             [this, sdfsFileName](const sdfsReply& reply) {
+                fs.showReply("getrange " + sdfsFileName, reply);
+            });
 
         } else if (input.compare("delete") == 0) {
             string fileName;
             cin >> fileName;
-            fs.deleteFile(fileName);
+            uint64_t id;
+            fs.deleteAsync(fileName, id, [this, fileName](const sdfsReply& reply) {
+                fs.showReply("delete " + fileName, reply);
+            });
 
         } else if (input.compare("store") == 0) {
             fs.showStore();
@@ -816,8 +908,71 @@ void mapleJuice::handleInput() {
         } else if (input.compare("ls") == 0) {
             string fileName;
             cin >> fileName;
+            uint64_t id;
+            fs.locateAsync(fileName, id, [this, fileName](const sdfsReply& reply) {
+                fs.showReply("ls " + fileName, reply);
+            });
+
+        } else if (input.compare("ops") == 0) {
+            fs.showOps();
+
+        } else if (input.compare("layout") == 0) {
+            string layout;
+            cin >> layout;
+            fs.blockLayout = layout.compare("blocks") == 0;
+            fs.codedLayout = layout.compare("coded") == 0;
+            cout << "storing large files "
+                 << (fs.blockLayout ? "in blocks" : fs.codedLayout ? "erasure coded" : "whole") << endl;
+
+        } else if (input.compare("blocks") == 0) {
+            string fileName;
+            cin >> fileName;
+            fs.showBlocks(fileName);
+
+        } else if (input.compare("repair") == 0) {
+            fs.showRepair();
+
+        } else if (input.compare("repairrate") == 0) {
+            double megabytes;
+            cin >> megabytes;
+            fs.setRepairRate(static_cast<uint64_t>(megabytes * 1024 * 1024));
+
+        } else if (input.compare("cache") == 0) {
+            fs.showCache();
+
+        } else if (input.compare("peers") == 0) {
+            fs.showPeers();
 
-            fs.showFileLocations(fileName);
+        } else if (input.compare("compress") == 0) {
+            string mode;
+            cin >> mode;
+            fs.compression = mode.compare("on") == 0;
+            fs.showCompression();
+
+        } else if (input.compare("durable") == 0) {
+            string mode;
+            cin >> mode;
+            fs.setDurable(mode.compare("on") == 0);
+            fs.showDurability();
+
+        } else if (input.compare("direct") == 0) {
+            string mode;
+            cin >> mode;
+            fs.setDirectWrites(mode.compare("on") == 0);
+
+        } else if (input.compare("zerocopy") == 0) {
+            string mode;
+            cin >> mode;
+            fs.setZeroCopy(mode.compare("on") == 0);
+
+        } else if (input.compare("quorum") == 0) {
+            cin >> fs.writeQuorum >> fs.readQuorum;
+            cout << "PUT waits for " << fs.writeQuorum << " replicas, GET for " << fs.readQuorum << endl;
+
+        } else if (input.compare("dir") == 0) {
+            string dirPrefix;
+            cin >> dirPrefix;
+            fs.showFileNames(dirPrefix);
 
         } else if (input.compare("ring") == 0) {
             fs.printRing();
@@ -828,7 +983,10 @@ void mapleJuice::handleInput() {
         } else if (input.compare("maple") == 0) {
             maple m;
             cin >> m.mapleExe >> m.numMaples >> m.sdfsIntermediateFileNamePrefix >> m.sdfsSrcDirectory;
-            mapleQ.push(m);
+            {
+                lock_guard<mutex> lk(jobsMutex);
+                mapleQ.push(m);
+            }
             lock_guard<mutex> lk(isMasterMutex);
             if (!isMaster) {
                 isMaster = true;
@@ -840,14 +998,17 @@ void mapleJuice::handleInput() {
             juice j;
             cin >> j.juiceExe >> j.numJuices >> j.sdfsIntermediateFileNamePrefix
                 >> j.sdfsDestFileName >> j.deleteInput;
-            if (juiceQ.empty()) {
+            bool first;
+            {
+                lock_guard<mutex> lk(jobsMutex);
+                first = juiceQ.empty();
                 juiceQ.push(j);
+            }
+            if (first) {
                 lock_guard<mutex> lk(cvWaitingForJuiceTaskMutex);
                 isJuiceTaskIssued = true;
                 log() << "sdfs/ Notify master thread that a juice task has been issued";
                 cvWaitingForJuiceTask.notify_one();
-            } else {
-                juiceQ.push(j);
             }
 
         } else {
@@ -857,9 +1018,24 @@ void mapleJuice::handleInput() {
                  << "[leave] to leave the system\n"
                  << "[join] <introducer vm's number> to join the system\n"
                  << "[put] <localFileName> <remoteFile> to add put file to sdfs\n"
+                 << "[append] <localFileName> <remoteFile> to append a local file to a file in sdfs\n"
+                 << "[getrange] <remoteFile> <localFileName> <offset> <length> to get part of a file\n"
                  << "[delete] <remoteFile> to delete file to sdfs\n"
                  << "[store] to show all files at this location\n"
-                 << "[ls] <remoteFile> to show file replica locations\n";
+                 << "[ls] <remoteFile> to show file replica locations\n"
+                 << "[dir] <prefix> to list the sdfs files whose names start with prefix\n"
+                 << "[ops] to show the put, get, delete and ls operations still running\n"
+                 << "[layout] <whole|blocks|coded> to store large files whole, striped in blocks or erasure coded\n"
+                 << "[blocks] <remoteFile> to show the blocks of a striped file or the fragments of a coded one\n"
+                 << "[repair] to show the progress of re-replication after a failure\n"
+                 << "[repairrate] <MB/s> to cap the re-replication traffic this node sends, 0 for no cap\n"
+                 << "[cache] to show the files cached from other nodes\n"
+                 << "[peers] to show how fast the other nodes answered reads\n"
+                 << "[compress] <on|off> to compress file transfers to nodes that support it\n"
+                 << "[durable] <on|off> to sync stored files to disk, in groups, before writers are answered\n"
+                 << "[direct] <on|off> to write large stored files with O_DIRECT\n"
+                 << "[zerocopy] <on|off> to move files with sendfile and io_uring\n"
+                 << "[quorum] <W> <R> to wait for W replicas on put and R replicas on get\n";
         }
     }
 }
@@ -889,48 +1065,3 @@ void mapleJuice::createSocket() {
     }
     log(INFO) << "Socket binding done.";
 }
-
-
-int mapleJuice::connectToServer(int targetNode, int *connectionFd) {
-    struct in_addr tmp;
-    tmp.s_addr = htonl(fs.fd->IPAddrs[targetNode]);
-    auto IP = inet_ntoa(tmp);
-
-    //create client skt
-    *connectionFd = socket(AF_INET, SOCK_STREAM, 0);
-
-    // allow address reuse
-    int YES = 1;
-    setsockopt(sockFd, SOL_SOCKET, SO_REUSEADDR, &YES, sizeof(int));
-
-    // open socket
-    if(*connectionFd < 0) {
-        cout << "Cannot open socket" << endl;
-        exit(1);
-    }
-
-    //Variables Declaration
-    struct addrinfo hints, * res;
-    int status;
-
-    //clear hints
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    auto portStr = to_string(PORT3);
-    status = getaddrinfo(IP, portStr.c_str(), &hints, &res);
-    if (status != 0) {
-        fprintf(stderr, "Error getaddrinfo\n");
-        exit(1);
-    }
-
-    status = connect(*connectionFd, res->ai_addr, res->ai_addrlen);
-    if (status < 0) {
-        cout << "Cannot connect to: " << targetNode << endl;
-        cout.flush();
-        return -1;
-    }
-    return 0;
-}
-
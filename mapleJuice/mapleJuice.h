@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include "../connection/connection.h"
 #include "../logger/logger.h"
 #include "../sdfs/sdfs.h"
 
@@ -94,6 +95,12 @@ mapleJuice(int number, logger &logg);
  */
 void recvMessages();
 
+/*
+ * handle one request opened by another node
+ *
+ */
+void handleMessage(shared_ptr<request> req);
+
 /*
  * Store a local file in sdfs.
  * @param localName name of the file to be stored
@@ -151,13 +158,21 @@ void handleMapleJob(char* buf, int node);
  * run maple job
  *
  */
-void runMapleJob(maple m, int node);
+void runMapleJob(maple m, int node, set<string> inputFiles);
 
 /*
- * store maple out files in sdfs
+ * write the collected maple output to a new container and empty it
+ * @param outPrefix sdfs name of the containers of this task without the part number
+ * @param outFiles containers of this task so far, the new one is added
  *
  */
-void storeMapleOutFiles(unordered_set<string>& deleteThese);
+void writeMaplePack(const string& outPrefix, map<string, string>& keyLines, vector<string>& outFiles);
+
+/*
+ * store maple out files in sdfs and delete the containers an earlier run of the task left under outPrefix
+ *
+ */
+void storeMapleOutFiles(const string& outPrefix, const vector<string>& outFiles);
 
 /*
  * store juice out files in sdfs
@@ -272,12 +287,6 @@ void handleJuiceJobDone(int juicerNode);
 */
 void partition(juiceJob& jb, string& sdfs_juice_input_filename_prefix);
 
-/*
- * connect to server at targetNode
- *
- */
-int connectToServer(int targetNode, int *connectionFd);
-
 
 bool isNodeFree(int nodeNum);
 /*
@@ -300,12 +309,25 @@ mutex isMasterMutex;
  */
 sdfs fs;
 
+/*
+ * long lived connections to the mapleJuice servers of other nodes
+ *
+ */
+connectionManager conns;
+
 /*
  * instance of logger class to write logs to the logFile
  *
  */
 logger& log;
 
+/*
+ * guards the job queues and the maps of the tasks sent to workers, which the master
+ * thread shares with the handlers of MAPD, JUID and FAMJ
+ *
+ */
+mutex jobsMutex;
+
 /*
  * queue of maple commands
  *
@@ -346,13 +368,6 @@ unordered_map<int, int> juicerNumber;
  */
 unordered_set<string> mapleFiles;
 
-/*
- *
- * output fileNames for maple phase
- *
- */
-unordered_set<string> mapleOutFiles;
-
 
 
 
@@ -0,0 +1,131 @@
+/*
+ * @file group_commit.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "group_commit.h"
+
+
+groupCommit::groupCommit(const string& dir, chrono::milliseconds window, size_t maxFiles, size_t syncfsFiles)
+: dir{dir}, window{window}, maxFiles{maxFiles}, syncfsFiles{syncfsFiles}, opened{1}, synced{0}, failed{0},
+  files{0}, syncfsGroups{0}, stopping{false} {
+    committer = thread(&groupCommit::run, this);
+}
+
+
+groupCommit::~groupCommit() {
+    {
+        lock_guard<mutex> lk(commitMutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    committer.join();
+}
+
+
+bool groupCommit::sync(const string& fileName) {
+    unique_lock<mutex> lk(commitMutex);
+    auto group = opened;
+    pending.push_back(fileName);
+    if (pending.size() == 1 || pending.size() >= maxFiles) {
+        queued.notify_all();
+    }
+    durable.wait(lk, [this, group]{ return synced >= group; });
+    return failed == 0 || failed > group;
+}
+
+
+void groupCommit::syncAlways(const string& fileName) {
+    lock_guard<mutex> lk(commitMutex);
+    always.push_back(fileName);
+}
+
+
+void groupCommit::show() {
+    lock_guard<mutex> lk(commitMutex);
+    cout << synced << " groups synced, " << files << " files, " << syncfsGroups << " of them with syncfs";
+    if (synced > 0) {
+        cout << ", " << static_cast<double>(files) / synced << " files per sync";
+    }
+    cout << endl;
+}
+
+
+void groupCommit::run() {
+    while (1) {
+        vector<string> group;
+        uint64_t number;
+        {
+            unique_lock<mutex> lk(commitMutex);
+            queued.wait(lk, [this]{ return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            // writers that arrive within the window share the sync of the first one
+            queued.wait_for(lk, window, [this]{ return stopping || pending.size() >= maxFiles; });
+            group.swap(pending);
+            number = opened++;
+        }
+
+        bool ok = syncGroup(group);
+        {
+            lock_guard<mutex> lk(commitMutex);
+            synced = number;
+            files += group.size();
+            if (!ok && failed == 0) {
+                failed = number;
+            }
+        }
+        durable.notify_all();
+    }
+}
+
+
+bool groupCommit::syncGroup(const vector<string>& group) {
+    bool ok = true;
+    if (group.size() >= syncfsFiles) {
+        int fd = open(dir.c_str(), O_RDONLY);
+        ok = fd >= 0 && syncfs(fd) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+        lock_guard<mutex> lk(commitMutex);
+        syncfsGroups++;
+        return ok;
+    }
+
+    // new files are durable only once their directory entries are
+    set<string> dirs;
+    for (auto& fileName : group) {
+        ok = syncFile(fileName) && ok;
+        auto slash = fileName.rfind('/');
+        dirs.insert(slash == string::npos ? "." : fileName.substr(0, slash));
+    }
+    vector<string> extra;
+    {
+        lock_guard<mutex> lk(commitMutex);
+        extra = always;
+    }
+    for (auto& fileName : extra) {
+        ok = syncFile(fileName) && ok;
+    }
+    for (auto& dirName : dirs) {
+        ok = syncFile(dirName) && ok;
+    }
+    return ok;
+}
+
+
+bool groupCommit::syncFile(const string& fileName) {
+    // a file removed before its group was synced has nothing left to make durable
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    if (!ok) {
+        perror("Cannot sync file");
+    }
+    return ok;
+}
@@ -0,0 +1,138 @@
+/*
+ * @file group_commit.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * Makes files durable in groups. Writers queue the files they wrote and wait; a
+ * committer thread collects the files that arrive within a window (or until a group
+ * is full) and syncs them together, with one syncfs of the file system when the group
+ * is large and an fsync of every file otherwise, followed by the files registered to
+ * be synced with every group and the directories holding the files. All writers of
+ * the group are released once it is on disk, so N small files cost about one sync
+ * instead of N.
+ *
+ */
+class groupCommit {
+
+public:
+
+/*
+ * @param dir a directory of the file system the files are on, for syncfs
+ * @param window time a group stays open after its first file
+ * @param maxFiles a group this large is synced without waiting for the window to end
+ * @param syncfsFiles groups of at least this many files are synced with one syncfs
+ *
+ */
+groupCommit(const string& dir, chrono::milliseconds window, size_t maxFiles, size_t syncfsFiles);
+
+/*
+ * sync what is queued and stop the committer
+ *
+ */
+~groupCommit();
+
+/*
+ * queue fileName for the next group and wait until that group is durable
+ * @return false if this group or an earlier one could not be synced
+ *
+ */
+bool sync(const string& fileName);
+
+/*
+ * sync fileName with every group, e.g. a log whose records describe the files
+ *
+ */
+void syncAlways(const string& fileName);
+
+/*
+ * print the groups synced and how many files they held
+ *
+ */
+void show();
+
+private:
+
+/*
+ * loop of the committer thread
+ *
+ */
+void run();
+
+/*
+ * sync a group of files and what is synced with every group
+ * @return false if some sync failed
+ *
+ */
+bool syncGroup(const vector<string>& group);
+
+/*
+ * fsync one file or directory
+ *
+ */
+bool syncFile(const string& fileName);
+
+string dir;
+
+chrono::milliseconds window;
+
+size_t maxFiles;
+
+size_t syncfsFiles;
+
+/*
+ * files of the group being collected
+ *
+ */
+vector<string> pending;
+
+vector<string> always;
+
+/*
+ * groups started and groups durable, a writer of group g waits for synced >= g
+ *
+ */
+uint64_t opened;
+
+uint64_t synced;
+
+/*
+ * the first group that failed to sync, 0 if none did. The error is sticky: after a failed sync the
+ * kernel may have dropped the dirty pages, so no later group is reported durable either
+ *
+ */
+uint64_t failed;
+
+uint64_t files;
+
+uint64_t syncfsGroups;
+
+mutex commitMutex;
+
+condition_variable queued;
+
+condition_variable durable;
+
+bool stopping;
+
+thread committer;
+};
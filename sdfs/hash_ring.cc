@@ -0,0 +1,101 @@
+/*
+ * @file hash_ring.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "hash_ring.h"
+
+
+hashRing::hashRing(int vnodes)
+: vnodes{vnodes} {
+}
+
+
+void hashRing::add(int node) {
+    lock_guard<mutex> lk(ringMutex);
+    if (!members.insert(node).second) {
+        return;
+    }
+    for (int i=0; i < vnodes; i++) {
+        // on the rare collision the member added first keeps the point
+        points.emplace(hash(to_string(node) + "#" + to_string(i)), node);
+    }
+}
+
+
+void hashRing::remove(int node) {
+    lock_guard<mutex> lk(ringMutex);
+    if (members.erase(node) == 0) {
+        return;
+    }
+    for (auto it = points.begin(); it != points.end(); ) {
+        if (it->second == node) {
+            it = points.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+
+bool hashRing::contains(int node) {
+    lock_guard<mutex> lk(ringMutex);
+    return members.find(node) != members.end();
+}
+
+
+int hashRing::owner(const string& key) {
+    lock_guard<mutex> lk(ringMutex);
+    if (points.empty()) {
+        return 0;
+    }
+    auto it = points.lower_bound(hash(key));
+    if (it == points.end()) {
+        it = points.begin();
+    }
+    return it->second;
+}
+
+
+vector<int> hashRing::replicas(const string& key, size_t n) {
+    lock_guard<mutex> lk(ringMutex);
+    vector<int> nodes;
+    if (points.empty()) {
+        return nodes;
+    }
+    n = min(n, members.size());
+
+    auto it = points.lower_bound(hash(key));
+    while (nodes.size() < n) {
+        if (it == points.end()) {
+            it = points.begin();
+        }
+        if (find(nodes.begin(), nodes.end(), it->second) == nodes.end()) {
+            nodes.push_back(it->second);
+        }
+        it++;
+    }
+    return nodes;
+}
+
+
+size_t hashRing::size() {
+    lock_guard<mutex> lk(ringMutex);
+    return members.size();
+}
+
+
+uint64_t hashRing::hash(const string& key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    // FNV-1a leaves keys that differ in their last bytes close together, finish with a mix
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
@@ -0,0 +1,88 @@
+/*
+ * @file hash_ring.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * Consistent hash ring deciding which nodes store a file. Every member owns vnodes
+ * points on a 64 bit ring and a key belongs to the first point clockwise from its
+ * hash, so a join or failure only moves the keys next to that member's points and
+ * load stays even as the cluster grows. Lookups are O(log(members * vnodes)).
+ *
+ */
+class hashRing {
+
+public:
+
+/*
+ * @param vnodes number of points of every member
+ *
+ */
+hashRing(int vnodes);
+
+/*
+ * add a member and its points, nothing happens if it is already there
+ *
+ */
+void add(int node);
+
+/*
+ * remove a member and its points
+ *
+ */
+void remove(int node);
+
+bool contains(int node);
+
+/*
+ * member owning key
+ * @return 0 if the ring is empty
+ *
+ */
+int owner(const string& key);
+
+/*
+ * first n distinct members clockwise from key, the owner comes first
+ *
+ */
+vector<int> replicas(const string& key, size_t n);
+
+/*
+ * number of members
+ *
+ */
+size_t size();
+
+/*
+ * 64 bit FNV-1a hash of key, mixed so that similar keys spread over the ring
+ *
+ */
+static uint64_t hash(const string& key);
+
+const int vnodes;
+
+private:
+
+/*
+ * position of the points of every member
+ *
+ */
+map<uint64_t, int> points;
+
+set<int> members;
+
+mutex ringMutex;
+};
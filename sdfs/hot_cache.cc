@@ -0,0 +1,145 @@
+/*
+ * @file hot_cache.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "hot_cache.h"
+#include <algorithm>
+
+
+hotFile::hotFile(size_t length)
+: data{nullptr}, length{length} {
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        data = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+    }
+}
+
+
+hotFile::~hotFile() {
+    if (data) {
+        munmap(data, length);
+    }
+}
+
+
+hotCache::hotCache(uint64_t capacity, uint64_t maxFile, size_t ghosts)
+: capacity{capacity}, maxFile{maxFile}, ghosts{ghosts}, size{0}, hits{0}, misses{0}, loads{0}, evictions{0} {
+}
+
+
+static bool sameFile(const struct stat& info, ino_t inode, size_t length, const timespec& modified) {
+    return info.st_ino == inode && static_cast<size_t>(info.st_size) == length &&
+           info.st_mtim.tv_sec == modified.tv_sec && info.st_mtim.tv_nsec == modified.tv_nsec;
+}
+
+
+shared_ptr<const hotFile> hotCache::get(const string& path) {
+    struct stat info;
+    bool exists = stat(path.c_str(), &info) == 0;
+    {
+        lock_guard<mutex> lk(cacheMutex);
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            auto& cached = it->second;
+            if (exists && sameFile(info, cached.inode, cached.contents->length, cached.modified)) {
+                uses.splice(uses.begin(), uses, cached.use);
+                hits++;
+                return cached.contents;
+            }
+            remove(it);
+        }
+        misses++;
+        if (!exists || static_cast<uint64_t>(info.st_size) > min(maxFile, capacity)) {
+            return nullptr;
+        }
+        auto ghost = ghostEntries.find(path);
+        if (ghost == ghostEntries.end()) {
+            remember(path);
+            return nullptr;
+        }
+        ghostOrder.erase(ghost->second);
+        ghostEntries.erase(ghost);
+    }
+
+    // read twice while remembered, worth keeping
+    auto contents = load(path, info);
+    if (!contents) {
+        return nullptr;
+    }
+    lock_guard<mutex> lk(cacheMutex);
+    if (entries.find(path) != entries.end()) {
+        return contents;
+    }
+    while (size + contents->length > capacity && !uses.empty()) {
+        remove(entries.find(uses.back()));
+        evictions++;
+    }
+    uses.push_front(path);
+    entries[path] = {contents, info.st_ino, info.st_mtim, uses.begin()};
+    size += contents->length;
+    loads++;
+    return contents;
+}
+
+
+shared_ptr<const hotFile> hotCache::load(const string& path, const struct stat& info) {
+    auto contents = make_shared<hotFile>(info.st_size);
+    if (info.st_size > 0 && !contents->data) {
+        return nullptr;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    size_t done = 0;
+    while (done < contents->length) {
+        auto numRead = pread(fd, contents->data + done, contents->length - done, done);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            break;
+        }
+        done += numRead;
+    }
+    // a writer may have got in between, keep the copy only if the file is as it was
+    struct stat after;
+    bool same = fstat(fd, &after) == 0 && sameFile(after, info.st_ino, contents->length, info.st_mtim);
+    close(fd);
+    return done == contents->length && same ? contents : nullptr;
+}
+
+
+void hotCache::erase(const string& path) {
+    lock_guard<mutex> lk(cacheMutex);
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        remove(it);
+    }
+}
+
+
+void hotCache::show() {
+    lock_guard<mutex> lk(cacheMutex);
+    cout << entries.size() << " hot files in memory, " << size / 1024 << " of " << capacity / 1024 << " KB\n"
+         << hits << " reads of stored files served from memory, " << misses << " from disk, " << loads
+         << " files loaded, " << evictions << " evicted" << endl;
+}
+
+
+void hotCache::remove(unordered_map<string, entry>::iterator it) {
+    uses.erase(it->second.use);
+    size -= it->second.contents->length;
+    entries.erase(it);
+}
+
+
+void hotCache::remember(const string& path) {
+    ghostOrder.push_front(path);
+    ghostEntries[path] = ghostOrder.begin();
+    if (ghostOrder.size() > ghosts) {
+        ghostEntries.erase(ghostOrder.back());
+        ghostOrder.pop_back();
+    }
+}
@@ -0,0 +1,142 @@
+/*
+ * @file hot_cache.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+
+/*
+ * contents of a cached file, the memory stays valid while somebody holds it even if the
+ * file is evicted in the meantime
+ *
+ */
+struct hotFile {
+    hotFile(size_t length);
+    ~hotFile();
+
+    char* data;
+    size_t length;
+};
+
+
+/*
+ * Bounded in-memory cache of the stored files this node serves most often, e.g. the
+ * maple and juice executables every worker fetches. Files are held in anonymous
+ * mappings, not mappings of the files themselves, since replicas are rewritten in
+ * place and a truncated file would fault a read in flight. Admission follows 2Q: the
+ * first read of a file only records its name in a bounded ghost list and the file is
+ * loaded when it is read again while its name is there, so one pass over many files
+ * does not push the hot ones out. Loaded files are evicted least recently used first.
+ * A file is revalidated with stat on every read and dropped once it changed.
+ *
+ */
+class hotCache {
+
+public:
+
+/*
+ * @param capacity most bytes held
+ * @param maxFile larger files are never held
+ * @param ghosts names of files read once that are remembered
+ *
+ */
+hotCache(uint64_t capacity, uint64_t maxFile, size_t ghosts);
+
+/*
+ * the contents of the file at path if it is held, or loaded now because it is hot
+ * @return nullptr if the file has to be read from disk
+ *
+ */
+shared_ptr<const hotFile> get(const string& path);
+
+/*
+ * drop the file at path
+ *
+ */
+void erase(const string& path);
+
+/*
+ * print the size of the cache and its hits and misses
+ *
+ */
+void show();
+
+private:
+
+struct entry {
+    shared_ptr<const hotFile> contents;
+    ino_t inode;
+    timespec modified;
+    list<string>::iterator use;
+};
+
+/*
+ * read the file into memory
+ * @return nullptr if it cannot be read or changed while it was read
+ *
+ */
+shared_ptr<const hotFile> load(const string& path, const struct stat& info);
+
+/*
+ * remove an entry, cacheMutex must be held
+ *
+ */
+void remove(unordered_map<string, entry>::iterator it);
+
+/*
+ * remember a file that was read once, cacheMutex must be held
+ *
+ */
+void remember(const string& path);
+
+const uint64_t capacity;
+
+const uint64_t maxFile;
+
+const size_t ghosts;
+
+uint64_t size;
+
+unordered_map<string, entry> entries;
+
+/*
+ * held files, most recently used first
+ *
+ */
+list<string> uses;
+
+/*
+ * files read once recently, newest first
+ *
+ */
+unordered_map<string, list<string>::iterator> ghostEntries;
+
+list<string> ghostOrder;
+
+/*
+ * reads served from memory, reads that went to disk, files loaded and evicted
+ *
+ */
+uint64_t hits;
+uint64_t misses;
+uint64_t loads;
+uint64_t evictions;
+
+mutex cacheMutex;
+};
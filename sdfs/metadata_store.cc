@@ -0,0 +1,261 @@
+/*
+ * @file metadata_store.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "metadata_store.h"
+
+constexpr size_t FIXEDPAYLOAD = 2 + 2 * sizeof(uint64_t);  // type, label, size and checksum
+constexpr size_t ENTRYHEADER = sizeof(uint32_t) + sizeof(uint64_t);
+
+
+metadataStore::metadataStore(const string& logFile, const string& snapshotFile)
+: logFile{logFile}, snapshotFile{snapshotFile}, logFd{-1}, logRecords{0}, written{0}, synced{0}, deferred{false} {
+}
+
+
+metadataStore::~metadataStore() {
+    if (logFd >= 0) {
+        close(logFd);
+    }
+}
+
+
+map<string, fileRecord> metadataStore::load() {
+    lock_guard<mutex> lk(storeMutex);
+    records.clear();
+
+    size_t count;
+    int snapshotFd = open(snapshotFile.c_str(), O_RDONLY);
+    if (snapshotFd >= 0) {
+        replay(snapshotFd, count);
+        close(snapshotFd);
+    }
+
+    logFd = open(logFile.c_str(), O_RDWR | O_CREAT, 0644);
+    if (logFd < 0) {
+        perror("Cannot open metadata log");
+        return records;
+    }
+    auto end = replay(logFd, logRecords);
+
+    // a crash can leave half a record behind, new records must not follow it
+    if (ftruncate(logFd, end) < 0 || lseek(logFd, end, SEEK_SET) < 0) {
+        perror("Cannot truncate metadata log");
+    }
+    return records;
+}
+
+
+void metadataStore::deferSync(bool on) {
+    lock_guard<mutex> lk(storeMutex);
+    deferred = on;
+}
+
+
+void metadataStore::sync() {
+    uint64_t target;
+    {
+        lock_guard<mutex> lk(storeMutex);
+        if (logRecords >= SNAPSHOTRECORDS && logRecords > records.size()) {
+            snapshot();
+        }
+        if (deferred || logFd < 0) {
+            return;
+        }
+        target = written;
+    }
+    // a caller that waited here while another synced finds its records on disk already
+    lock_guard<mutex> lk(syncMutex);
+    if (synced >= target) {
+        return;
+    }
+    uint64_t upTo;
+    {
+        lock_guard<mutex> storeLk(storeMutex);
+        upTo = written;
+    }
+    if (fdatasync(logFd) < 0) {
+        perror("Cannot sync metadata log");
+        return;
+    }
+    synced = upTo;
+}
+
+
+void metadataStore::put(const string& fileName, const fileRecord& record) {
+    lock_guard<mutex> lk(storeMutex);
+    records[fileName] = record;
+    append(entry(payload('F', fileName, record)), 1);
+}
+
+
+void metadataStore::relabel(const vector<pair<string, char>>& labels) {
+    lock_guard<mutex> lk(storeMutex);
+    string entries;
+    size_t count = 0;
+    for (auto& label : labels) {
+        auto it = records.find(label.first);
+        if (it == records.end() || it->second.label == label.second) {
+            continue;
+        }
+        it->second.label = label.second;
+        entries += entry(payload('L', label.first, it->second));
+        count++;
+    }
+    append(entries, count);
+}
+
+
+void metadataStore::erase(const vector<string>& fileNames) {
+    lock_guard<mutex> lk(storeMutex);
+    string entries;
+    size_t count = 0;
+    for (auto& fileName : fileNames) {
+        if (records.erase(fileName) > 0) {
+            entries += entry(payload('D', fileName, fileRecord{0, 0, 0, 0, 0}));
+            count++;
+        }
+    }
+    append(entries, count);
+}
+
+
+bool metadataStore::apply(const string& data) {
+    if (data.size() < FIXEDPAYLOAD) {
+        return false;
+    }
+    fileRecord record;
+    record.label = data[1];
+    memcpy(&record.size, &data[2], sizeof(record.size));
+    memcpy(&record.checksum, &data[2 + sizeof(record.size)], sizeof(record.checksum));
+    record.size = ntohll(record.size);
+    record.checksum = ntohll(record.checksum);
+    record.version = 0;
+    record.layout = 0;
+    auto fileName = data.substr(FIXEDPAYLOAD);
+
+    if (data[0] == 'F' || data[0] == 'V') {
+        size_t extra = sizeof(record.version) + (data[0] == 'F' ? sizeof(record.layout) : 0);
+        if (data.size() < FIXEDPAYLOAD + extra) {
+            return false;
+        }
+        memcpy(&record.version, &data[FIXEDPAYLOAD], sizeof(record.version));
+        record.version = ntohll(record.version);
+        if (data[0] == 'F') {
+            record.layout = data[FIXEDPAYLOAD + sizeof(record.version)];
+        }
+        records[data.substr(FIXEDPAYLOAD + extra)] = record;
+    } else if (data[0] == 'P') {
+        records[fileName] = record;
+    } else if (data[0] == 'L') {
+        auto it = records.find(fileName);
+        if (it != records.end()) {
+            it->second.label = record.label;
+        }
+    } else if (data[0] == 'D') {
+        records.erase(fileName);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+string metadataStore::payload(char type, const string& fileName, const fileRecord& record) {
+    string data(FIXEDPAYLOAD, '\0');
+    data[0] = type;
+    data[1] = record.label;
+    uint64_t size = htonll(record.size);
+    uint64_t sum = htonll(record.checksum);
+    memcpy(&data[2], &size, sizeof(size));
+    memcpy(&data[2 + sizeof(size)], &sum, sizeof(sum));
+    if (type == 'F') {
+        uint64_t version = htonll(record.version);
+        data.append(reinterpret_cast<char*>(&version), sizeof(version));
+        data.push_back(record.layout);
+    }
+    return data + fileName;
+}
+
+
+string metadataStore::entry(const string& payload) {
+    char header[ENTRYHEADER];
+    uint32_t length = htonl(payload.size());
+    uint64_t sum = htonll(checksum(payload.data(), payload.size()));
+    memcpy(header, &length, sizeof(length));
+    memcpy(header + sizeof(length), &sum, sizeof(sum));
+    return string(header, sizeof(header)) + payload;
+}
+
+
+void metadataStore::append(const string& entries, size_t count) {
+    if (logFd < 0 || count == 0) {
+        return;
+    }
+    if (!writeAll(logFd, entries.data(), entries.size())) {
+        perror("Cannot write metadata log");
+    }
+    logRecords += count;
+    written += count;
+}
+
+
+off_t metadataStore::replay(int fd, size_t& count) {
+    off_t offset = 0;
+    count = 0;
+    char header[ENTRYHEADER];
+    while (readAll(fd, header, sizeof(header))) {
+        uint32_t length;
+        uint64_t sum;
+        memcpy(&length, header, sizeof(length));
+        memcpy(&sum, header + sizeof(length), sizeof(sum));
+        length = ntohl(length);
+
+        if (length > MAXRECORD) {
+            break;
+        }
+        string data(length, '\0');
+        if (!readAll(fd, &data[0], length) || checksum(data.data(), length) != ntohll(sum) || !apply(data)) {
+            break;
+        }
+        offset += sizeof(header) + length;
+        count++;
+    }
+    return offset;
+}
+
+
+void metadataStore::snapshot() {
+    string data;
+    for (auto& it : records) {
+        data += entry(payload('F', it.first, it.second));
+    }
+
+    string tmpFile = snapshotFile + ".tmp";
+    int fd = open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Cannot write metadata snapshot");
+        return;
+    }
+    bool written = writeAll(fd, data.data(), data.size()) && fsync(fd) == 0;
+    close(fd);
+
+    // the old snapshot and the log stay valid until the new one is complete on disk
+    if (!written || rename(tmpFile.c_str(), snapshotFile.c_str()) < 0) {
+        perror("Cannot write metadata snapshot");
+        remove(tmpFile.c_str());
+        return;
+    }
+    auto slash = snapshotFile.rfind('/');
+    int dirFd = open(slash == string::npos ? "." : snapshotFile.substr(0, slash).c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+
+    if (ftruncate(logFd, 0) < 0 || lseek(logFd, 0, SEEK_SET) < 0 || fdatasync(logFd) < 0) {
+        perror("Cannot truncate metadata log");
+    }
+    logRecords = 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * @file metadata_store.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include "../util/util.h"
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t SNAPSHOTRECORDS = 4096;  // log records that trigger a snapshot once they outnumber the files
+constexpr uint32_t MAXRECORD = 64 * 1024; // longer records can only be garbage
+
+
+/*
+ * what the store keeps about a file of this node
+ *
+ */
+struct fileRecord {
+    char label;
+    uint64_t size;
+    uint64_t checksum;
+    uint64_t version;
+    char layout;
+};
+
+
+/*
+ * Crash consistent record of the files a node stores. Every change is appended to a
+ * write ahead log, the records of one operation with a single write. sync() makes what
+ * was appended durable, with one fdatasync for all callers waiting at the time, so
+ * callers append under their own locks and sync after releasing them. Once the log has
+ * more records than there are files, the whole inventory is written to a snapshot that
+ * atomically replaces the previous one and the log starts over. A record is
+ * length (32 bit), checksum of the payload (64 bit), payload: type (F put, L relabel,
+ * D delete), label, size, checksum of the file (64 bit each), for F the version of the
+ * file (64 bit) and its layout, and the file name. Puts of logs written before layouts (V)
+ * have layout 0, before versions (P) version 0 as well.
+ * A torn record at the end of the log is cut off when it is read back.
+ *
+ */
+class metadataStore {
+
+public:
+
+/*
+ * @param logFile write ahead log, snapshotFile snapshot kept next to it
+ *
+ */
+metadataStore(const string& logFile, const string& snapshotFile);
+
+~metadataStore();
+
+/*
+ * read the snapshot and replay the log on top of it
+ * @return files stored by this node before it restarted
+ *
+ */
+map<string, fileRecord> load();
+
+/*
+ * when set, sync() leaves the log to whoever turned this on, e.g. to be synced together
+ * with the files the records describe
+ *
+ */
+void deferSync(bool on);
+
+/*
+ * make every record appended so far durable and write a snapshot if one is due
+ *
+ */
+void sync();
+
+/*
+ * record a stored file or a new version of it
+ *
+ */
+void put(const string& fileName, const fileRecord& record);
+
+/*
+ * record new labels of stored files
+ *
+ */
+void relabel(const vector<pair<string, char>>& labels);
+
+/*
+ * record that files are no longer stored
+ *
+ */
+void erase(const vector<string>& fileNames);
+
+private:
+
+/*
+ * apply one payload to records
+ * @return false if it is not a valid payload
+ *
+ */
+bool apply(const string& payload);
+
+/*
+ * build the payload of a record
+ *
+ */
+string payload(char type, const string& fileName, const fileRecord& record);
+
+/*
+ * length and checksum followed by the payload, as written to disk
+ *
+ */
+string entry(const string& payload);
+
+/*
+ * append entries to the log with one write, storeMutex must be held
+ * @param count records in entries
+ *
+ */
+void append(const string& entries, size_t count);
+
+/*
+ * read the records of fd and apply them up to the first one that is torn or corrupt
+ * @param count set to the number of records applied
+ * @return offset after the last valid record
+ *
+ */
+off_t replay(int fd, size_t& count);
+
+/*
+ * write all records to the snapshot and empty the log, storeMutex must be held
+ *
+ */
+void snapshot();
+
+string logFile;
+
+string snapshotFile;
+
+int logFd;
+
+/*
+ * records appended since the last snapshot
+ *
+ */
+size_t logRecords;
+
+/*
+ * records appended since the log was opened and how many of them are synced, a sync
+ * only waits for the records appended before it started
+ *
+ */
+uint64_t written;
+
+uint64_t synced;
+
+bool deferred;
+
+map<string, fileRecord> records;
+
+mutex storeMutex;
+
+/*
+ * held across an fdatasync so concurrent callers of sync() share it, taken before storeMutex
+ *
+ */
+mutex syncMutex;
+};
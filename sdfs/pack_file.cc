@@ -0,0 +1,134 @@
+/*
+ * @file pack_file.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "pack_file.h"
+
+constexpr size_t FOOTERSIZE = sizeof(uint64_t) + sizeof(uint32_t) + 8;   // index offset, keys, PACKMAGIC
+
+
+bool packFile::write(const string& fileName, const map<string, string>& entries) {
+    ofstream out(fileName, ios::binary | ios::trunc);
+    if (!out.good()) {
+        return false;
+    }
+    string index;
+    uint64_t offset = 0;
+    for (auto& entry : entries) {
+        out.write(entry.second.data(), entry.second.size());
+
+        uint32_t keyLen = htonl(entry.first.size());
+        uint64_t sentOffset = htonll(offset);
+        uint64_t sentLength = htonll(entry.second.size());
+        index.append(reinterpret_cast<char*>(&keyLen), sizeof(keyLen));
+        index.append(entry.first);
+        index.append(reinterpret_cast<char*>(&sentOffset), sizeof(sentOffset));
+        index.append(reinterpret_cast<char*>(&sentLength), sizeof(sentLength));
+        offset += entry.second.size();
+    }
+
+    char footer[FOOTERSIZE];
+    uint64_t indexOffset = htonll(offset);
+    uint32_t count = htonl(entries.size());
+    memcpy(footer, &indexOffset, sizeof(indexOffset));
+    memcpy(footer+8, &count, sizeof(count));
+    memcpy(footer+12, PACKMAGIC.data(), PACKMAGIC.size());
+
+    out.write(index.data(), index.size());
+    out.write(footer, sizeof(footer));
+    return out.flush().good();
+}
+
+
+bool packFile::isPack(const string& fileName) {
+    return fileName.size() > PACKSUFFIX.size() &&
+           fileName.compare(fileName.size() - PACKSUFFIX.size(), PACKSUFFIX.size(), PACKSUFFIX) == 0;
+}
+
+
+bool packFile::open(const string& fileName) {
+    this->fileName = fileName;
+    index.clear();
+
+    auto size = fileSize(fileName);
+    ifstream in(fileName, ios::binary);
+    if (size < FOOTERSIZE || !in.good()) {
+        return false;
+    }
+    char footer[FOOTERSIZE];
+    in.seekg(size - FOOTERSIZE);
+    if (!in.read(footer, sizeof(footer)) || PACKMAGIC.compare(0, PACKMAGIC.size(), footer+12, 8) != 0) {
+        return false;
+    }
+    uint64_t indexOffset;
+    uint32_t count;
+    memcpy(&indexOffset, footer, sizeof(indexOffset));
+    memcpy(&count, footer+8, sizeof(count));
+    indexOffset = ntohll(indexOffset);
+    count = ntohl(count);
+    if (indexOffset > size - FOOTERSIZE) {
+        return false;
+    }
+
+    string entries(size - FOOTERSIZE - indexOffset, '\0');
+    in.seekg(indexOffset);
+    if (!in.read(&entries[0], entries.size())) {
+        return false;
+    }
+    size_t pos = 0;
+    for (uint32_t i=0; i < count; i++) {
+        uint32_t keyLen;
+        if (entries.size() - pos < sizeof(keyLen)) {
+            return false;
+        }
+        memcpy(&keyLen, &entries[pos], sizeof(keyLen));
+        pos += sizeof(keyLen);
+        keyLen = ntohl(keyLen);
+        if (entries.size() - pos < keyLen + 2 * sizeof(uint64_t)) {
+            return false;
+        }
+        string key(entries, pos, keyLen);
+        pos += keyLen;
+
+        uint64_t offset, length;
+        memcpy(&offset, &entries[pos], sizeof(offset));
+        pos += sizeof(offset);
+        memcpy(&length, &entries[pos], sizeof(length));
+        pos += sizeof(length);
+        index[key] = make_pair(ntohll(offset), ntohll(length));
+    }
+    return true;
+}
+
+
+vector<string> packFile::keys() {
+    vector<string> names;
+    for (auto& entry : index) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+
+bool packFile::find(const string& key, uint64_t& offset, uint64_t& length) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+        return false;
+    }
+    offset = it->second.first;
+    length = it->second.second;
+    return true;
+}
+
+
+bool packFile::read(const string& key, string& data) {
+    uint64_t offset, length;
+    if (!find(key, offset, length)) {
+        return false;
+    }
+    ifstream in(fileName, ios::binary);
+    in.seekg(offset);
+    data.resize(length);
+    return length == 0 || in.read(&data[0], length);
+}
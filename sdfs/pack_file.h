@@ -0,0 +1,87 @@
+/*
+ * @file pack_file.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include "../util/util.h"
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const string PACKSUFFIX = "#pack";      // sdfs names of containers end with it
+const string PACKMAGIC = "sdfspack";    // last bytes of a container
+constexpr uint64_t PACKBYTES = 64 * 1024 * 1024;  // maple output buffered before it is written to a container
+
+
+/*
+ * Container packing many small logical files into one sdfs file so that maple output
+ * is stored, replicated and listed as one file instead of one per key. The data of
+ * every key comes first, followed by the index, sorted by key, of
+ * length of the key (32 bit), key, offset and length of its data (64 bit each), and a
+ * footer of the offset of the index (64 bit), number of keys (32 bit) and PACKMAGIC.
+ * The footer is at a fixed distance from the end, so the data of a key can be read
+ * without reading the rest of the container.
+ *
+ */
+class packFile {
+
+public:
+
+/*
+ * write entries, key and data, to fileName
+ *
+ */
+static bool write(const string& fileName, const map<string, string>& entries);
+
+/*
+ * true if the sdfs file is a container
+ *
+ */
+static bool isPack(const string& fileName);
+
+/*
+ * read the index of a container
+ * @return false if fileName is not a container
+ *
+ */
+bool open(const string& fileName);
+
+/*
+ * keys of the container in order
+ *
+ */
+vector<string> keys();
+
+/*
+ * where the data of key is
+ * @return false if the container does not have key
+ *
+ */
+bool find(const string& key, uint64_t& offset, uint64_t& length);
+
+/*
+ * read the data of key
+ * @return false if the container does not have key
+ *
+ */
+bool read(const string& key, string& data);
+
+private:
+
+string fileName;
+
+/*
+ * offset and length of the data of every key
+ *
+ */
+map<string, pair<uint64_t, uint64_t>> index;
+};
@@ -0,0 +1,101 @@
+/*
+ * @file peer_stats.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "peer_stats.h"
+#include "../util/util.h"
+
+
+peerStats::peerStats(double weight, uint64_t rateSample, uint64_t penalty, uint64_t penaltyFor)
+: weight{weight}, rateSample{rateSample}, penalty{penalty}, penaltyFor{penaltyFor} {
+}
+
+
+double peerStats::average(double old, double sample) {
+    return old == 0 ? sample : old + weight * (sample - old);
+}
+
+
+void peerStats::pinged(int node, uint64_t micros) {
+    lock_guard<mutex> lk(statsMutex);
+    auto& stats = peers[node];
+    stats.rtt = average(stats.rtt, micros);
+}
+
+
+void peerStats::started(int node) {
+    lock_guard<mutex> lk(statsMutex);
+    peers[node].reading++;
+}
+
+
+void peerStats::finished(int node, uint64_t bytes, uint64_t micros, bool broken) {
+    lock_guard<mutex> lk(statsMutex);
+    auto& stats = peers[node];
+    stats.reading--;
+    stats.reads++;
+    if (broken) {
+        stats.broken++;
+        stats.brokeAt = timeNow();
+        return;
+    }
+    if (bytes >= rateSample) {
+        stats.perByte = average(stats.perByte, static_cast<double>(micros) / bytes);
+    } else {
+        stats.latency = average(stats.latency, micros);
+    }
+}
+
+
+double peerStats::estimate(const peer& stats, uint64_t bytes, uint64_t now) {
+    // a node nobody measured yet looks as good as the best, so it gets tried
+    double expected = max(stats.rtt, stats.latency);
+    expected += bytes * stats.perByte;
+    // reads already running share the node with this one
+    expected *= 1 + stats.reading;
+    if (stats.brokeAt > 0 && now - stats.brokeAt < penaltyFor) {
+        expected += penalty;
+    }
+    return expected;
+}
+
+
+double peerStats::cost(int node, uint64_t bytes) {
+    lock_guard<mutex> lk(statsMutex);
+    return estimate(peers[node], bytes, timeNow());
+}
+
+
+vector<int> peerStats::rank(vector<int> nodes, uint64_t bytes) {
+    lock_guard<mutex> lk(statsMutex);
+    auto now = timeNow();
+    vector<pair<double, int>> costs;
+    for (auto node : nodes) {
+        costs.push_back(make_pair(estimate(peers[node], bytes, now), node));
+    }
+    stable_sort(costs.begin(), costs.end(), [](const pair<double, int>& a, const pair<double, int>& b) {
+        return a.first < b.first;
+    });
+    for (size_t i=0; i < costs.size(); i++) {
+        nodes[i] = costs[i].second;
+    }
+    return nodes;
+}
+
+
+void peerStats::show() {
+    lock_guard<mutex> lk(statsMutex);
+    vector<int> nodes;
+    for (auto& it : peers) {
+        nodes.push_back(it.first);
+    }
+    sort(nodes.begin(), nodes.end());
+    for (auto node : nodes) {
+        auto& stats = peers[node];
+        cout << node << ": ping " << static_cast<uint64_t>(stats.rtt) << " us, read latency "
+             << static_cast<uint64_t>(stats.latency) << " us, "
+             << static_cast<uint64_t>(stats.perByte > 0 ? 1 / stats.perByte : 0) << " MB/s, " << stats.reading << " reads running, " << stats.reads << " reads, " << stats.broken
+             << " broke off" << endl;
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * @file peer_stats.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * What this node knows of how fast other nodes answer: the round trip of the failure
+ * detector's pings, the latency of small reads, the throughput of large ones, the reads
+ * still running and when a read last broke. All of it is kept as moving averages, that
+ * of throughput as time per byte so that a slow transfer shows at once. Reads
+ * rank the replicas of a file by their expected time and go to the fastest first, so a
+ * loaded or slow node is asked only when the others cannot answer.
+ *
+ */
+class peerStats {
+
+public:
+
+/*
+ * @param weight weight of a new sample in the moving averages
+ * @param rateSample reads of at least this many bytes measure throughput, smaller ones latency
+ * @param penalty microseconds added to the expected time of a node whose last read broke
+ * @param penaltyFor how long that penalty lasts, in microseconds
+ *
+ */
+peerStats(double weight, uint64_t rateSample, uint64_t penalty, uint64_t penaltyFor);
+
+/*
+ * a ping to node came back after micros
+ *
+ */
+void pinged(int node, uint64_t micros);
+
+/*
+ * a read from node starts
+ *
+ */
+void started(int node);
+
+/*
+ * a read from node ended after micros with bytes received
+ * @param broken the node did not answer or the transfer broke off
+ *
+ */
+void finished(int node, uint64_t bytes, uint64_t micros, bool broken);
+
+/*
+ * expected microseconds to read bytes from node
+ *
+ */
+double cost(int node, uint64_t bytes);
+
+/*
+ * nodes ordered by their expected time to read bytes, nodes that look the same keep
+ * their order
+ *
+ */
+vector<int> rank(vector<int> nodes, uint64_t bytes);
+
+/*
+ * print what is known of every node
+ *
+ */
+void show();
+
+private:
+
+struct peer {
+    double rtt;
+    double latency;
+    double perByte;         // microseconds per byte, 0 until measured
+    int reading;
+    uint64_t reads;
+    uint64_t broken;
+    uint64_t brokeAt;
+};
+
+/*
+ * expected time, statsMutex must be held
+ *
+ */
+double estimate(const peer& stats, uint64_t bytes, uint64_t now);
+
+double average(double old, double sample);
+
+const double weight;
+
+const uint64_t rateSample;
+
+const uint64_t penalty;
+
+const uint64_t penaltyFor;
+
+unordered_map<int, peer> peers;
+
+mutex statsMutex;
+};
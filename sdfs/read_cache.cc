@@ -0,0 +1,162 @@
+/*
+ * @file read_cache.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "read_cache.h"
+
+
+readCache::readCache(const string& dir, uint64_t capacity)
+: dir{dir}, capacity{capacity}, size{0}, changes{0}, hits{0}, validated{0}, misses{0}, invalidated{0} {
+    mkdir(dir.c_str(), 0755);
+    DIR* copies = opendir(dir.c_str());
+    if (copies == nullptr) {
+        perror("Cannot open read cache");
+        return;
+    }
+    while (auto copy = readdir(copies)) {
+        string name(copy->d_name);
+        if (name.compare(".") != 0 && name.compare("..") != 0) {
+            ::remove((dir + "/" + name).c_str());
+        }
+    }
+    closedir(copies);
+}
+
+
+bool readCache::find(const string& sdfsName, uint64_t& version, bool& leased) {
+    lock_guard<mutex> lk(cacheMutex);
+    auto it = entries.find(sdfsName);
+    if (it == entries.end()) {
+        return false;
+    }
+    version = it->second.version;
+    leased = chrono::steady_clock::now() < it->second.expiry;
+    return true;
+}
+
+
+bool readCache::copyTo(const string& sdfsName, const string& localName) {
+    // the open copy pins the entry, a copy removed or replaced meanwhile is only unlinked
+    // and stays readable, so other reads do not wait for this one
+    ifstream src;
+    {
+        lock_guard<mutex> lk(cacheMutex);
+        auto it = entries.find(sdfsName);
+        if (it == entries.end()) {
+            return false;
+        }
+        src.open(path(sdfsName), ios::binary);
+        if (!src.good()) {
+            remove(it);
+            return false;
+        }
+        uses.splice(uses.begin(), uses, it->second.use);
+    }
+    ofstream dst(localName, ios::binary | ios::trunc);
+    if (!(dst << src.rdbuf())) {
+        return false;
+    }
+    lock_guard<mutex> lk(cacheMutex);
+    hits++;
+    return true;
+}
+
+
+uint64_t readCache::generation() {
+    lock_guard<mutex> lk(cacheMutex);
+    return changes;
+}
+
+
+bool readCache::renew(const string& sdfsName, chrono::steady_clock::time_point expiry, uint64_t seen) {
+    lock_guard<mutex> lk(cacheMutex);
+    auto it = entries.find(sdfsName);
+    if (it == entries.end() || changes != seen) {
+        return false;
+    }
+    it->second.expiry = expiry;
+    validated++;
+    return true;
+}
+
+
+void readCache::insert(const string& sdfsName, const string& localName, uint64_t version,
+                       chrono::steady_clock::time_point expiry, uint64_t seen) {
+    auto length = fileSize(localName);
+    if (length > capacity) {
+        return;
+    }
+    lock_guard<mutex> lk(cacheMutex);
+    if (changes != seen) {
+        return;
+    }
+    auto it = entries.find(sdfsName);
+    if (it != entries.end()) {
+        remove(it);
+    }
+    while (size + length > capacity && !uses.empty()) {
+        remove(entries.find(uses.back()));
+    }
+
+    ifstream src(localName, ios::binary);
+    ofstream dst(path(sdfsName), ios::binary | ios::trunc);
+    if (!src.good() || !(dst << src.rdbuf())) {
+        dst.close();
+        ::remove(path(sdfsName).c_str());
+        return;
+    }
+    uses.push_front(sdfsName);
+    entries[sdfsName] = entry{version, length, expiry, uses.begin()};
+    size += length;
+}
+
+
+void readCache::erase(const string& sdfsName) {
+    lock_guard<mutex> lk(cacheMutex);
+    changes++;
+    auto it = entries.find(sdfsName);
+    if (it != entries.end()) {
+        remove(it);
+        invalidated++;
+    }
+}
+
+
+void readCache::missed() {
+    lock_guard<mutex> lk(cacheMutex);
+    misses++;
+}
+
+
+void readCache::show() {
+    lock_guard<mutex> lk(cacheMutex);
+    cout << entries.size() << " files cached, " << size / 1024 << " of " << capacity / 1024 << " KB\n"
+         << hits << " reads served locally (" << validated << " validated with the primary), "
+         << misses << " over the network, " << invalidated << " copies invalidated" << endl;
+}
+
+
+string readCache::path(const string& sdfsName) {
+    // escaped like the names of stored files, so two names never share a copy
+    string name;
+    for (size_t i=0; i < sdfsName.size(); i++) {
+        auto c = sdfsName[i];
+        if (c == '/' || c == '%' || (c == '.' && i == 0)) {
+            char escaped[4];
+            snprintf(escaped, sizeof(escaped), "%%%02X", c);
+            name += escaped;
+        } else {
+            name += c;
+        }
+    }
+    return dir + "/" + name;
+}
+
+
+void readCache::remove(unordered_map<string, entry>::iterator it) {
+    ::remove(path(it->first).c_str());
+    uses.erase(it->second.use);
+    size -= it->second.size;
+    entries.erase(it);
+}
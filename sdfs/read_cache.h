@@ -0,0 +1,154 @@
+/*
+ * @file read_cache.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include "../util/util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <dirent.h>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+
+using namespace std;
+
+
+/*
+ * Bounded cache of sdfs files this node fetched from other nodes, one copy per file in
+ * a directory of its own. Every entry keeps the version (checksum) it was fetched at
+ * and the lease its primary granted. While the lease runs the copy is used without
+ * asking anybody, the primary tells the holders when the file changes. Once it ran out
+ * the copy has to be validated against the version of the primary again. The least
+ * recently used copies are removed when the cache is full.
+ *
+ */
+class readCache {
+
+public:
+
+/*
+ * @param dir directory of the copies, emptied as entries do not survive a restart
+ * @param capacity most bytes kept
+ *
+ */
+readCache(const string& dir, uint64_t capacity);
+
+/*
+ * look up a file
+ * @param version set to the version of the copy
+ * @param leased set if its lease still runs
+ * @return false if the file is not cached
+ *
+ */
+bool find(const string& sdfsName, uint64_t& version, bool& leased);
+
+/*
+ * copy the cached file to localName, other reads of the cache go on meanwhile
+ * @return false if it was removed in the meantime
+ *
+ */
+bool copyTo(const string& sdfsName, const string& localName);
+
+/*
+ * number of invalidations so far. A version the primary sent after generation()
+ * returned seen is only used if no invalidation arrived in between, it may be older
+ * than the one the invalidation announced.
+ *
+ */
+uint64_t generation();
+
+/*
+ * the primary confirmed the version of the copy, use it until expiry
+ * @return false if the copy is gone or an invalidation came in after seen
+ *
+ */
+bool renew(const string& sdfsName, chrono::steady_clock::time_point expiry, uint64_t seen);
+
+/*
+ * keep a copy of the fetched file localName as sdfsName, older copies are removed
+ * until it fits. Files larger than the cache are not kept.
+ *
+ */
+void insert(const string& sdfsName, const string& localName, uint64_t version,
+            chrono::steady_clock::time_point expiry, uint64_t seen);
+
+/*
+ * drop the copy of a file that changed or was deleted
+ *
+ */
+void erase(const string& sdfsName);
+
+/*
+ * count a read that went over the network
+ *
+ */
+void missed();
+
+/*
+ * print the size of the cache and how reads were served
+ *
+ */
+void show();
+
+private:
+
+struct entry {
+    uint64_t version;
+    uint64_t size;
+    chrono::steady_clock::time_point expiry;
+    list<string>::iterator use;
+};
+
+/*
+ * path of the copy of sdfsName
+ *
+ */
+string path(const string& sdfsName);
+
+/*
+ * remove an entry and its copy, cacheMutex must be held
+ *
+ */
+void remove(unordered_map<string, entry>::iterator it);
+
+string dir;
+
+const uint64_t capacity;
+
+uint64_t size;
+
+/*
+ * invalidations received, whether or not a copy was dropped
+ *
+ */
+uint64_t changes;
+
+unordered_map<string, entry> entries;
+
+/*
+ * cached files, most recently used first
+ *
+ */
+list<string> uses;
+
+/*
+ * reads served from a copy, those of them validated with the primary first, reads
+ * that went over the network and copies dropped because their file changed
+ *
+ */
+uint64_t hits;
+uint64_t validated;
+uint64_t misses;
+uint64_t invalidated;
+
+mutex cacheMutex;
+};
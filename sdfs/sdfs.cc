@@ -11,139 +11,208 @@
 const string VMPREFIX = "shahzad-";
 
 sdfs::sdfs(int number, logger &logg)
-: myNumber{number}, log(logg) {
+: myNumber{number},
+  conns{PORT2, logg, [this](int node){ return fd->IPAddrs[node]; },
+        [this](uint32_t IP){ return getNodeNumber(IP); }},
+  meta(METALOG, METASNAPSHOT), cache(CACHEDIR, CACHEBYTES),
+  hot(HOTBYTES, HOTFILEMAX, HOTGHOSTS), peers(PEERWEIGHT, RATESAMPLE, BROKENPENALTY, BROKENFOR),
+  commits(STOREROOT, chrono::milliseconds(GROUPCOMMITMS), GROUPCOMMITFILES, SYNCFSFILES),
+  storeDirs(STOREFANOUT * STOREFANOUT, false), repairWorkers(REPAIRSTREAMS, "repair"),
+  clientWorkers(CLIENTSTREAMS, "client"), nextOp{1},
+  repairThrottle(REPAIRRATE), repairQueued{0}, repairDone{0}, repairFailed{0}, repairBytes{0}, log(logg), placement(VNODES) {
 
     fd = new failureDetector(number, logg, this);
     createSocket();
     fill(ring.begin(), ring.end(), false);
     ring[number] = true;
-    isAllFileNamesRecvd = false;
+    placement.add(number);
     isAllJuiceFilesRecvd = false;
+    juiceParts = 0;
+    blockLayout = false;
+    codedLayout = false;
+    compression = true;
+    durable = false;
+    directWrites = false;
+    zeroCopy = false;
+    handedOff = handOffPending = 0;
+    handingOff = handOffAgain = false;
+    mkdir(STOREROOT.c_str(), 0755);
+    commits.syncAlways(METALOG);
+    writeQuorum = WRITEQUORUM;
+    readQuorum = READQUORUM;
+    lastVersion = 0;
+    loadFiles();
     thread recvMessagesThread(&sdfs::recvMessages, this);
     recvMessagesThread.detach();  // let this run on its own
 }
 
 void sdfs::recvMessages() {
+    // GET, READ, BGET and JSND are small but answered with whole files
+    auto isBulk = [](const string& firstFrame, bool ended) {
+        return !ended || firstFrame.compare(0, 3, "GET") == 0 || firstFrame.compare(0, 4, "READ") == 0 ||
+               firstFrame.compare(0, 4, "BGET") == 0 || firstFrame.compare(0, 4, "JSND") == 0;
+    };
+    conns.serve(sockFd, [this](shared_ptr<request> req){ handleMessage(req); }, isBulk);
+}
+
 
+void sdfs::handleMessage(shared_ptr<request> req) {
     char recvBuf[MAXDATASIZE];
     int numBytes, offset, senderNode;
-    struct sockaddr_in theirAddr;
-    socklen_t theirAddrLen = sizeof(theirAddr);
 
-    listen(sockFd,10);
+    numBytes = req->read(recvBuf, MAXDATASIZE - 1);
+    if (numBytes <= 0) {
+        return;
+    }
+    recvBuf[numBytes] = '\0';
+    senderNode = req->node;
+
+    if (strncmp(recvBuf, "PUT", 3) == 0) { // put a file
+        log(INFO) << "received a file to store";
+        offset = 3;
+
+        char label;
+        memcpy(&label, recvBuf+offset, sizeof(label));
+        offset += sizeof(label);
+
+        uint64_t version;
+        char layout;
+        uint64_t newer = 0;
+        auto fileName = recvFile(recvBuf, *req, numBytes, offset, version, layout, false, &newer);
+        if (!fileName.empty()) {
+            addFile(fileName, label, version, layout);
+        } else if (newer != 0) {
+            sendStale(*req, newer);
+        }
+
+    } else if (strncmp(recvBuf, "APND", 4) == 0) { // append to a file this node is the primary of
+        log(INFO) << "received bytes to append from " << senderNode;
+        recvAppend(recvBuf, *req, numBytes, 4);
 
-    // keep listening for incoming connections
-    while(1) {
-        int newConnFd = -1;
-        newConnFd = accept(sockFd, (struct sockaddr *) &theirAddr, &theirAddrLen);
+    } else if (strncmp(recvBuf, "APR", 3) == 0) { // append the primary passes on to a replica
+        recvAppendReplica(recvBuf, *req, numBytes, 4, recvBuf[3]);
 
-        if (newConnFd < 0) {
-            perror("Cannot accept incoming connection");
-        }
+    } else if (strncmp(recvBuf, "CHN", 3) == 0) { // put a file and pass it down the chain
+        char label = recvBuf[3];
+        log(INFO) << "received a chain replicated file to store with label " << label;
+        recvChainFile(string(recvBuf, numBytes), *req, label);
 
-        numBytes = read(newConnFd, recvBuf, MAXDATASIZE - 1);
-        recvBuf[numBytes] = '\0';
-        senderNode = getNodeNumber(ntohl(theirAddr.sin_addr.s_addr));
+    } else if(strncmp(recvBuf, "GET", 3) == 0) { // Get a file
+        log(INFO) << "received a request to send a file" << endl;
+        offset = 3;
 
-        if (strncmp(recvBuf, "PUT", 3) == 0) { // put a file
-            log(INFO) << "received a file to store";
-            offset = 3;
+        char label;
+        memcpy(&label, recvBuf+offset, sizeof(label));
+        offset += sizeof(label);
+        log(INFO) << "received a request to send a file with label " << label;
 
-            char label;
-            memcpy(&label, recvBuf+offset, sizeof(label));
-            offset += sizeof(label);
+        int requestNode;
+        memcpy(&requestNode, recvBuf+offset, sizeof(requestNode));
+        offset += sizeof(requestNode);
+        requestNode = ntohl(requestNode);
 
-            auto fileName = recvFile(recvBuf, newConnFd, numBytes, offset);
+        int localNameSize;
+        memcpy(&localNameSize, recvBuf+offset, sizeof(localNameSize));
+        offset += sizeof(localNameSize);
+        localNameSize = ntohl(localNameSize);
 
-            files.insert(pair<string,char>(fileName, label));
+        int sdfsNameSize;
+        memcpy(&sdfsNameSize, recvBuf+offset, sizeof(sdfsNameSize));
+        offset += sizeof(sdfsNameSize);
+        sdfsNameSize = ntohl(sdfsNameSize);
 
-        } else if(strncmp(recvBuf, "GET", 3) == 0) { // Get a file
-            log(INFO) << "received a request to send a file" << endl;
-            offset = 3;
+        char localName[localNameSize+1];
+        memcpy(localName, recvBuf+offset, localNameSize);
+        offset += localNameSize;
+        localName[localNameSize] = '\0';
 
-            char label;
-            memcpy(&label, recvBuf+offset, sizeof(label));
-            offset += sizeof(label);
-            log(INFO) << "received a request to send a file with label " << label;
+        char sdfsName[sdfsNameSize+1];
+        memcpy(sdfsName, recvBuf+offset, sdfsNameSize);
+        offset += sdfsNameSize;
+        sdfsName[sdfsNameSize] = '\0';
 
-            int requestNode;
-            memcpy(&requestNode, recvBuf+offset, sizeof(requestNode));
-            offset += sizeof(requestNode);
-            requestNode = ntohl(requestNode);
+        sendFile(requestNode, localName, sdfsName, label);
 
-            int localNameSize;
-            memcpy(&localNameSize, recvBuf+offset, sizeof(localNameSize));
-            offset += sizeof(localNameSize);
-            localNameSize = ntohl(localNameSize);
+    } else if(strncmp(recvBuf, "DELT", 4) == 0) { // Delete the file
+        log(INFO) << "received a request to delete a file";
+        offset = 4;
 
-            int sdfsNameSize;
-            memcpy(&sdfsNameSize, recvBuf+offset, sizeof(sdfsNameSize));
-            offset += sizeof(sdfsNameSize);
-            sdfsNameSize = ntohl(sdfsNameSize);
+        int fileNameSize;
+        memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+        offset += sizeof(fileNameSize);
+        fileNameSize = ntohl(fileNameSize);
 
-            char localName[localNameSize+1];
-            memcpy(localName, recvBuf+offset, localNameSize);
-            offset += localNameSize;
-            localName[localNameSize] = '\0';
+        char fileName[fileNameSize+1];
+        memcpy(fileName, recvBuf+offset, fileNameSize);
+        offset += fileNameSize;
+        fileName[fileNameSize] = '\0';
 
-            char sdfsName[sdfsNameSize+1];
-            memcpy(sdfsName, recvBuf+offset, sdfsNameSize);
-            offset += sdfsNameSize;
-            sdfsName[sdfsNameSize] = '\0';
+        log(INFO) << "received a request to delete " << fileName;
+        auto removed = removeFile(fileName);
+        req->write(removed ? "DELD" : "NFIL", 4, true);
 
-            sendFile(requestNode, localName, sdfsName, label);
+    } else if(strncmp(recvBuf, "FILE", 4) == 0) { // FILE in response to GETT
+        log(INFO) << "received the file in response to GET";
+        offset = 4;
+        uint64_t version;
+        char layout;
+        recvFile(recvBuf, *req, numBytes, offset, version, layout, true);
 
-        } else if(strncmp(recvBuf, "DELT", 4) == 0) { // Delete the file
-            log(INFO) << "received a request to delete a file";
-            offset = 4;
+    } else if(strncmp(recvBuf, "READ", 4) == 0) { // read a stored file, the reply carries it
+        offset = 4;
 
-            int fileNameSize;
-            memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
-            offset += sizeof(fileNameSize);
-            fileNameSize = ntohl(fileNameSize);
+        int fileNameSize;
+        memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+        offset += sizeof(fileNameSize);
+        fileNameSize = ntohl(fileNameSize);
 
-            char fileName[fileNameSize+1];
-            memcpy(fileName, recvBuf+offset, fileNameSize);
-            offset += fileNameSize;
-            fileName[fileNameSize] = '\0';
+        string fileName(recvBuf+offset, fileNameSize);
+        offset += fileNameSize;
 
-            log(INFO) << "received a request to delete " << fileName;
-            removeFile(fileName);
+        uint64_t start, length, version;
+        memcpy(&start, recvBuf+offset, sizeof(start));
+        offset += sizeof(start);
+        memcpy(&length, recvBuf+offset, sizeof(length));
+        offset += sizeof(length);
+        memcpy(&version, recvBuf+offset, sizeof(version));
+        offset += sizeof(version);
 
-        } else if(strncmp(recvBuf, "FILE", 4) == 0) { // FILE in response to GETT
-            log(INFO) << "received the file in response to GET";
-            offset = 4;
-            recvFile(recvBuf, newConnFd, numBytes, offset);
+        log(DEBUG) << "received a request to read " << fileName << " from " << senderNode;
+        sendData(*req, fileName, ntohll(start), ntohll(length), ntohll(version));
 
-        } else if(strncmp(recvBuf, "NFIL", 4) == 0) { // FILE does not exist in response to GETT
-            offset = 4;
+    } else if(strncmp(recvBuf, "NFIL", 4) == 0) { // FILE does not exist in response to GETT
+        offset = 4;
 
-            int fileNameSize;
-            memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
-            offset += sizeof(fileNameSize);
-            fileNameSize = ntohl(fileNameSize);
+        int fileNameSize;
+        memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+        offset += sizeof(fileNameSize);
+        fileNameSize = ntohl(fileNameSize);
 
-            char fileName[fileNameSize+1];
-            memcpy(fileName, recvBuf+offset, fileNameSize);
-            offset += fileNameSize;
-            fileName[fileNameSize] = '\0';
+        char fileName[fileNameSize+1];
+        memcpy(fileName, recvBuf+offset, fileNameSize);
+        offset += fileNameSize;
+        fileName[fileNameSize] = '\0';
 
-        } else if(strncmp(recvBuf, "UPDA", 4) == 0) { // FILE does not exist in response to GETT
-            offset = 4;
+    } else if(strncmp(recvBuf, "UPDA", 4) == 0) { // FILE does not exist in response to GETT
+        offset = 4;
 
-            char label = recvBuf[4];
-            offset++;
+        char label = recvBuf[4];
+        offset++;
 
-            log(INFO) << "Update " << label << " message received";
+        log(INFO) << "Update " << label << " message received";
 
-            int fileCount;
-            memcpy(&fileCount, recvBuf+offset, sizeof(fileCount));
-            offset += sizeof(fileCount);
-            fileCount = ntohl(fileCount);
+        int fileCount;
+        memcpy(&fileCount, recvBuf+offset, sizeof(fileCount));
+        offset += sizeof(fileCount);
+        fileCount = ntohl(fileCount);
 
-            log(DEBUG) << "File count " << fileCount;
+        log(DEBUG) << "File count " << fileCount;
 
-            int fileNameLen;
+        vector<string> missing, announced;
+        vector<pair<string, char>> relabeled;
+        int fileNameLen;
+        {
+            lock_guard<mutex> lk(filesMutex);
             for (int i=0; i < fileCount; i++) {
                 memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
                 offset += sizeof(fileNameLen);
@@ -152,97 +221,111 @@ void sdfs::recvMessages() {
                 string fileName(recvBuf+offset, fileNameLen);
                 offset += fileNameLen;
 
-                log(DEBUG) << "fileName " << fileName;
+                uint64_t version;
+                memcpy(&version, recvBuf+offset, sizeof(version));
+                offset += sizeof(version);
+                version = ntohll(version);
+                announced.push_back(fileName);
 
                 auto it = files.find(fileName);
                 if (it != files.end()) {
                     it->second = label;
+                    relabeled.emplace_back(fileName, label);
+                    // a copy that missed writes while this node was away is brought up to date
+                    if (versions[fileName] < version && missingFiles.insert(make_pair(fileName, label)).second) {
+                        missing.push_back(fileName);
+                    }
                 } else {
-                    missingFiles.insert(pair<string, char>(fileName, label));
-                    sendGetMessage(myNumber, senderNode, fileName, fileName, 'A');
+                    // a file already being fetched only takes the new label
+                    auto pending = missingFiles.insert(pair<string, char>(fileName, label));
+                    if (pending.second) {
+                        missing.push_back(fileName);
+                    } else {
+                        pending.first->second = label;
+                    }
                 }
             }
+            meta.relabel(relabeled);
+        }
+        // the new labels reach the disk with one sync, lookups do not wait for it
+        meta.sync();
+        queueRepair(senderNode, missing);
+        if (label == 'A') {
+            takeOver(announced);
+        }
 
-        } else if(strncmp(recvBuf, "QURY", 4) == 0) { // check if this file exits
-            offset = 4;
-            log(INFO) << "received QURY message";
-
-            int requestNode;
-            memcpy(&requestNode, recvBuf+offset, sizeof(requestNode));
-            offset += sizeof(requestNode);
-            requestNode = ntohl(requestNode);
-
-            log(DEBUG) << "request Node " << requestNode;
+    } else if(strncmp(recvBuf, "BGET", 4) == 0) { // send a batch of files to re-replicate them
+        log(INFO) << "received a request to re-replicate files from " << senderNode;
+        sendBatch(*req, recvBuf, 4);
 
-            int fileNameLen;
-            memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
-            offset += sizeof(fileNameLen);
-            fileNameLen = ntohl(fileNameLen);
+    } else if(strncmp(recvBuf, "DSYN", 4) == 0) { // send the blocks a stale replica is missing
+        log(INFO) << "received a request to sync a stale replica from " << senderNode;
+        sendDelta(*req, recvBuf, 4);
 
-            string fileName(recvBuf+offset, fileNameLen);
+    } else if(strncmp(recvBuf, "VERS", 4) == 0) { // version of a file and a lease on it
+        sendVersion(*req, recvBuf, 4);
 
-            log(DEBUG) << "fileName " << fileName;
+    } else if(strncmp(recvBuf, "INVL", 4) == 0) { // a file this node cached changed
+        offset = 4;
 
-            auto it = files.find(fileName);
-            if (it != files.end()) {
-                sendExistMessage(requestNode, it->second);
-                if (it->second != 'C') {
-                    sendQueryMessage(requestNode, successorNode(myNumber), fileName);
-                }
-            }
+        int fileNameSize;
+        memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+        offset += sizeof(fileNameSize);
+        fileNameSize = ntohl(fileNameSize);
 
-        } else if(strncmp(recvBuf, "EXST", 4) == 0) { // reply for Query message if file exists
-            offset = 4;
+        string fileName(recvBuf+offset, fileNameSize);
+        log(DEBUG) << "sdfs/ " << senderNode << " invalidated the cached copy of " << fileName;
+        cache.erase(fileName);
+        req->write("ACKI", 4, true);
 
-            char label = recvBuf[offset];
+    } else if(strncmp(recvBuf, "LABL", 4) == 0) { // label of a file at this node
+        sendLabel(*req, recvBuf, 4);
 
-            struct in_addr tmp;
-            tmp.s_addr = htonl(fd->IPAddrs[senderNode]);
-            auto IP = inet_ntoa(tmp);
-            cout << IP << "      " << label << endl;
+    } else if(strncmp(recvBuf, "NVER", 4) == 0) { // a writer asks the primary for a new version of a file
+        sendNewVersion(*req, recvBuf, 4);
 
+    } else if(strncmp(recvBuf, "HOVR", 4) == 0 || strncmp(recvBuf, "OWNS", 4) == 0) { // primaries after a join
+        recvOwnership(*req, recvBuf, senderNode);
 
-        } else if(strncmp(recvBuf, "GEF", 3) == 0) { // request to get filenames given a prefix
-            offset = 3;
+    } else if(strncmp(recvBuf, "CTCH", 4) == 0) { // this node missed a write of a file
+        offset = 4;
 
-            int sdfsPrefixLen;
-            memcpy(&sdfsPrefixLen, recvBuf+offset, sizeof(sdfsPrefixLen));
-            offset += sizeof(sdfsPrefixLen);
-            sdfsPrefixLen = ntohl(sdfsPrefixLen);
-            string dirPrefix(recvBuf+offset, sdfsPrefixLen);
+        uint64_t version;
+        memcpy(&version, recvBuf+offset, sizeof(version));
+        offset += sizeof(version);
 
-            log() << "sdfs/ received GEF message from " << senderNode << " for " << dirPrefix;
+        int fileNameSize;
+        memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+        offset += sizeof(fileNameSize);
+        fileNameSize = ntohl(fileNameSize);
 
-            sendFileNames(dirPrefix, senderNode);
+        string fileName(recvBuf+offset, fileNameSize);
+        log(INFO) << "sdfs/ " << senderNode << " found the copy of " << fileName << " here out of date";
+        catchUp(fileName, ntohll(version));
 
-        } else if(strncmp(recvBuf, "FNAM", 4) == 0) { // response to GEF
-            log() << "sdfs/ received FNAM message from " << senderNode;
-            offset = 4;
-            recvFileNames(recvBuf+4, senderNode);
+    } else if(strncmp(recvBuf, "GEF", 3) == 0) { // request to get filenames given a prefix
+        sendFileNames(*req, recvBuf, 3);
 
-        } else if(strncmp(recvBuf, "JSND", 4) == 0) { // request to send juice input files
-            log() << "sdfs/ received a request to send juice input files";
+    } else if(strncmp(recvBuf, "JSND", 4) == 0) { // request to send juice input files
+        log() << "sdfs/ received a request to send juice input files";
 
-            handleSendJuiceInputFiles(recvBuf+4);
+        handleSendJuiceInputFiles(recvBuf+4);
 
-        } else if(strncmp(recvBuf, "JFIL", 4) == 0) { // receive juice input file
-            log(INFO) << "received a juice file from " << senderNode;
-            offset = 4;
-            recvJuiceFile(recvBuf, newConnFd, numBytes, offset);
+    } else if(strncmp(recvBuf, "JFIL", 4) == 0) { // receive juice input file
+        log(INFO) << "received a juice file from " << senderNode;
+        offset = 4;
+        recvJuiceFile(recvBuf, *req, numBytes, offset);
 
-        } else if(strncmp(recvBuf, "JSNT", 4) == 0) { // sent all juice input files
-            log(INFO) << "received all juices file sent " << senderNode;
-            handleAllJuiceFilesSent(senderNode);
+    } else if(strncmp(recvBuf, "JSNT", 4) == 0) { // sent all juice input files
+        log(INFO) << "received all juices file sent " << senderNode;
+        handleAllJuiceFilesSent(senderNode);
 
-        } else if(strncmp(recvBuf, "DELI", 4) == 0) { // delete intermediate files
-            log(INFO) << "received delete intermediate files message from " << senderNode;
-            handleDeleteIntermediateFiles(recvBuf+4);
+    } else if(strncmp(recvBuf, "DELI", 4) == 0) { // delete intermediate files
+        log(INFO) << "received delete intermediate files message from " << senderNode;
+        handleDeleteIntermediateFiles(recvBuf+4);
 
-        } else { // unrecongnized message
-            log(ERROR) << "sdfs/ Unkown message: " << recvBuf;
-            exit(2);
-        }
-        close(newConnFd);
+    } else { // unrecongnized message, the request ends without an answer and fails at the sender
+        log(ERROR) << "sdfs/ unknown message " << string(recvBuf, min(numBytes, 4)) << " from " << senderNode;
     }
 }
 
@@ -264,23 +347,39 @@ void sdfs::deleteIntermediateFiles(string prefix) {
     cout << "deleteing Intermediate Files\n";
     log() << "deleteing Intermediate Files\n";
     
-    string sysCmd = "rm -f ";
-    for (auto it=files.begin(); it!=files.end(); it++ ){
-        if(isPrefix(prefix, it->first) ) {
-            string cmd = sysCmd + it->first;
-            system(cmd.c_str());
-            files.erase(it);
+    vector<string> removed;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        // files is sorted, the names with prefix are next to each other
+        for (auto it=files.lower_bound(prefix); it!=files.end() && isPrefix(prefix, it->first); ){
+            removeLocalFile(it->first);
+            removed.push_back(it->first);
+            it = files.erase(it);
         }
+        meta.erase(removed);
+    }
+    meta.sync();
+    for (auto& fileName : removed) {
+        invalidateLeases(fileName);
     }
     cout << "all intermediate files deleted\n";
     log() << "sdfs/ all intermediate files deleted";
 }
 
+void sdfs::expectJuiceFiles() {
+    lock_guard<mutex> lk(cvJuiceFilesMutex);
+    for (int i=1; i < NODES+1; i++) {
+        if (ring[i]) {
+            juiceFilesNotifications.insert(i);
+        }
+    }
+}
+
 void sdfs::handleAllJuiceFilesSent(int node) {
+    lock_guard<mutex> lk(cvJuiceFilesMutex);
     juiceFilesNotifications.erase(node);
 
     if (juiceFilesNotifications.empty()) {
-        lock_guard<mutex> lk(cvJuiceFilesMutex);
         isAllJuiceFilesRecvd = true;
         cout << "Notifying One for juice Files" << endl;
         log() << "sdfs/ Notify other thread that all juice Files have been received";
@@ -304,14 +403,8 @@ void sdfs::sendDeleteIntermediateFiles(string prefix) {
 
     for (int node=1; node < NODES+1; node++) {
         if (ring[node]) {
-            int connToServer;
-            int status = connectToServer(node, &connToServer);
-            if(status) {
+            if (!conns.send(node, message, offset)) {
                 cout <<"deleteIntermediateFiles: Cannot connect to "<< node << endl;
-
-            } else {
-                write(connToServer, message, offset);
-                close(connToServer);
             }
         }
     }
@@ -362,32 +455,46 @@ void sdfs::sendJuiceInputFiles(string prefix, int countJuices, unordered_map<int
     log() << "sdfs/ sending Juice input files";
     cout << "sending Juice input files" << endl;
 
-    for (auto it = files.begin(); it != files.end(); it++) {
-        if(it->second == 'A' && isPrefix(prefix, it->first) ) {
-            auto key = getKey(it->first);
-            if (key.size() == 0) {
-                continue;
+    vector<string> inputFiles;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto it = files.lower_bound(prefix); it != files.end() && isPrefix(prefix, it->first); it++) {
+            if(it->second == 'A') {
+                inputFiles.push_back(it->first);
             }
-            juicerID =  hash<string>{}(key) % countJuices;
-            auto it1 = juiceIDs.find(juicerID);
-
-            if (it1 != juiceIDs.end()) {
-                pushFileToNode(it1->second, it->first, prefix+"_"+key, "JFIL");
+        }
+    }
+    for (auto& fileName : inputFiles) {
+        // a container holds the output of a whole maple task, every key goes to its own juicer
+        packFile pack;
+        if (packFile::isPack(fileName) && pack.open(storePath(fileName))) {
+            for (auto& key : pack.keys()) {
+                uint64_t start, length;
+                auto it1 = juiceIDs.find(hash<string>{}(key) % countJuices);
+                if (key.size() > 0 && it1 != juiceIDs.end() && pack.find(key, start, length)) {
+                    pushFileToNode(it1->second, storePath(fileName), prefix+"_"+key, "JFIL", start, length);
+                }
             }
+            continue;
+        }
+
+        auto key = getKey(fileName);
+        if (key.size() == 0) {
+            continue;
+        }
+        juicerID =  hash<string>{}(key) % countJuices;
+        auto it1 = juiceIDs.find(juicerID);
+
+        if (it1 != juiceIDs.end()) {
+            pushFileToNode(it1->second, storePath(fileName), prefix+"_"+key, "JFIL");
         }
     }
     char message[10];
     strcpy(message, "JSNT");
     int offset = 4;
     for (auto it = juiceIDs.begin(); it != juiceIDs.end(); it++) {
-        int connToServer;
-        int status = connectToServer(it->second, &connToServer);
-        if(status) {
+        if (!conns.send(it->second, message, offset)) {
             cout <<"sendJuiceInputFiles: Cannot connect to "<< it->second << endl;
-
-        } else {
-            write(connToServer, message, offset);
-            close(connToServer);
         }
     }
     log() << "sdfs/ all juice input files sent";
@@ -395,16 +502,18 @@ void sdfs::sendJuiceInputFiles(string prefix, int countJuices, unordered_map<int
 }
 
 
-void sdfs::recvJuiceFile(char * recvBuf, int connFd, int numBytes, int offset) {
+void sdfs::recvJuiceFile(char * recvBuf, request& req, int numBytes, int offset) {
+    offset += sizeof(uint64_t) + 1;     // juice files have no version and are whole
+
     int fileNameSize;
     memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
     offset += sizeof(fileNameSize);
     fileNameSize = ntohl(fileNameSize);
 
-    int length;
+    uint64_t length;
     memcpy(&length, recvBuf+offset, sizeof(length));
     offset += sizeof(length);
-    length = ntohl(length);
+    length = ntohll(length);
 
     string fileName(recvBuf+offset, fileNameSize);
     offset += fileNameSize;
@@ -413,106 +522,85 @@ void sdfs::recvJuiceFile(char * recvBuf, int connFd, int numBytes, int offset) {
         return;
     }
 
-    ofstream wFile(fileName, ios::binary | ios::app);
-    wFile.write(recvBuf + offset, numBytes - offset);
-
-    length -= (numBytes - offset);
-    while (length ) {
-        numBytes = read(connFd, recvBuf, MAXDATASIZE - 1);
-        recvBuf[numBytes] = '\0';
-        wFile.write(recvBuf, numBytes);
-        length -= numBytes;
+    // the lines of a key come from several containers, every transfer is received on its own
+    // so a broken one leaves nothing behind and two of them cannot interleave
+    string partName;
+    {
+        lock_guard<mutex> lk(cvJuiceFilesMutex);
+        partName = fileName + "#part" + to_string(juiceParts++);
     }
-    juiceFiles.insert(fileName);
-    wFile.close();
-}
-
-
-void sdfs::recvFileNames(char* recvBuf, int senderNode) {
-    log() << "sdfs/ storing fileNames received from " << senderNode;
-    int count;
-    int offset = 0;
-    memcpy(&count, recvBuf, sizeof(count));
-    count = ntohl(count);
-    offset += sizeof(count);
-
-    int fileNameLen;
-    for (int i=0; i < count; i++) {
-        memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
-        offset += sizeof(fileNameLen);
-        fileNameLen = ntohl(fileNameLen);
+    ofstream part(partName, ios::binary | ios::trunc);
+    part.write(recvBuf + offset, numBytes - offset);
 
-        fileNames.insert(string(recvBuf+offset, fileNameLen));
-        offset += fileNameLen;
+    length -= (numBytes - offset);
+    bool received = recvFileChunks(req, part, length);
+    part.close();
+    if (!received || !part) {
+        log(ERROR) << "sdfs/ connection closed while receiving juice file " << fileName << ", dropped what arrived";
+        remove(partName.c_str());
+        return;
     }
-
-    log() << "sdfs/ " << count <<" fileName received from " << senderNode;
-
-    cout << count <<" fileName received from " << senderNode << endl;
-    fileNameRequestSent.erase(senderNode);
-
-    if (fileNameRequestSent.empty()) {
-        lock_guard<mutex> lk(cvMutex);
-        isAllFileNamesRecvd = true;
-        cout << "Notifying One" << endl;
-        cv.notify_one();
+    {
+        lock_guard<mutex> lk(cvJuiceFilesMutex);
+        ofstream wFile(fileName, ios::binary | ios::app);
+        ifstream rFile(partName, ios::binary);
+        if (rFile.peek() != ifstream::traits_type::eof()) {
+            wFile << rFile.rdbuf();
+        }
+        juiceFiles.insert(fileName);
     }
+    remove(partName.c_str());
 }
 
 
-void sdfs::sendFileNames(string dirPrefix, int node) {
-    char message[MAXDATASIZE];
-    strcpy(message, "FNAM");
-    int offset = 4;
-
-    int count = 0;
-    offset += sizeof(count);
-    int fileNameLen;
-    int sentFileNameLen;
-    log() << "sdfs/ sending fileNames for " << dirPrefix;
+void sdfs::sendFileNames(request& req, char* recvBuf, int offset) {
+    int sdfsPrefixLen;
+    memcpy(&sdfsPrefixLen, recvBuf+offset, sizeof(sdfsPrefixLen));
+    offset += sizeof(sdfsPrefixLen);
+    sdfsPrefixLen = ntohl(sdfsPrefixLen);
+    string dirPrefix(recvBuf+offset, sdfsPrefixLen);
 
-    for (auto it=files.begin(); it!=files.end(); it++ ){
-        if(it->second == 'A' && isPrefix(dirPrefix, it->first) ) {
-            fileNameLen = it->first.size();
-            sentFileNameLen = htonl(fileNameLen);
-            memcpy(message+offset, &sentFileNameLen, sizeof(sentFileNameLen));
-            offset += sizeof(sentFileNameLen);
+    log() << "sdfs/ sending fileNames for " << dirPrefix << " to " << req.node;
 
-            memcpy(message+offset, &it->first[0], fileNameLen);
-            offset += fileNameLen;
-            count++;
+    // reply: pages of FNAM, count as 32 bit and length and name of every file, ended by
+    // a page without names. files is sorted, so a page starts where the one before
+    // ended and only names with the prefix are visited.
+    string after;
+    bool first = true;
+    uint64_t total = 0;
+    int count;
+    do {
+        string page("FNAM");
+        page.resize(4 + sizeof(count));
+        count = 0;
+        {
+            lock_guard<mutex> lk(filesMutex);
+            auto it = first ? files.lower_bound(dirPrefix) : files.upper_bound(after);
+            for (; it != files.end() && isPrefix(dirPrefix, it->first) && page.size() < LISTPAGE; it++) {
+                after = it->first;
+                if (it->second != 'A' || isBlock(it->first)) {
+                    continue;
+                }
+                int sentFileNameLen = htonl(it->first.size());
+                page.append(reinterpret_cast<char*>(&sentFileNameLen), sizeof(sentFileNameLen));
+                page.append(it->first);
+                count++;
+            }
         }
-    }
-    log(DEBUG) << "sdfs/ total fileNames sending " << count;
-    count = htonl(count);
-    memcpy(message+4, &count, sizeof(count));
-
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
-        cout <<"sendExistMessage: Cannot connect to "<< node << endl;
-
-    } else {
-        write(connToServer, message, offset);
-        close(connToServer);
-    }
-    log() << "fileNames sent for " << dirPrefix;
-}
-
-
-void sdfs::getFileNames(string dirPrefix) {
-    log() << "sdfs/ sending Get file names message for dir " << dirPrefix;
-    sendGetFileNamesMessage(dirPrefix);
-
-    unique_lock<mutex> lk(cvMutex);
-    log() << "sdfs/ waiting for fileNames for " << dirPrefix;
-    cout << "Waiting... \n";
-    cv.wait(lk, [this]{return isAllFileNamesRecvd;});
+        first = false;
+        total += count;
+        int sentCount = htonl(count);
+        memcpy(&page[4], &sentCount, sizeof(sentCount));
+        if (!req.write(&page[0], page.size(), count == 0)) {
+            log() << "sdfs/ listing of " << dirPrefix << " for " << req.node << " broke off";
+            return;
+        }
+    } while (count > 0);
+    log() << "sdfs/ " << total << " fileNames sent for " << dirPrefix;
 }
 
 
-void sdfs::sendGetFileNamesMessage(string dirPrefix) {
-    isAllFileNamesRecvd = false;
+bool sdfs::listFiles(const string& dirPrefix, const function<void(const string&)>& found) {
     int sdfsPrefixLen = dirPrefix.size();
     int sentSdfsPrefixLen = htonl(sdfsPrefixLen);
 
@@ -526,22 +614,69 @@ void sdfs::sendGetFileNamesMessage(string dirPrefix) {
     memcpy(message+offset, &dirPrefix[0], sdfsPrefixLen);
     offset += sdfsPrefixLen;
 
-    log(DEBUG) << "GEF" << " message Length " << offset;
-
+    // every node starts on its listing at once, the replies are read one node after the other
+    vector<pair<int, shared_ptr<request>>> reqs;
+    bool complete = true;
     for (size_t hostNode = 1; hostNode < ring.size(); hostNode++) {
         if (ring[hostNode]) {
-            fileNameRequestSent.insert(hostNode);
-            int connToServer;
-            int status = connectToServer(hostNode, &connToServer);
-            if(status) {
-                cout <<"sendGetMessage: Cannot connect to "<< hostNode << endl;
+            auto req = conns.open(hostNode);
+            if(!req || !req->write(message, offset, true)) {
+                cout <<"listFiles: Cannot connect to "<< hostNode << endl;
+                complete = false;
             } else {
                 log(DEBUG) << "sdfs/ sending Get file Names message to " << hostNode;
-                write(connToServer, message, offset);
-                close(connToServer);
+                reqs.emplace_back(hostNode, req);
+            }
+        }
+    }
+
+    string fileName;
+    for (auto& sent : reqs) {
+        auto& req = sent.second;
+        int count = -1;
+        do {
+            char header[4 + sizeof(count)];
+            if (!req->readAll(header, sizeof(header)) || strncmp(header, "FNAM", 4) != 0) {
+                break;
+            }
+            memcpy(&count, header+4, sizeof(count));
+            count = ntohl(count);
+            for (int i=0; i < count; i++) {
+                int fileNameLen;
+                if (!req->readAll(reinterpret_cast<char*>(&fileNameLen), sizeof(fileNameLen))) {
+                    break;
+                }
+                fileName.resize(ntohl(fileNameLen));
+                if (!req->readAll(&fileName[0], fileName.size())) {
+                    break;
+                }
+                found(fileName);
             }
+        } while (count > 0);
+        if (count != 0) {
+            cout <<"listFiles: listing from "<< sent.first << " broke off" << endl;
+            complete = false;
         }
     }
+    return complete;
+}
+
+
+void sdfs::getFileNames(string dirPrefix) {
+    log() << "sdfs/ getting file names for dir " << dirPrefix;
+    fileNames.clear();
+    listFiles(dirPrefix, [this](const string& fileName) { fileNames.insert(fileName); });
+    log() << "sdfs/ " << fileNames.size() << " fileNames for " << dirPrefix;
+}
+
+
+void sdfs::showFileNames(const string& dirPrefix) {
+    uint64_t count = 0;
+    bool complete = listFiles(dirPrefix, [&count](const string& fileName) {
+        cout << fileName << "\n";
+        count++;
+    });
+    cout << count << " files" << (complete ? "" : ", some nodes could not be listed") << endl;
 }
 
 
@@ -591,13 +726,8 @@ void sdfs::sendJuiceFilesToJuicers(string prefix, int countJuices, unordered_map
 
     for (int node = 1; node < NODES+1; node++) {
         if(ring[node]) {
-            int connToServer;
-            int status = connectToServer(node, &connToServer);
-            if(status) {
+            if (!conns.send(node, message, offset)) {
                 cout <<"sendJuiceIputMessages: Cannot connect to "<< node << endl;
-            } else {
-                write(connToServer, message, offset);
-                close(connToServer);
             }
         }
     }
@@ -606,27 +736,15 @@ void sdfs::sendJuiceFilesToJuicers(string prefix, int countJuices, unordered_map
 }
 
 
-void sdfs::recvMapleFiles() {
-    isAllMapleFilesRecvd = false;
-    {
-        lock_guard<mutex> lk(mapleFilesMutex);
-            for (auto it = mapleFiles.begin(); it !=mapleFiles.end(); it++) {
-            auto hostNode = location(*it);
-            if (hostNode == myNumber) {
-                recvdMapleFiles.insert(*it);
-                mapleFiles.erase(it);
-            }
-        }
-    }
-    unique_lock<mutex> lk(cvMapleFilesMutex);
-    log() << "sdfs/ waiting for mapleFiles";
-    cout << "Waiting for MapleFiles... \n";
-    cvMapleFiles.wait(lk, [this]{return isAllMapleFilesRecvd;});
-    log() << "sdfs/ all maple Files have been received.";
-}
+string sdfs::recvFile(char * recvBuf, request& req, int numBytes, int offset, uint64_t& version, char& layout,
+                      bool fetched, uint64_t* newer) {
+    memcpy(&version, recvBuf+offset, sizeof(version));
+    offset += sizeof(version);
+    version = ntohll(version);
 
+    layout = recvBuf[offset];
+    offset++;
 
-string sdfs::recvFile(char * recvBuf, int connFd, int numBytes, int offset) {
     int fileNameSize;
     memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
     offset += sizeof(fileNameSize);
@@ -635,10 +753,10 @@ string sdfs::recvFile(char * recvBuf, int connFd, int numBytes, int offset) {
     log(DEBUG) << "Receiving file";
     log(DEBUG) << "fileNameSize " << fileNameSize;
 
-    int length;
+    uint64_t length;
     memcpy(&length, recvBuf+offset, sizeof(length));
     offset += sizeof(length);
-    length = ntohl(length);
+    length = ntohll(length);
 
     log(DEBUG) << "length of the file " << length;
 
@@ -647,87 +765,68 @@ string sdfs::recvFile(char * recvBuf, int connFd, int numBytes, int offset) {
 
     log(DEBUG) << "fileName " << fileName;
 
-    ofstream wFile(fileName, ios::binary | ios::trunc);
-    wFile.write(recvBuf + offset, numBytes - offset);
+    // a PUT that lost the race with a newer one is read off the connection and dropped
+    auto storedVersion = fetched ? 0 : fileVersion(fileName);
+    bool stale = version != 0 && version < storedVersion;
+    auto wFile = stale ? unique_ptr<ostream>(new ofstream()) : createFile(fetched ? fileName : storePath(fileName), length);
+    wFile->write(recvBuf + offset, numBytes - offset);
 
     length -= (numBytes - offset);
 
-    while (length ) {
-        numBytes = read(connFd, recvBuf, MAXDATASIZE - 1);
-        recvBuf[numBytes] = '\0';
-        wFile.write(recvBuf, numBytes);
-        length -= numBytes;
+    if (!recvFileChunks(req, *wFile, length)) {
+        log(ERROR) << "sdfs/ connection closed while receiving " << fileName << ", dropped what arrived";
+        wFile.reset();
+        if (fetched) {
+            remove(fileName.c_str());
+        } else if (!stale) {
+            // the transfer truncated the copy stored before, that one is gone as well
+            dropCopy(fileName, fileVersion(fileName));
+            removeLocalFile(fileName);
+        }
+        return "";
     }
 
-    // if this File is one of the missing files.
-    auto it = missingFiles.find(fileName);
-    if (it != missingFiles.end()) {
-        files.insert(pair<string, char>(it->first, it->second));
-        missingFiles.erase(fileName);
+    if (stale) {
+        log(INFO) << "sdfs/ dropped version " << version << " of " << fileName << ", a newer one is stored";
+        if (newer) {
+            *newer = storedVersion;
+        }
+        return "";
     }
-
-    wFile.close();
+    wFile.reset();
     log(INFO) << "stored file on local disk";
 
-    lock_guard<mutex> lk(mapleFilesMutex);
-    if (!mapleFiles.empty()) {
-        auto it = mapleFiles.find(fileName);
-        if (it != mapleFiles.end()) {
-            recvdMapleFiles.insert(fileName);
-            mapleFiles.erase(it);
-        }
-        if (mapleFiles.empty()) {
-            lock_guard<mutex> lk(cvMapleFilesMutex);
-            isAllMapleFilesRecvd = true;
-            cout << "Notifying One for Maple Files" << endl;
-            log() << "sdfs/ Notify other thread that all mapleFiles have been received";
-            cvMapleFiles.notify_one();
-
-        }
+    // if this File is one of the missing files.
+    replicaArrived(fileName, version, layout);
+    bool replica;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        replica = files.find(fileName) != files.end();
     }
-    return fileName;
-}
-
-
-void sdfs::sendExistMessage(int node, char label) {
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
-        cout <<"sendExistMessage: Cannot connect to "<< node << endl;
-    } else {
-        char message[MAXDATASIZE];
-        strcpy(message, "EXST");
-        int offset = 4;
-
-        message[offset] = label;
-        offset++;
 
-        write(connToServer, message, offset);
-        close(connToServer);
+    // a striped or coded file answers GET with its manifest, the parts are read from here
+    if (fetched && !replica) {
+        assembleFile(fileName, layout);
     }
-}
-
-
-void sdfs::sendFileToSuccessor(string fileName, char label) {
-    auto node = successorNode(myNumber);
-    string code("PUT");
-    code += label;
-    pushFileToNode(node, fileName, fileName, code);
+    return fileName;
 }
 
 
 void sdfs::sendFile(int requestNode, string localName, string sdfsName, char label) {
-    auto it = files.find(localName);
-    if (it != files.end()) {
-        pushFileToNode(requestNode, localName, sdfsName, "FILE");
+    bool stored;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(localName) != files.end();
+    }
+    if (stored) {
+        pushFileToNode(requestNode, storePath(localName), sdfsName, "FILE", 0, WHOLEFILE, 0, fileLayout(localName));
 
-    } else if (label != 'C') {
-        sendGetMessage(requestNode, successorNode(myNumber), sdfsName, localName, label+1);
+    } else if (label != 'C' && nextReplica(sdfsName) != 0) {
+        sendGetMessage(requestNode, nextReplica(sdfsName), sdfsName, localName, label+1);
 
     } else {
-        int connToServer;
-        int status = connectToServer(requestNode, &connToServer);
-        if(status) {
+        auto req = conns.open(requestNode);
+        if(!req) {
             cout <<"sendFile: Cannot connect to "<< requestNode << endl;
 
         } else {
@@ -744,362 +843,3245 @@ void sdfs::sendFile(int requestNode, string localName, string sdfsName, char lab
             memcpy(message+offset, &localName[0], localNameLen);
             offset += localNameLen;
 
-            write(connToServer, message, offset);
-            close(connToServer);
+            req->write(message, offset, true);
         }
     }
 }
 
 
-void sdfs::fetchFile(string sdfsName, string localName) {
+bool sdfs::fetchFile(string sdfsName, string localName) {
     auto hostNode = location(sdfsName);
 
     log(INFO) << "fetching file " << sdfsName <<  ", hosting node " << hostNode;
-    if (hostNode == myNumber) {
-        if (sdfsName.compare(localName) != 0) {
-            ifstream  src(sdfsName, ios::binary);
-            ofstream  dst(localName, ios::binary);
+    bool stored;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(sdfsName) != files.end();
+    }
+    // the copy here is read only if no replica of the read quorum has a newer one, a primary
+    // that does not store the file yet reads it from the replicas like any other node
+    uint64_t newest;
+    if (stored && (!readVersion(sdfsName, newest) || fileVersion(sdfsName) < newest)) {
+        stored = false;
+    }
+    if (stored) {
+        auto path = storePath(sdfsName);
+        ofstream  dst(localName, ios::binary);
+        if (auto cached = hot.get(path)) {
+            dst.write(cached->data, cached->length);
+        } else {
+            ifstream  src(path, ios::binary);
             dst << src.rdbuf();
             src.close();
-            dst.close();
         }
-        return;
+        dst.close();
+        return assembleFile(localName, fileLayout(sdfsName));
+    }
+
+    if (readCached(sdfsName, localName)) {
+        log(INFO) << "sdfs/ read " << sdfsName << " from the read cache";
+        return true;
     }
-    sendGetMessage(myNumber, hostNode, sdfsName, localName, 'A');
+    cache.missed();
+
+    uint64_t version;
+    char layout;
+    if (!readVersion(sdfsName, version, &layout)) {
+        cout << "could not fetch " << sdfsName << ", fewer than " << readQuorum << " replicas have it" << endl;
+        return false;
+    }
+    if (!fetchRanges(sdfsName, localName, version)) {
+        cout << "could not fetch " << sdfsName << endl;
+        log(ERROR) << "sdfs/ no replica could send " << sdfsName;
+        return false;
+    }
+    cacheFetched(sdfsName, localName, version, layout);
+    // a striped or coded file answers with its manifest, the parts are fetched now
+    return assembleFile(localName, layout);
 }
 
 
-void sdfs::sendGetMessage(int requestNode, int hostNode, string sdfsName, string localName, char label) {
-    int connToServer;
-    int status = connectToServer(hostNode, &connToServer);
-    if(status) {
-        cout <<"sendGetMessage: Cannot connect to "<< hostNode << endl;
+bool sdfs::fetchRange(const string& sdfsName, const string& localName, uint64_t start, uint64_t length) {
+    bool stored;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(sdfsName) != files.end();
+    }
+    uint64_t version = 0;
+    char layout = fileLayout(sdfsName);
+    if (readQuorum > 1 || !stored) {
+        uint64_t newest;
+        if (!readVersion(sdfsName, newest, &layout)) {
+            cout << "could not fetch " << sdfsName << ", fewer than " << readQuorum << " replicas have it" << endl;
+            return false;
+        }
+        stored = stored && fileVersion(sdfsName) >= newest;
+        version = newest;
+    }
 
+    // of a striped or coded file the manifest is read whole, it tells where the range lives
+    bool whole = layout != LAYOUTBLOCKS && layout != LAYOUTCODED;
+    uint64_t readStart = whole ? start : 0;
+    uint64_t readLength = whole ? length : WHOLEFILE;
+    if (stored) {
+        copyRange(storePath(sdfsName), localName, readStart, readLength);
     } else {
-        int sdfsNameLen = sdfsName.size();
-        int localNameLen = localName.size();
-        int sentSdfsNameLen = htonl(sdfsNameLen);
-        int sentLocalNameLen = htonl(localNameLen);
+        auto replicas = peers.rank(replicaNodes(sdfsName), length);
+        bool read = false;
+        uint64_t fileLength;
+        for (size_t i=0; i < replicas.size() && !read; i++) {
+            ofstream out(localName, ios::binary | ios::trunc);
+            read = readRange(replicas[i], sdfsName, out, readStart, readLength, fileLength, version);
+        }
+        if (!read) {
+            cout << "could not fetch " << sdfsName << endl;
+            log(ERROR) << "sdfs/ no replica could send " << start << "+" << length << " of " << sdfsName;
+            return false;
+        }
+    }
+    return whole || assembleRange(localName, layout, start, length);
+}
 
-        char message[MAXDATASIZE];
-        strcpy(message, "GET");
-        int offset = 3;
 
-        message[offset] = label;
-        offset++;
+bool sdfs::readCached(const string& sdfsName, const string& localName) {
+    uint64_t version;
+    bool leased;
+    if (!cache.find(sdfsName, version, leased)) {
+        return false;
+    }
+    if (!leased) {
+        auto seen = cache.generation();
+        uint64_t current;
+        chrono::steady_clock::time_point expiry;
+        if (!requestVersion(sdfsName, current, expiry) || current != version || !cache.renew(sdfsName, expiry, seen)) {
+            cache.erase(sdfsName);
+            return false;
+        }
+    }
+    return cache.copyTo(sdfsName, localName);
+}
 
-        requestNode = htonl(requestNode);
-        memcpy(message+offset, &requestNode, sizeof(requestNode));
-        offset += sizeof(requestNode);
 
-        memcpy(message+offset, &sentSdfsNameLen, sizeof(sentSdfsNameLen));
-        offset += sizeof(sentSdfsNameLen);
+void sdfs::cacheFetched(const string& sdfsName, const string& localName, uint64_t version, char layout) {
+    // the blocks of a striped file are fetched on their own, only whole files are kept
+    if (layout == LAYOUTBLOCKS || layout == LAYOUTCODED) {
+        return;
+    }
+    auto seen = cache.generation();
+    uint64_t current;
+    chrono::steady_clock::time_point expiry;
+    if (requestVersion(sdfsName, current, expiry) && current == version) {
+        cache.insert(sdfsName, localName, version, expiry, seen);
+    }
+}
 
-        memcpy(message+offset, &sentLocalNameLen, sizeof(sentLocalNameLen));
-        offset += sizeof(sentLocalNameLen);
 
-        memcpy(message+offset, &sdfsName[0], sdfsNameLen);
-        offset += sdfsNameLen;
+bool sdfs::requestVersion(const string& sdfsName, uint64_t& version, chrono::steady_clock::time_point& expiry) {
+    auto req = conns.open(location(sdfsName));
+    if (!req) {
+        return false;
+    }
+    char message[MAXDATASIZE];
+    strcpy(message, "VERS");
+    int offset = 4;
 
-        memcpy(message+offset, &localName[0], localNameLen);
-        offset += localNameLen;
+    int fileNameSize = sdfsName.size();
+    int sentFileNameSize = htonl(fileNameSize);
+    memcpy(message+offset, &sentFileNameSize, sizeof(sentFileNameSize));
+    offset += sizeof(sentFileNameSize);
+    memcpy(message+offset, &sdfsName[0], fileNameSize);
+    offset += fileNameSize;
 
-        log(DEBUG) << "GET" << label << " message Length " << offset;
+    // the primary counts the lease from when it got the request, so do we
+    auto sent = chrono::steady_clock::now();
+    if (!req->write(message, offset, true)) {
+        return false;
+    }
 
-        write(connToServer, message, offset);
-        close(connToServer);
+    // reply: VRSN, version as 64 bit and lease in ms as 32 bit or NFIL
+    char reply[16];
+    if (!req->readAll(reply, 4) || strncmp(reply, "VRSN", 4) != 0 || !req->readAll(reply+4, 12)) {
+        return false;
     }
+    uint32_t lease;
+    memcpy(&version, reply+4, sizeof(version));
+    memcpy(&lease, reply+12, sizeof(lease));
+    version = ntohll(version);
+    expiry = sent + chrono::milliseconds(ntohl(lease));
+    return true;
 }
 
 
-bool sdfs::storeFile(string localName, string sdfsName) {
-    auto node = location(sdfsName);
-    vector<int> nodes;
-    vector<string> messageTypes; 
-    if (node == myNumber) {
-        if (localName.compare(sdfsName) != 0) {
-            ifstream  src(localName, ios::binary);
-            ofstream  dst(sdfsName, ios::binary);
-            dst << src.rdbuf();
-            src.close();
-            dst.close();
-        }
-        files.insert(pair<string, char>(sdfsName, 'A'));
-        
-        node = successorNode(node);     
-        nodes.push_back(node);          //B
-        node = successorNode(node);
-        nodes.push_back(node);          //C
-        
-        messageTypes.push_back("PUTB");
-        messageTypes.push_back("PUTC");
-        return pushFileToNodes(nodes, localName, sdfsName, messageTypes);
-    }
-    if (successorNode(node) == myNumber) {
-        if (localName.compare(sdfsName) != 0) {
-            ifstream  src(localName, ios::binary);
-            ofstream  dst(sdfsName, ios::binary);
-            dst << src.rdbuf();
-            src.close();
-            dst.close();
-        }
-        files.insert(pair<string, char>(sdfsName, 'B'));
-        
-        nodes.push_back(node);                              //A
-        messageTypes.push_back("PUTA");
-
-        nodes.push_back(successorNode(myNumber));          //C
-        messageTypes.push_back("PUTC");
+void sdfs::sendVersion(request& req, char* recvBuf, int offset) {
+    int fileNameSize;
+    memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+    offset += sizeof(fileNameSize);
+    fileNameSize = ntohl(fileNameSize);
 
-        return pushFileToNodes(nodes, localName, sdfsName, messageTypes);
-    }
+    string fileName(recvBuf+offset, fileNameSize);
 
-    if (successorNode(successorNode(node)) == myNumber) {
-        if (localName.compare(sdfsName) != 0) {
-            ifstream  src(localName, ios::binary);
-            ofstream  dst(sdfsName, ios::binary);
-            dst << src.rdbuf();
-            src.close();
-            dst.close();
+    char label = 0;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.find(fileName);
+        if (it != files.end()) {
+            label = it->second;
         }
-        files.insert(pair<string, char>(sdfsName, 'C'));
-        
-        nodes.push_back(node);                          //A
-        messageTypes.push_back("PUTA");
-
-        nodes.push_back(successorNode(node));          //B
-        messageTypes.push_back("PUTB");
+    }
 
-        return pushFileToNodes(nodes, localName, sdfsName, messageTypes);
-        
+    // the lease is granted before the version is read, a PUT landing in between invalidates it
+    uint32_t lease = 0;
+    if (label != 0 && location(fileName) == myNumber) {
+        lease = LEASEMS;
+        lock_guard<mutex> lk(leaseMutex);
+        leases[fileName][req.node] = chrono::steady_clock::now() + chrono::milliseconds(lease);
+    }
+    if (label == 0) {
+        req.write("NFIL", 4, true);
+        return;
     }
 
-    nodes.push_back(node);          //A
-    node = successorNode(node);
-    nodes.push_back(node);          //B
-    node = successorNode(node);
-    nodes.push_back(node);          //C
-    
-    messageTypes.push_back("PUTA");
-    messageTypes.push_back("PUTB");
-    messageTypes.push_back("PUTC");
-    return pushFileToNodes(nodes, localName, sdfsName, messageTypes);
- 
+    char reply[16];
+    memcpy(reply, "VRSN", 4);
+    uint64_t version = htonll(fileVersion(fileName));
+    memcpy(reply+4, &version, sizeof(version));
+    uint32_t sentLease = htonl(lease);
+    memcpy(reply+12, &sentLease, sizeof(sentLease));
+    req.write(reply, sizeof(reply), true);
 }
 
 
-void sdfs::removeFile(string fileName) {
-    auto it = files.find(fileName);
-    if (it != files.end()) {
-        auto label = it->second;
-        files.erase(it);
-
-        string cmd = "rm -f " + fileName;
-        system(cmd.c_str());
-
-        if (label != 'C') {
-            sendDeleteMessage(successorNode(myNumber), fileName);
+void sdfs::invalidateLeases(const string& fileName) {
+    vector<int> holders;
+    {
+        lock_guard<mutex> lk(leaseMutex);
+        auto it = leases.find(fileName);
+        if (it == leases.end()) {
+            return;
+        }
+        auto now = chrono::steady_clock::now();
+        for (auto& lease : it->second) {
+            if (lease.second > now) {
+                holders.push_back(lease.first);
+            }
         }
+        leases.erase(it);
     }
-}
 
+    char message[MAXDATASIZE];
+    strcpy(message, "INVL");
+    int offset = 4;
 
-void sdfs::deleteFile(string fileName) {
-    auto node = location(fileName);
+    int fileNameSize = fileName.size();
+    int sentFileNameSize = htonl(fileNameSize);
+    memcpy(message+offset, &sentFileNameSize, sizeof(sentFileNameSize));
+    offset += sizeof(sentFileNameSize);
+    memcpy(message+offset, &fileName[0], fileNameSize);
+    offset += fileNameSize;
 
-    if (node == myNumber) {
-        removeFile(fileName);
-        return;
+    // a holder that cannot be reached is left to its lease running out
+    vector<shared_ptr<request>> sent;
+    for (auto node : holders) {
+        auto req = conns.open(node);
+        if (req && req->write(message, offset, true)) {
+            sent.push_back(req);
+        }
+    }
+    char ack[4];
+    for (auto& req : sent) {
+        req->readAll(ack, sizeof(ack));
     }
-    sendDeleteMessage(node, fileName);
+    log(DEBUG) << "sdfs/ invalidated " << sent.size() << " cached copies of " << fileName;
 }
 
 
-void sdfs::sendDeleteMessage(int node, string fileName) {
-    int connToServer;
-    int status = connectToServer(node, &connToServer);
-    if(status) {
-        cout <<"sendDeleteMessage: Cannot connect to "<< node << endl;
+vector<int> sdfs::replicaNodes(const string& sdfsName) {
+    return placement.replicas(sdfsName, 3);
+}
+
+
+int sdfs::nextReplica(const string& sdfsName) {
+    auto replicas = replicaNodes(sdfsName);
+    auto it = find(replicas.begin(), replicas.end(), myNumber);
+    if (it == replicas.end() || it+1 == replicas.end()) {
+        return 0;
+    }
+    return *(it+1);
+}
+
+
+bool sdfs::fetchRanges(const string& sdfsName, const string& localName, uint64_t version) {
+    auto replicas = peers.rank(replicaNodes(sdfsName), MINRANGE);
+    ofstream out(localName, ios::binary | ios::trunc);
+
+    // the first range also tells how large the file is
+    uint64_t length = 0;
+    size_t first = 0;
+    while (first < replicas.size() && !readRange(replicas[first], sdfsName, out, 0, MINRANGE, length, version)) {
+        out.seekp(0);
+        first++;
+    }
+    out.close();
+    if (first == replicas.size()) {
+        return false;
+    }
+    if (length <= MINRANGE) {
+        return true;
+    }
+
+    // split the rest evenly among the replicas that are not far slower than the fastest one,
+    // range i starts at replica i and moves down the others if it fails. The replica that
+    // sent the first range goes first.
+    rotate(replicas.begin(), replicas.begin() + first, replicas.end());
+    size_t count = 1;
+    auto share = (length - MINRANGE) / replicas.size();
+    auto best = peers.cost(replicas[0], share);
+    while (count < replicas.size() && peers.cost(replicas[count], share) <= SLOWREPLICA * max(best, 1.0)) {
+        count++;
+    }
+    auto rangeSize = (length - MINRANGE + count - 1) / count;
+    vector<char> fetched(count, false);
+    {
+        workerPool workers(count, "ranges");
+        for (size_t i=0; i < count; i++) {
+            uint64_t start = MINRANGE + i * rangeSize;
+            if (start >= length) {
+                fetched[i] = true;
+                continue;
+            }
+            uint64_t rangeLength = min(rangeSize, length - start);
+            workers.submit([this, &sdfsName, &localName, &replicas, &fetched, i, start, rangeLength, version]{
+                ofstream range(localName, ios::binary | ios::in | ios::out);
+                uint64_t size;
+                for (size_t j=0; j < replicas.size() && !fetched[i]; j++) {
+                    range.seekp(start);
+                    fetched[i] = readRange(replicas[(i + j) % replicas.size()], sdfsName, range,
+                                           start, rangeLength, size, version);
+                }
+            });
+        }
+    }
+    log(INFO) << "sdfs/ fetched " << sdfsName << " from " << count << " replicas, " << replicas[0] << " first";
+    return find(fetched.begin(), fetched.end(), false) == fetched.end();
+}
+
+
+void sdfs::sendGetMessage(int requestNode, int hostNode, string sdfsName, string localName, char label) {
+    auto req = conns.open(hostNode);
+    if(!req) {
+        cout <<"sendGetMessage: Cannot connect to "<< hostNode << endl;
 
     } else {
-        int fileNameLen = sizeof(fileName);
-        int sentFileNameLen = htonl(fileNameLen);
+        int sdfsNameLen = sdfsName.size();
+        int localNameLen = localName.size();
+        int sentSdfsNameLen = htonl(sdfsNameLen);
+        int sentLocalNameLen = htonl(localNameLen);
 
         char message[MAXDATASIZE];
-        strcpy (message, "DELT");
-        int offset = 4;
-        memcpy (message+offset, &sentFileNameLen, sizeof(sentFileNameLen));
-        offset += sizeof(sentFileNameLen);
-        memcpy (message+offset, &fileName[0], fileNameLen);
-        offset += fileNameLen;
-        write(connToServer, message, offset);
-        close(connToServer);
+        strcpy(message, "GET");
+        int offset = 3;
+
+        message[offset] = label;
+        offset++;
+
+        requestNode = htonl(requestNode);
+        memcpy(message+offset, &requestNode, sizeof(requestNode));
+        offset += sizeof(requestNode);
+
+        memcpy(message+offset, &sentSdfsNameLen, sizeof(sentSdfsNameLen));
+        offset += sizeof(sentSdfsNameLen);
+
+        memcpy(message+offset, &sentLocalNameLen, sizeof(sentLocalNameLen));
+        offset += sizeof(sentLocalNameLen);
+
+        memcpy(message+offset, &sdfsName[0], sdfsNameLen);
+        offset += sdfsNameLen;
+
+        memcpy(message+offset, &localName[0], localNameLen);
+        offset += localNameLen;
+
+        log(DEBUG) << "GET" << label << " message Length " << offset;
+
+        req->write(message, offset, true);
     }
 }
 
 
-void sdfs::newNode(int node) {
-    ring[node] = true;
+bool sdfs::storeFile(string localName, string sdfsName, bool whole) {
+    cache.erase(sdfsName);
+
+    if ((blockLayout || codedLayout) && !whole) {
+        auto length = fileSize(localName);
+        if (codedLayout && length > CODEDMIN) {
+            return storeFragments(localName, sdfsName, length);
+        }
+        if (blockLayout && length > BLOCKSIZE) {
+            return storeBlocks(localName, sdfsName, length);
+        }
+    }
+    return storeReplicas(localName, sdfsName, 0, WHOLEFILE);
 }
 
 
-void sdfs::updateFileIds() {
-    for (auto it = files.begin(); it != files.end(); ++it) {
-        auto filename = it->first;
-        auto node = location(filename);
+bool sdfs::storeReplicas(const string& localName, const string& sdfsName, uint64_t start, uint64_t length,
+                         char layout) {
+    // a replica that holds a newer version than the one given drops the write, it is stored
+    // again under a version above the one it lost to
+    uint64_t newer = 0;
+    for (int tries = 0; tries < STALETRIES; tries++) {
+        auto version = requestNewVersion(sdfsName, newer);
+        if (version == 0) {
+            log(ERROR) << "sdfs/ the primary of " << sdfsName << " could not give it a version";
+            return false;
+        }
+        auto replicas = replicaNodes(sdfsName);
+
+        // replicas get labels A, B, C in ring order, the chain skips this node
+        vector<int> nodes;
+        vector<string> messageTypes;
+        size_t stored = 0;
+        newer = 0;
+        for (size_t i=0; i < replicas.size(); i++) {
+            char label = 'A' + i;
+            if (replicas[i] != myNumber) {
+                nodes.push_back(replicas[i]);
+                messageTypes.push_back(string("PUT") + label);
+            } else if (version < fileVersion(sdfsName)) {
+                newer = fileVersion(sdfsName);
+            } else {
+                copyRange(localName, storePath(sdfsName), start, length);
+                addFile(sdfsName, label, version, layout);
+                stored++;
+            }
+        }
+        if (newer == 0 && nodes.empty()) {
+            return true;
+        }
+        // the chain acks once it has the copies still missing for writeQuorum, the tail catches up after
+        auto quorum = writeQuorum > stored ? writeQuorum - stored : 0;
+        if (newer == 0 && pushFileToNodes(nodes, localName, sdfsName, messageTypes, start, length, version,
+                                          layout, quorum, &newer)) {
+            return true;
+        }
+        if (newer == 0) {
+            return false;
+        }
+        log(INFO) << "sdfs/ version " << version << " of " << sdfsName << " is older than " << newer
+                  << " held by a replica, it is stored again";
+    }
+    log(ERROR) << "sdfs/ " << sdfsName << " kept losing to newer versions, it was not stored";
+    return false;
+}
+
 
-        if (myNumber == node) {
-            files[filename] = 'A';
+bool sdfs::appendFile(const string& localName, const string& sdfsName) {
+    if (!fileExists(localName)) {
+        cout << "appendFile: Could not open file: " << localName << endl;
+        return false;
+    }
+    cache.erase(sdfsName);
+
+    // the delta is removed once it is applied, the primary here works on a link of its own
+    auto primary = location(sdfsName);
+    if (primary == myNumber) {
+        auto deltaFile = storePath(sdfsName + BLOCKSEP + "append" + to_string(newVersion(sdfsName)));
+        if (link(localName.c_str(), deltaFile.c_str()) < 0) {
+            copyRange(localName, deltaFile, 0, WHOLEFILE);
         }
+        bool isPrimary;
+        return appendDelta(sdfsName, deltaFile, isPrimary);
+    }
+
+    auto length = fileSize(localName);
+    auto req = conns.open(primary);
+    if (!req) {
+        cout << "appendFile: Cannot connect to " << primary << endl;
+        return false;
+    }
+    char header[MAXDATASIZE];
+    int offset = createFileHeader(header, "APND", sdfsName, length);
+
+    req->compress(compression);
+    char reply[4];
+    if (!req->write(header, offset) || !sendFileRange(*req, localName, 0, length) || !req->finish() ||
+        !req->readAll(reply, sizeof(reply))) {
+        log(ERROR) << "sdfs/ append to " << sdfsName << " at " << primary << " broke off";
+        return false;
+    }
+    if (strncmp(reply, "NFIL", 4) == 0) {
+        cout << primary << " is not the primary of " << sdfsName << " (yet), try again" << endl;
     }
+    return strncmp(reply, "APOK", 4) == 0;
 }
 
 
-int sdfs::createUpdaMsg(char* msg, vector<string>& filenames, char fileType) {
+void sdfs::recvAppend(char* recvBuf, request& req, int numBytes, int offset) {
+    offset += sizeof(uint64_t) + 1;     // the client does not pick the version of an append, the file stays whole
 
-    string msgType = "UPDA";
-    msgType += fileType;
+    int fileNameSize;
+    memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+    offset += sizeof(fileNameSize);
+    fileNameSize = ntohl(fileNameSize);
 
-    memcpy(msg, &msgType[0], msgType.size());
-    int bufferlen = msgType.size();
+    uint64_t length;
+    memcpy(&length, recvBuf+offset, sizeof(length));
+    offset += sizeof(length);
+    length = ntohll(length);
 
-    int fileCt = htonl(filenames.size());
-    memcpy(msg+bufferlen, &fileCt, sizeof(fileCt));
-    bufferlen += sizeof(fileCt);
+    string fileName(recvBuf+offset, fileNameSize);
+    offset += fileNameSize;
 
-    for (string filename : filenames) {
-        //filename size
-        int filenameSize = htonl(filename.size());
-        memcpy(msg+bufferlen, &filenameSize, sizeof(filenameSize));
-        bufferlen += sizeof(filenameSize);
+    // the bytes are taken in before the file is locked so a slow client holds up no other append
+    auto deltaFile = storePath(fileName + BLOCKSEP + "append" + to_string(newVersion(fileName)));
+    ofstream delta(deltaFile, ios::binary | ios::trunc);
+    delta.write(recvBuf + offset, numBytes - offset);
+    bool received = recvFileChunks(req, delta, length - (numBytes - offset));
+    delta.close();
+    if (!received) {
+        log(ERROR) << "sdfs/ connection closed while receiving an append to " << fileName;
+        remove(deltaFile.c_str());
+        return;
+    }
 
-        //filename
-        memcpy(msg+bufferlen, &filename[0], filename.size());
-        bufferlen += filename.size();
+    bool primary;
+    bool appended = appendDelta(fileName, deltaFile, primary);
+    req.write(!primary ? "NFIL" : appended ? "APOK" : "APNK", 4, true);
+}
+
+
+bool sdfs::appendDelta(const string& fileName, const string& deltaFile, bool& primary) {
+    // appends of a file are applied one at a time at the primary
+    {
+        unique_lock<mutex> lk(appendMutex);
+        appendDone.wait(lk, [this, &fileName]{ return appending.find(fileName) == appending.end(); });
+        appending.insert(fileName);
     }
-    log(DEBUG) << "update buffer size " << bufferlen;
-    return bufferlen;
+    // the replicas past writeQuorum may still be sent the bytes after the append returns
+    auto delta = shared_ptr<string>(new string(deltaFile), [](string* delta) {
+        remove(delta->c_str());
+        delete delta;
+    });
+    bool appended = applyAppend(fileName, delta, primary);
+
+    // the next append starts once writeQuorum copies have this one, a slower replica that
+    // gets them out of order answers APNK and catches up
+    {
+        lock_guard<mutex> lk(appendMutex);
+        appending.erase(fileName);
+    }
+    appendDone.notify_all();
+    return appended;
 }
 
 
-void sdfs::requestUpdateMasteringFiles() {
-    vector<string> masteringFiles;
-    for (auto it = files.begin(); it != files.end(); ++it) {
-        if (it->second == 'A') {
-            masteringFiles.push_back(it->first);
+bool sdfs::applyAppend(const string& fileName, shared_ptr<string> delta, bool& primary) {
+    char label = 0;
+    bool arrived;
+    {
+        // a file on its way to a new primary is appended to once it is here
+        unique_lock<mutex> lk(filesMutex);
+        arrived = filesArrived.wait_for(lk, chrono::milliseconds(HANDOFFWAITMS), [this, &fileName]{
+            return missingFiles.find(fileName) == missingFiles.end();
+        });
+        auto it = files.find(fileName);
+        if (it != files.end()) {
+            label = it->second;
+        }
+    }
+    // the node a file is on stays its primary until the copy reached a node that joined in front of it
+    primary = location(fileName) == myNumber;
+    if (!primary) {
+        return false;
+    }
+    if (!arrived) {
+        log(ERROR) << "sdfs/ cannot append to " << fileName << ", it has not reached this node yet";
+        return false;
+    }
+    auto path = storePath(fileName);
+    if (label != 0 && fileLayout(fileName) != LAYOUTWHOLE) {
+        log(ERROR) << "sdfs/ cannot append to " << fileName << ", it is striped or erasure coded";
+        return false;
+    }
+
+    // only a file that is not stored yet starts out empty, the copy here is never thrown away
+    blockChecksums checksums;
+    if (label == 0) {
+        ofstream(path, ios::binary | ios::trunc).close();
+        checksums.length = 0;
+        checksums.sums.clear();
+    } else if (!loadChecksums(fileName, checksums)) {
+        log(ERROR) << "sdfs/ cannot append to " << fileName << ", the checksums of its copy cannot be read";
+        return false;
+    }
+    auto offset = checksums.length;
+    {
+        ifstream src(*delta, ios::binary);
+        ofstream dst(path, ios::binary | ios::app);
+        dst << src.rdbuf();
+    }
+    extendChecksums(fileName, checksums);
+    auto version = newVersion(fileName);
+    // a file created here is labeled by its place among the replicas
+    auto replicas = replicaNodes(fileName);
+    auto position = find(replicas.begin(), replicas.end(), myNumber) - replicas.begin();
+    if (label == 0) {
+        label = position < static_cast<long>(replicas.size()) ? 'A' + position : 'A';
+    }
+    addFile(fileName, label, version, LAYOUTWHOLE, &checksums);
+    log(INFO) << "sdfs/ appended " << checksums.length - offset << " bytes to " << fileName << " at " << offset;
+
+    // the primary has one copy, the others come from the replicas
+    vector<function<bool()>> pushes;
+    for (size_t i=0; i < replicas.size(); i++) {
+        char replicaLabel = 'A' + i;
+        auto node = replicas[i];
+        if (node == myNumber) {
+            continue;
         }
+        pushes.push_back([this, delta, fileName, replicaLabel, node, offset, version]{
+            if (pushAppend(node, *delta, fileName, replicaLabel, offset, version)) {
+                return true;
+            }
+            sendCatchUp(node, fileName, version);
+            return false;
+        });
+    }
+    if (!waitQuorum(pushes, writeQuorum > 0 ? writeQuorum - 1 : 0)) {
+        log(ERROR) << "sdfs/ fewer than " << writeQuorum << " replicas have the append to " << fileName;
+        return false;
+    }
+    return true;
+}
+
+
+bool sdfs::pushAppend(int node, const string& deltaFile, const string& fileName, char label, uint64_t offset,
+                      uint64_t version) {
+    ifstream file(deltaFile, ios::binary);
+    auto length = fileSize(deltaFile);
+    auto req = conns.open(node);
+    if (!file.good() || !req) {
+        return false;
+    }
+
+    char header[MAXDATASIZE];
+    int headerLen = createFileHeader(header, string("APR") + label, fileName, length, version);
+    // the offset goes between layout and file name
+    memmove(header + 13 + sizeof(offset), header + 13, headerLen - 13);
+    uint64_t sentOffset = htonll(offset);
+    memcpy(header + 13, &sentOffset, sizeof(sentOffset));
+    headerLen += sizeof(sentOffset);
+
+    req->compress(compression);
+    char reply[4];
+    return req->write(header, headerLen) && sendFileRange(*req, deltaFile, 0, length) && req->finish() &&
+           req->readAll(reply, sizeof(reply)) && strncmp(reply, "APOK", 4) == 0;
+}
+
+
+void sdfs::recvAppendReplica(char* recvBuf, request& req, int numBytes, int offset, char label) {
+    uint64_t version, at;
+    memcpy(&version, recvBuf+offset, sizeof(version));
+    offset += sizeof(version);
+    version = ntohll(version);
+    offset++;   // appends only go to whole files
+    memcpy(&at, recvBuf+offset, sizeof(at));
+    offset += sizeof(at);
+    at = ntohll(at);
+
+    int fileNameSize;
+    memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+    offset += sizeof(fileNameSize);
+    fileNameSize = ntohl(fileNameSize);
+
+    uint64_t length;
+    memcpy(&length, recvBuf+offset, sizeof(length));
+    offset += sizeof(length);
+    length = ntohll(length);
+
+    string fileName(recvBuf+offset, fileNameSize);
+    offset += fileNameSize;
+
+    bool stored;
+    uint64_t current;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(fileName) != files.end();
+        current = stored ? versions[fileName] : 0;
+    }
+    // the bytes only fit a copy that ends where the primary's did, anything else missed an append
+    blockChecksums checksums;
+    if (!stored || !loadChecksums(fileName, checksums)) {
+        checksums.length = 0;
+        checksums.sums.clear();
+    }
+    bool fits = current < version && checksums.length == at && (stored || at == 0);
+    ofstream wFile;
+    if (fits) {
+        wFile.open(storePath(fileName), ios::binary | (stored ? ios::app : ios::trunc));
     }
+    wFile.write(recvBuf + offset, numBytes - offset);
+    bool received = recvFileChunks(req, wFile, length - (numBytes - offset));
+    wFile.close();
 
-    if (masteringFiles.empty()) {
+    if (fits && received) {
+        extendChecksums(fileName, checksums);
+        addFile(fileName, label, version, LAYOUTWHOLE, &checksums);
+        req.write("APOK", 4, true);
+        return;
+    }
+    if (current >= version) {   // a retry of an append applied already
+        req.write("APOK", 4, true);
         return;
     }
+    log(INFO) << "sdfs/ the copy of " << fileName << " here ends at " << checksums.length << ", not at "
+              << at << ", it catches up";
+    req.write("APNK", 4, true);
+    catchUp(fileName, version);
+}
 
-    // send request to potential b/c
-    // msg: UPDA, fileCT, sizeof(filename1), filename1 ...
-    int targetNode = myNumber;
 
-    for (char fileType = 'B'; fileType<='C'; ++fileType) {
-        char msg[MAXDATASIZE2];
-        auto offset = createUpdaMsg(msg, masteringFiles, fileType);
+bool sdfs::storeBlocks(const string& localName, const string& sdfsName, uint64_t length) {
+    blockManifest manifest;
+    manifest.length = length;
+    manifest.blockSize = BLOCKSIZE;
+    for (uint64_t start = 0; start < length; start += BLOCKSIZE) {
+        auto blockName = sdfsName + BLOCKSEP + to_string(manifest.blocks.size());
+        manifest.blocks.push_back(make_pair(blockName, min(BLOCKSIZE, length - start)));
+    }
+    log(INFO) << "sdfs/ striping " << localName << " into " << manifest.blocks.size() << " blocks";
+
+    // every block has its own replicas, store a few of them at a time
+    vector<char> stored(manifest.blocks.size(), false);
+    {
+        workerPool workers(min(manifest.blocks.size(), PARALLELBLOCKS), "blocks");
+        for (size_t i=0; i < manifest.blocks.size(); i++) {
+            workers.submit([this, &localName, &manifest, &stored, i]{
+                stored[i] = storeReplicas(localName, manifest.blocks[i].first, i * manifest.blockSize,
+                                          manifest.blocks[i].second);
+            });
+        }
+    }
+    if (find(stored.begin(), stored.end(), false) != stored.end()) {
+        log(ERROR) << "sdfs/ could not store every block of " << sdfsName;
+        return false;
+    }
+
+    // the manifest is written under a block name so it cannot clash with a local file
+    auto manifestFile = sdfsName + BLOCKSEP + "manifest";
+    if (!writeManifest(manifestFile, manifest)) {
+        return false;
+    }
+    auto ret = storeReplicas(manifestFile, sdfsName, 0, WHOLEFILE, LAYOUTBLOCKS);
+    remove(manifestFile.c_str());
+    return ret;
+}
+
 
-        //send to appropriate node
-        targetNode = successorNode(targetNode);
-        if (targetNode == myNumber) {
+void sdfs::copyRange(const string& localName, const string& sdfsName, uint64_t start, uint64_t length) {
+    // a file copied onto itself would be truncated before it is read
+    struct stat srcStat, dstStat;
+    if (stat(localName.c_str(), &srcStat) == 0 && stat(sdfsName.c_str(), &dstStat) == 0 &&
+        srcStat.st_dev == dstStat.st_dev && srcStat.st_ino == dstStat.st_ino) {
+        if (start == 0 && length == WHOLEFILE) {
             return;
         }
-        int connToServer;
-        int status = connectToServer(targetNode, &connToServer);
-        if(status) {
-            cout <<"requestUpdateMasteringFiles: Cannot connect to "<< targetNode << endl;
+        log(ERROR) << "sdfs/ cannot copy a range of " << localName << " onto itself";
+        return;
+    }
+    ifstream src(localName, ios::binary);
+    ofstream dst(sdfsName, ios::binary | ios::trunc);
+    src.seekg(start);
+
+    char chunk[CHUNKSIZE];
+    while (length > 0) {
+        src.read(chunk, min(length, static_cast<uint64_t>(CHUNKSIZE)));
+        auto numRead = src.gcount();
+        if (numRead <= 0) {
+            break;
+        }
+        dst.write(chunk, numRead);
+        length -= numRead;
+    }
+}
 
-        } else {
-            write(connToServer, msg, offset);
-            close(connToServer);
+
+bool sdfs::readManifest(const string& fileName, blockManifest& manifest) {
+    ifstream file(fileName);
+    string magic;
+    if (!getline(file, magic) || magic != MANIFESTMAGIC) {
+        return false;
+    }
+    file >> manifest.length >> manifest.blockSize;
+
+    manifest.blocks.clear();
+    string blockName;
+    uint64_t blockLength;
+    while (file >> blockName >> blockLength) {
+        manifest.blocks.push_back(make_pair(blockName, blockLength));
+    }
+    return true;
+}
+
+
+bool sdfs::writeManifest(const string& fileName, const blockManifest& manifest) {
+    ofstream file(fileName, ios::trunc);
+    file << MANIFESTMAGIC << "\n" << manifest.length << " " << manifest.blockSize << "\n";
+    for (auto& block : manifest.blocks) {
+        file << block.first << " " << block.second << "\n";
+    }
+    file.close();
+    return file.good();
+}
+
+
+bool sdfs::isBlock(const string& sdfsName) {
+    auto sep = sdfsName.rfind(BLOCKSEP);
+    return sep != string::npos && sep + 1 < sdfsName.size() &&
+           all_of(sdfsName.begin() + sep + 1, sdfsName.end(), ::isdigit);
+}
+
+
+bool sdfs::assembleBlocks(const string& localName) {
+    blockManifest manifest;
+    if (!readManifest(localName, manifest)) {
+        return false;
+    }
+    log(INFO) << "sdfs/ fetching " << manifest.blocks.size() << " blocks of " << localName;
+
+    ofstream(localName, ios::binary | ios::trunc).close();
+
+    vector<char> fetched(manifest.blocks.size(), false);
+    {
+        workerPool workers(min(manifest.blocks.size(), PARALLELBLOCKS), "blocks");
+        uint64_t offset = 0;
+        for (size_t i=0; i < manifest.blocks.size(); i++) {
+            workers.submit([this, &localName, &manifest, &fetched, i, offset]{
+                ofstream out(localName, ios::binary | ios::in | ios::out);
+                fetched[i] = fetchBlock(manifest.blocks[i].first, out, offset);
+            });
+            offset += manifest.blocks[i].second;
+        }
+    }
+    if (find(fetched.begin(), fetched.end(), false) != fetched.end()) {
+        cout << "could not fetch every block of " << localName << endl;
+        log(ERROR) << "sdfs/ could not fetch every block of " << localName;
+        return false;
+    }
+    log(INFO) << "sdfs/ assembled " << localName << " from its blocks";
+    return true;
+}
+
+
+bool sdfs::fetchBlock(const string& sdfsName, ofstream& out, uint64_t offset) {
+    // try the fastest replica first
+    uint64_t length;
+    for (auto node : peers.rank(replicaNodes(sdfsName), 0)) {
+        out.seekp(offset);
+        if (readRange(node, sdfsName, out, 0, WHOLEFILE, length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool sdfs::assembleRange(const string& localName, char layout, uint64_t start, uint64_t length) {
+    blockManifest blocks;
+    codedManifest coded;
+    vector<pair<string, uint64_t>> parts;
+    vector<vector<int>> nodes;
+    uint64_t fileLength;
+    if (layout == LAYOUTBLOCKS && readManifest(localName, blocks)) {
+        fileLength = blocks.length;
+        parts = blocks.blocks;
+        for (auto& block : parts) {
+            nodes.push_back(peers.rank(replicaNodes(block.first), block.second));
+        }
+    } else if (layout == LAYOUTCODED && readCodedManifest(localName, coded)) {
+        fileLength = coded.length;
+        for (int i=0; i < coded.dataFragments; i++) {
+            auto& fragment = coded.fragments[i];
+            parts.push_back(make_pair(fragment.first, min(coded.fragmentSize, fileLength - min(fileLength,
+                                                                                            i * coded.fragmentSize))));
+            nodes.push_back(liveNode(fragment.second) ? vector<int>(1, fragment.second) : vector<int>());
+        }
+    } else {
+        return false;
+    }
+    start = min(start, fileLength);
+    length = min(length, fileLength - start);
+
+    // each part that overlaps the range sends only its share of it
+    vector<tuple<size_t, uint64_t, uint64_t>> reads;
+    uint64_t offset = 0;
+    for (size_t i=0; i < parts.size(); i++) {
+        auto partStart = max(start, offset), partEnd = min(start + length, offset + parts[i].second);
+        if (partStart < partEnd) {
+            reads.push_back(make_tuple(i, partStart - offset, partEnd - partStart));
+        }
+        offset += parts[i].second;
+    }
+    auto manifest = localName + BLOCKSEP + "manifest";
+    rename(localName.c_str(), manifest.c_str());
+    ofstream(localName, ios::binary | ios::trunc).close();
+
+    vector<char> fetched(reads.size(), false);
+    if (!reads.empty()) {
+        workerPool workers(min(reads.size(), PARALLELBLOCKS), "ranges");
+        for (size_t r=0; r < reads.size(); r++) {
+            workers.submit([this, &localName, &parts, &nodes, &reads, &fetched, r, start]{
+                size_t i;
+                uint64_t partStart, partLength;
+                tie(i, partStart, partLength) = reads[r];
+                uint64_t at = 0;
+                for (size_t j=0; j < i; j++) {
+                    at += parts[j].second;
+                }
+                ofstream out(localName, ios::binary | ios::in | ios::out);
+                uint64_t size;
+                for (size_t j=0; j < nodes[i].size() && !fetched[r]; j++) {
+                    out.seekp(at + partStart - start);
+                    fetched[r] = readRange(nodes[i][j], parts[i].first, out, partStart, partLength, size);
+                }
+            });
+        }
+    }
+    if (find(fetched.begin(), fetched.end(), false) == fetched.end()) {
+        remove(manifest.c_str());
+        return true;
+    }
+    if (coded.fragments.empty()) {
+        remove(manifest.c_str());
+        cout << "could not fetch every block of " << start << "+" << length << endl;
+        log(ERROR) << "sdfs/ could not fetch every block of the range " << start << "+" << length;
+        return false;
+    }
+
+    // a data fragment is lost, rebuild the file from the others and cut the range from it
+    log(INFO) << "sdfs/ decoding the fragments of a range of " << localName;
+    bool assembled = assembleFragments(manifest);
+    if (assembled) {
+        copyRange(manifest, localName, start, length);
+    }
+    remove(manifest.c_str());
+    return assembled;
+}
+
+
+bool sdfs::assembleFile(const string& localName, char layout) {
+    if (layout == LAYOUTBLOCKS) {
+        return assembleBlocks(localName);
+    }
+    if (layout == LAYOUTCODED) {
+        return assembleFragments(localName);
+    }
+    return true;
+}
+
+
+bool sdfs::storeFragments(const string& localName, const string& sdfsName, uint64_t length) {
+    codedManifest manifest;
+    manifest.length = length;
+    manifest.dataFragments = CODEDDATA;
+    manifest.parityFragments = CODEDPARITY;
+    manifest.fragmentSize = (length + CODEDDATA - 1) / CODEDDATA;
+    int total = CODEDDATA + CODEDPARITY;
+    auto nodes = fragmentNodes(sdfsName, total);
+    if (nodes.empty()) {
+        return false;
+    }
+    for (int i=0; i < total; i++) {
+        manifest.fragments.push_back(make_pair(sdfsName + BLOCKSEP + "frag" + to_string(i), nodes[i]));
+    }
+    log(INFO) << "sdfs/ coding " << localName << " into " << CODEDDATA << "+" << CODEDPARITY
+              << " fragments of " << manifest.fragmentSize << " bytes";
+
+    // parity is computed chunk by chunk into files next to localName
+    vector<string> parts;
+    for (int i=0; i < total; i++) {
+        parts.push_back(localName + BLOCKSEP + "part" + to_string(i));
+    }
+    {
+        reedSolomon coder(CODEDDATA, CODEDPARITY);
+        vector<vector<uint8_t>> chunks(total, vector<uint8_t>(CHUNKSIZE));
+        vector<const uint8_t*> data;
+        vector<uint8_t*> parity;
+        for (int i=0; i < total; i++) {
+            if (i < CODEDDATA) {
+                data.push_back(chunks[i].data());
+            } else {
+                parity.push_back(chunks[i].data());
+            }
+        }
+        ifstream src(localName, ios::binary);
+        vector<ofstream> outs;
+        for (int i=CODEDDATA; i < total; i++) {
+            outs.emplace_back(parts[i], ios::binary | ios::trunc);
+        }
+        for (uint64_t offset = 0; offset < manifest.fragmentSize; offset += CHUNKSIZE) {
+            auto chunk = min(static_cast<uint64_t>(CHUNKSIZE), manifest.fragmentSize - offset);
+            for (int j=0; j < CODEDDATA; j++) {
+                memset(chunks[j].data(), 0, chunk);
+                auto start = j * manifest.fragmentSize + offset;
+                if (start < length) {
+                    src.clear();
+                    src.seekg(start);
+                    src.read(reinterpret_cast<char*>(chunks[j].data()), min(chunk, length - start));
+                }
+            }
+            coder.encode(data, parity, chunk);
+            for (int i=0; i < CODEDPARITY; i++) {
+                outs[i].write(reinterpret_cast<char*>(parity[i]), chunk);
+            }
+        }
+        for (auto& out : outs) {
+            out.close();
+        }
+    }
+
+    // every fragment goes to its own node, all at once
+    vector<char> stored(total, false);
+    {
+        workerPool workers(total, "fragments");
+        for (int i=0; i < total; i++) {
+            workers.submit([this, &localName, &manifest, &parts, &stored, i]{
+                auto& fragment = manifest.fragments[i];
+                if (i < manifest.dataFragments) {
+                    auto start = i * manifest.fragmentSize;
+                    stored[i] = storeFragment(fragment.second, localName, fragment.first, start,
+                                              min(manifest.fragmentSize, manifest.length - start));
+                } else {
+                    stored[i] = storeFragment(fragment.second, parts[i], fragment.first, 0, WHOLEFILE);
+                }
+            });
+        }
+    }
+    for (int i=CODEDDATA; i < total; i++) {
+        remove(parts[i].c_str());
+    }
+    if (find(stored.begin(), stored.end(), false) != stored.end()) {
+        log(ERROR) << "sdfs/ could not store every fragment of " << sdfsName;
+        return false;
+    }
+
+    // the manifest is written under a block name so it cannot clash with a local file
+    auto manifestFile = sdfsName + BLOCKSEP + "manifest";
+    if (!writeCodedManifest(manifestFile, manifest)) {
+        return false;
+    }
+    auto ret = storeReplicas(manifestFile, sdfsName, 0, WHOLEFILE, LAYOUTCODED);
+    remove(manifestFile.c_str());
+    return ret;
+}
+
+
+bool sdfs::storeFragment(int node, const string& localName, const string& fragmentName, uint64_t start,
+                         uint64_t length) {
+    if (node == myNumber) {
+        copyRange(localName, storePath(fragmentName), start, length);
+        addFile(fragmentName, 'F');
+        return true;
+    }
+    return pushFileToNode(node, localName, fragmentName, "PUTF", start, length);
+}
+
+
+bool sdfs::readCodedManifest(const string& fileName, codedManifest& manifest) {
+    ifstream file(fileName);
+    string magic;
+    if (!getline(file, magic) || magic != CODEDMAGIC) {
+        return false;
+    }
+    file >> manifest.length >> manifest.fragmentSize >> manifest.dataFragments >> manifest.parityFragments;
+
+    manifest.fragments.clear();
+    string fragmentName;
+    int node;
+    while (file >> fragmentName >> node) {
+        manifest.fragments.push_back(make_pair(fragmentName, node));
+    }
+    return static_cast<int>(manifest.fragments.size()) == manifest.dataFragments + manifest.parityFragments;
+}
+
+
+bool sdfs::writeCodedManifest(const string& fileName, const codedManifest& manifest) {
+    ofstream file(fileName, ios::trunc);
+    file << CODEDMAGIC << "\n" << manifest.length << " " << manifest.fragmentSize << " "
+         << manifest.dataFragments << " " << manifest.parityFragments << "\n";
+    for (auto& fragment : manifest.fragments) {
+        file << fragment.first << " " << fragment.second << "\n";
+    }
+    file.close();
+    return file.good();
+}
+
+
+vector<int> sdfs::fragmentNodes(const string& sdfsName, size_t count) {
+    auto nodes = placement.replicas(sdfsName, count);
+    if (!nodes.empty() && nodes.size() < count) {
+        // a small ring holds several fragments per node and tolerates fewer failures
+        log(INFO) << "sdfs/ " << nodes.size() << " nodes for " << count << " fragments of " << sdfsName;
+        auto distinct = nodes.size();
+        while (nodes.size() < count) {
+            nodes.push_back(nodes[nodes.size() % distinct]);
+        }
+    }
+    return nodes;
+}
+
+
+bool sdfs::assembleFragments(const string& localName) {
+    codedManifest manifest;
+    if (!readCodedManifest(localName, manifest)) {
+        return false;
+    }
+    log(INFO) << "sdfs/ fetching the fragments of " << localName;
+
+    int total = manifest.dataFragments + manifest.parityFragments;
+    vector<string> parts;
+    for (int i=0; i < total; i++) {
+        parts.push_back(localName + BLOCKSEP + "part" + to_string(i));
+    }
+    vector<bool> present;
+    vector<bool> wanted(total, false);
+    bool assembled = readFragments(manifest, parts, present);
+    for (int i=0; i < manifest.dataFragments && assembled; i++) {
+        wanted[i] = !present[i];
+    }
+    if (assembled && !decodeFragments(manifest, parts, present, wanted)) {
+        assembled = false;
+    }
+
+    // the data fragments one after the other are the file
+    if (assembled) {
+        ofstream out(localName, ios::binary | ios::trunc);
+        uint64_t left = manifest.length;
+        for (int i=0; i < manifest.dataFragments; i++) {
+            ifstream part(parts[i], ios::binary);
+            char chunk[CHUNKSIZE];
+            auto partLeft = min(left, manifest.fragmentSize);
+            left -= partLeft;
+            while (partLeft > 0 && part.read(chunk, min(partLeft, static_cast<uint64_t>(CHUNKSIZE))).gcount() > 0) {
+                out.write(chunk, part.gcount());
+                partLeft -= part.gcount();
+            }
+            if (partLeft > 0) {
+                assembled = false;
+                break;
+            }
+        }
+        out.close();
+        assembled = assembled && out.good();
+    }
+    for (auto& part : parts) {
+        remove(part.c_str());
+    }
+    if (!assembled) {
+        cout << "could not read enough fragments of " << localName << endl;
+        log(ERROR) << "sdfs/ could not read enough fragments of " << localName;
+        return false;
+    }
+    log(INFO) << "sdfs/ assembled " << localName << " from its fragments";
+    return true;
+}
+
+
+bool sdfs::readFragments(const codedManifest& manifest, const vector<string>& parts, vector<bool>& present) {
+    int total = manifest.dataFragments + manifest.parityFragments;
+    present.assign(total, false);
+    vector<char> read(total, false);
+    int next = 0;
+    int count = 0;
+    while (count < manifest.dataFragments && next < total) {
+        // ask for as many fragments as are still missing, the data ones come first
+        vector<int> round;
+        while (next < total && count + static_cast<int>(round.size()) < manifest.dataFragments) {
+            auto node = manifest.fragments[next].second;
+            if (liveNode(node)) {
+                round.push_back(next);
+            }
+            next++;
+        }
+        if (round.empty()) {
+            break;
+        }
+        {
+            workerPool workers(round.size(), "fragments");
+            for (auto i : round) {
+                workers.submit([this, &manifest, &parts, &read, i]{
+                    auto& fragment = manifest.fragments[i];
+                    if (fragment.second == myNumber) {
+                        {
+                            lock_guard<mutex> lk(filesMutex);
+                            read[i] = files.find(fragment.first) != files.end();
+                        }
+                        copyRange(storePath(fragment.first), parts[i], 0, WHOLEFILE);
+                        return;
+                    }
+                    ofstream out(parts[i], ios::binary | ios::trunc);
+                    uint64_t length;
+                    read[i] = readRange(fragment.second, fragment.first, out, 0, WHOLEFILE, length);
+                });
+            }
+        }
+        for (auto i : round) {
+            present[i] = read[i];
+            count += read[i] ? 1 : 0;
+        }
+    }
+    return count >= manifest.dataFragments;
+}
+
+
+bool sdfs::decodeFragments(const codedManifest& manifest, const vector<string>& parts, const vector<bool>& present,
+                           const vector<bool>& wanted) {
+    int total = manifest.dataFragments + manifest.parityFragments;
+    if (find(wanted.begin(), wanted.end(), true) == wanted.end()) {
+        return true;
+    }
+    bool parity = find(wanted.begin() + manifest.dataFragments, wanted.end(), true) != wanted.end();
+
+    reedSolomon coder(manifest.dataFragments, manifest.parityFragments);
+    vector<vector<uint8_t>> chunks(total, vector<uint8_t>(CHUNKSIZE));
+    vector<uint8_t*> shards;
+    vector<ifstream> ins(total);
+    vector<ofstream> outs(total);
+    for (int i=0; i < total; i++) {
+        shards.push_back(chunks[i].data());
+        if (present[i]) {
+            ins[i].open(parts[i], ios::binary);
+        } else if (wanted[i]) {
+            outs[i].open(parts[i], ios::binary | ios::trunc);
+        }
+    }
+
+    // fragments read short, the last data one, are padded with zeros like when they were coded
+    for (uint64_t offset = 0; offset < manifest.fragmentSize; offset += CHUNKSIZE) {
+        auto chunk = min(static_cast<uint64_t>(CHUNKSIZE), manifest.fragmentSize - offset);
+        for (int i=0; i < total; i++) {
+            if (present[i]) {
+                ins[i].read(reinterpret_cast<char*>(shards[i]), chunk);
+                memset(shards[i] + ins[i].gcount(), 0, chunk - ins[i].gcount());
+                ins[i].clear();
+            }
+        }
+        if (!coder.reconstruct(shards, present, chunk, parity)) {
+            return false;
+        }
+        for (int i=0; i < total; i++) {
+            if (wanted[i]) {
+                outs[i].write(reinterpret_cast<char*>(shards[i]), chunk);
+            }
+        }
+    }
+    for (int i=0; i < total; i++) {
+        if (wanted[i]) {
+            outs[i].close();
+            if (!outs[i].good()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+void sdfs::rebuildFragments() {
+    vector<string> primaries;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto& file : layouts) {
+            auto it = files.find(file.first);
+            if (file.second == LAYOUTCODED && it != files.end() && it->second == 'A') {
+                primaries.push_back(file.first);
+            }
+        }
+    }
+    for (auto& fileName : primaries) {
+        codedManifest manifest;
+        if (!readCodedManifest(storePath(fileName), manifest)) {
+            continue;
+        }
+        for (auto& fragment : manifest.fragments) {
+            if (fragment.second != myNumber && !liveNode(fragment.second)) {
+                repairWorkers.submit([this, fileName]{ rebuildFragments(fileName); });
+                break;
+            }
+        }
+    }
+}
+
+
+bool sdfs::rebuildFragments(const string& sdfsName) {
+    codedManifest manifest;
+    if (fileLayout(sdfsName) != LAYOUTCODED || !readCodedManifest(storePath(sdfsName), manifest)) {
+        return false;
+    }
+    int total = manifest.dataFragments + manifest.parityFragments;
+    vector<bool> lost(total, false);
+    set<int> holding;
+    for (int i=0; i < total; i++) {
+        auto node = manifest.fragments[i].second;
+        if (node != myNumber && !liveNode(node)) {
+            lost[i] = true;
+        } else {
+            holding.insert(node);
+        }
+    }
+    if (find(lost.begin(), lost.end(), true) == lost.end()) {
+        return true;
+    }
+
+    // live nodes without a fragment of the file take the lost ones, in ring order
+    auto candidates = fragmentNodes(sdfsName, placement.size());
+    vector<int> spare;
+    for (auto node : candidates) {
+        if (holding.count(node) == 0) {
+            spare.push_back(node);
+        }
+    }
+    if (spare.empty()) {
+        spare = candidates;
+    }
+
+    vector<string> parts;
+    for (int i=0; i < total; i++) {
+        parts.push_back(sdfsName + BLOCKSEP + "part" + to_string(i));
+    }
+    vector<bool> present;
+    bool rebuilt = readFragments(manifest, parts, present) && decodeFragments(manifest, parts, present, lost);
+    size_t next = 0;
+    for (int i=0; i < total && rebuilt; i++) {
+        if (!lost[i]) {
+            continue;
+        }
+        auto node = spare[next++ % spare.size()];
+        rebuilt = storeFragment(node, parts[i], manifest.fragments[i].first, 0, WHOLEFILE);
+        manifest.fragments[i].second = node;
+        log(INFO) << "sdfs/ rebuilt " << manifest.fragments[i].first << " on " << node;
+    }
+    for (auto& part : parts) {
+        remove(part.c_str());
+    }
+    if (!rebuilt) {
+        log(ERROR) << "sdfs/ could not rebuild the lost fragments of " << sdfsName;
+        return false;
+    }
+
+    auto manifestFile = sdfsName + BLOCKSEP + "manifest";
+    if (!writeCodedManifest(manifestFile, manifest)) {
+        return false;
+    }
+    auto ret = storeReplicas(manifestFile, sdfsName, 0, WHOLEFILE, LAYOUTCODED);
+    remove(manifestFile.c_str());
+    return ret;
+}
+
+
+bool sdfs::readRange(int node, const string& sdfsName, ofstream& out, uint64_t start, uint64_t length,
+                     uint64_t& fileLength, uint64_t version) {
+    peers.started(node);
+    auto began = timeNow();
+    auto req = conns.open(node);
+    if (!req) {
+        peers.finished(node, 0, timeNow() - began, true);
+        return false;
+    }
+    char message[MAXDATASIZE];
+    strcpy(message, "READ");
+    int offset = 4;
+
+    int fileNameSize = sdfsName.size();
+    int sentFileNameSize = htonl(fileNameSize);
+    memcpy(message+offset, &sentFileNameSize, sizeof(sentFileNameSize));
+    offset += sizeof(sentFileNameSize);
+    memcpy(message+offset, &sdfsName[0], fileNameSize);
+    offset += fileNameSize;
+
+    uint64_t sentStart = htonll(start);
+    memcpy(message+offset, &sentStart, sizeof(sentStart));
+    offset += sizeof(sentStart);
+    uint64_t sentLength = htonll(length);
+    memcpy(message+offset, &sentLength, sizeof(sentLength));
+    offset += sizeof(sentLength);
+    uint64_t sentVersion = htonll(version);
+    memcpy(message+offset, &sentVersion, sizeof(sentVersion));
+    offset += sizeof(sentVersion);
+
+    // reply: DATA, length of the file and of the range as 64 bit, range or NFIL
+    char reply[20];
+    bool answered = req->write(message, offset, true) && req->readAll(reply, 4);
+    bool read = answered && strncmp(reply, "DATA", 4) == 0 && req->readAll(reply+4, 16);
+    uint64_t rangeLength = 0;
+    if (read) {
+        memcpy(&fileLength, reply+4, sizeof(fileLength));
+        memcpy(&rangeLength, reply+12, sizeof(rangeLength));
+        fileLength = ntohll(fileLength);
+        rangeLength = ntohll(rangeLength);
+        read = recvFileChunks(*req, out, rangeLength) && out.flush().good();
+    }
+    // a replica without the version asked for answered all the same
+    peers.finished(node, rangeLength, timeNow() - began, !answered || (!read && strncmp(reply, "DATA", 4) == 0));
+    return read;
+}
+
+
+void sdfs::sendData(request& req, const string& fileName, uint64_t start, uint64_t length, uint64_t version) {
+    bool stored;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(fileName) != files.end() && (version == 0 || versions[fileName] == version);
+    }
+    auto path = storePath(fileName);
+    ifstream file(path, ios::binary);
+    if (!stored || !file.good()) {
+        req.write("NFIL", 4, true);
+        return;
+    }
+    auto fileLength = fileSize(path);
+    start = min(start, fileLength);
+    length = min(length, fileLength - start);
+
+    char header[20];
+    memcpy(header, "DATA", 4);
+    uint64_t sentFileLength = htonll(fileLength);
+    memcpy(header+4, &sentFileLength, sizeof(sentFileLength));
+    uint64_t sentLength = htonll(length);
+    memcpy(header+12, &sentLength, sizeof(sentLength));
+
+    req.compress(compression);
+    if (!req.write(header, sizeof(header)) || !sendStored(req, path, start, length) || !req.finish()) {
+        log(ERROR) << "sdfs/ sending " << fileName << " to " << req.node << " failed";
+    }
+}
+
+
+void sdfs::showBlocks(string fileName) {
+    auto manifestFile = fileName + BLOCKSEP + "manifest";
+    blockManifest manifest;
+    uint64_t version;
+    char layout;
+    bool found = readVersion(fileName, version, &layout) && (layout == LAYOUTBLOCKS || layout == LAYOUTCODED);
+    if (found) {
+        ofstream out(manifestFile, ios::binary | ios::trunc);
+        found = fetchBlock(fileName, out, 0);
+    }
+    codedManifest coded;
+    if (found && layout == LAYOUTCODED && readCodedManifest(manifestFile, coded)) {
+        remove(manifestFile.c_str());
+        cout << fileName << ": " << coded.length << " bytes in " << coded.dataFragments << "+"
+             << coded.parityFragments << " fragments of " << coded.fragmentSize << " bytes, coded with "
+             << gfKernel() << "\n";
+        for (auto& fragment : coded.fragments) {
+            struct in_addr tmp;
+            auto known = fragment.second > 0 && fragment.second <= NODES;
+            tmp.s_addr = htonl(known ? fd->IPAddrs[fragment.second] : 0);
+            cout << left << setw(20) << fragment.first << setw(18) << inet_ntoa(tmp)
+                 << (liveNode(fragment.second) ? "alive" : "lost") << endl;
+        }
+        return;
+    }
+    if (!found || layout != LAYOUTBLOCKS || !readManifest(manifestFile, manifest)) {
+        cout << fileName << " is not stored in blocks" << endl;
+        remove(manifestFile.c_str());
+        return;
+    }
+    remove(manifestFile.c_str());
+
+    cout << fileName << ": " << manifest.length << " bytes in " << manifest.blocks.size() << " blocks\n";
+    for (auto& block : manifest.blocks) {
+        struct in_addr tmp;
+        tmp.s_addr = htonl(fd->IPAddrs[location(block.first)]);
+        cout << left << setw(20) << block.first << setw(10) << block.second << inet_ntoa(tmp) << endl;
+    }
+}
+
+
+bool sdfs::removeFile(string fileName) {
+    unique_lock<mutex> lk(filesMutex);
+    auto it = files.find(fileName);
+    if (it != files.end()) {
+        auto label = it->second;
+        auto layout = layoutOf(fileName);
+        files.erase(it);
+        versions.erase(fileName);
+        layouts.erase(fileName);
+        meta.erase(vector<string>{fileName});
+        lk.unlock();
+        meta.sync();
+
+        // the primary of a striped or coded file deletes its blocks or fragments as well
+        blockManifest manifest;
+        codedManifest coded;
+        if (label == 'A' && layout == LAYOUTBLOCKS && readManifest(storePath(fileName), manifest)) {
+            for (auto& block : manifest.blocks) {
+                deleteFile(block.first);
+            }
+        } else if (label == 'A' && layout == LAYOUTCODED && readCodedManifest(storePath(fileName), coded)) {
+            for (auto& fragment : coded.fragments) {
+                if (fragment.second == myNumber) {
+                    removeFile(fragment.first);
+                } else if (liveNode(fragment.second)) {
+                    sendDeleteMessage(fragment.second, fragment.first);
+                }
+            }
+        }
+
+        removeLocalFile(fileName);
+        invalidateLeases(fileName);
+
+        // fragments are stored once
+        auto next = nextReplica(fileName);
+        if ((label == 'A' || label == 'B') && next != 0) {
+            sendDeleteMessage(next, fileName);
+        }
+        return true;
+    }
+    return false;
+}
+
+
+bool sdfs::deleteFile(string fileName) {
+    auto node = location(fileName);
+    cache.erase(fileName);
+
+    if (node == myNumber) {
+        return removeFile(fileName);
+    }
+    return sendDeleteMessage(node, fileName, true);
+}
+
+
+bool sdfs::sendDeleteMessage(int node, string fileName, bool acked) {
+    auto req = conns.open(node);
+    if(!req) {
+        cout <<"sendDeleteMessage: Cannot connect to "<< node << endl;
+        return false;
+
+    } else {
+        int fileNameLen = fileName.size();
+        int sentFileNameLen = htonl(fileNameLen);
+
+        char message[MAXDATASIZE];
+        strcpy (message, "DELT");
+        int offset = 4;
+        memcpy (message+offset, &sentFileNameLen, sizeof(sentFileNameLen));
+        offset += sizeof(sentFileNameLen);
+        memcpy (message+offset, &fileName[0], fileNameLen);
+        offset += fileNameLen;
+        if (!req->write(message, offset, true)) {
+            return false;
+        }
+        // reply: DELD once the file is removed, NFIL if node did not have it
+        char reply[4];
+        return !acked || (req->readAll(reply, sizeof(reply)) && strncmp(reply, "DELD", 4) == 0);
+    }
+}
+
+
+void sdfs::newNode(int node, bool joining) {
+    bool known = ring[node];
+    if (!known && joining && node != myNumber) {
+        // the files of the new node stay where they are until each node says which of them it keeps
+        lock_guard<mutex> lk(handOverMutex);
+        auto& members = joiningNodes[node];
+        for (int member = 1; member <= NODES; member++) {
+            if (ring[member]) {
+                members.insert(member);
+            }
+        }
+    }
+    ring[node] = true;
+    placement.add(node);
+    if (known || node == myNumber) {
+        return;
+    }
+    // the new node may be back with copies that missed writes, tell it what it should have.
+    // It fetches them under the re-replication cap, the copies it replaces are dropped after.
+    thread announceThread([this, node, joining]{
+        {
+            lock_guard<mutex> lck (updateFileDistMutex);
+            updateFileIds();
+            if (joining) {
+                announceHandOvers(node);
+            }
+            requestUpdateMasteringFiles(node);
+        }
+        handOff();
+    });
+    announceThread.detach();  // let this run on its own
+}
+
+
+void sdfs::handOff() {
+    {
+        lock_guard<mutex> lk(handOffMutex);
+        if (handingOff) {
+            handOffAgain = true;
+            return;
+        }
+        handingOff = true;
+    }
+    runHandOff();
+}
+
+
+void sdfs::runHandOff() {
+    int tries = 0;
+    while (1) {
+        vector<pair<string, uint64_t>> surplus;
+        {
+            lock_guard<mutex> lk(filesMutex);
+            for (auto it = files.begin(); it != files.end(); ++it) {
+                auto replicas = replicaNodes(it->first);
+                if (it->second != 'F' && find(replicas.begin(), replicas.end(), myNumber) == replicas.end()) {
+                    surplus.emplace_back(it->first, versions[it->first]);
+                }
+            }
+        }
+
+        uint64_t dropped = 0, kept = 0;
+        for (auto& copy : surplus) {
+            // ownership moved once every replica has what this copy has
+            bool handed = true;
+            for (auto node : replicaNodes(copy.first)) {
+                char label;
+                uint64_t version;
+                if (!requestLabel(node, copy.first, label, version) || label == 0 || version < copy.second) {
+                    handed = false;
+                    break;
+                }
+            }
+            if (handed && dropCopy(copy.first, copy.second)) {
+                dropped++;
+            } else {
+                kept++;
+            }
+        }
+        if (dropped > 0) {
+            log(INFO) << "sdfs/ handed off " << dropped << " files, " << kept << " still on their way";
+        }
+
+        {
+            lock_guard<mutex> lk(handOffMutex);
+            handedOff += dropped;
+            handOffPending = kept;
+            if (handOffAgain) {
+                handOffAgain = false;
+                tries = 0;
+                continue;
+            }
+            if (kept == 0 || ++tries >= HANDOFFTRIES) {
+                handingOff = false;
+                return;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(HANDOFFPOLLMS));
+    }
+}
+
+
+bool sdfs::dropCopy(const string& fileName, uint64_t version) {
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.find(fileName);
+        if (it == files.end() || versions[fileName] != version) {
+            return false;
+        }
+        // a striped or coded file keeps its blocks, they have replicas of their own
+        files.erase(it);
+        versions.erase(fileName);
+        layouts.erase(fileName);
+        meta.erase(vector<string>{fileName});
+    }
+    meta.sync();
+    removeLocalFile(fileName);
+    return true;
+}
+
+
+void sdfs::announceHandOvers(int node) {
+    // the files this node was the primary of before node joined in front of it
+    vector<string> kept;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto& file : files) {
+            if (file.second == 'B' && placement.owner(file.first) == node) {
+                kept.push_back(file.first);
+            }
+        }
+    }
+    // node is told last, it fetches the files only after the UPDA that follows
+    for (int member = 1; member <= NODES; member++) {
+        if (member == myNumber) {
+            applyOwnership(true, myNumber, node, true, kept);
+        } else if (ring[member] && member != node && !sendOwnership(member, "HOVR", node, kept)) {
+            log(INFO) << "sdfs/ could not tell " << member << " which files stay here until " << node << " has them";
+        }
+    }
+    if (!sendOwnership(node, "HOVR", node, kept)) {
+        log(INFO) << "sdfs/ could not tell " << node << " which files stay here until it has them";
+    }
+    log(INFO) << "sdfs/ " << kept.size() << " files stay here until " << node << " has them";
+}
+
+
+void sdfs::takeOver(const vector<string>& fileNames) {
+    vector<string> arrived;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto& fileName : fileNames) {
+            if (files.find(fileName) != files.end() && missingFiles.find(fileName) == missingFiles.end()) {
+                arrived.push_back(fileName);
+            }
+        }
+    }
+    map<int, vector<string>> moved;
+    {
+        lock_guard<mutex> lk(handOverMutex);
+        for (auto& fileName : arrived) {
+            auto it = handOvers.find(fileName);
+            if (it != handOvers.end() && it->second != myNumber && placement.owner(fileName) == myNumber) {
+                moved[it->second].push_back(fileName);
+            }
+        }
+    }
+
+    for (auto& handed : moved) {
+        auto previous = handed.first;
+        auto& names = handed.second;
+        // the node the files were on stops handing out their versions before this node starts
+        uint64_t issued = 0;
+        if (liveNode(previous) && !sendOwnership(previous, "OWNS", myNumber, names, &issued)) {
+            log(ERROR) << "sdfs/ " << previous << " did not give up " << names.size() << " files, they stay there";
+            continue;
+        }
+        {
+            lock_guard<mutex> lk(filesMutex);
+            lastVersion = max(lastVersion, issued);
+        }
+        applyOwnership(false, myNumber, myNumber, true, names);
+        for (int member = 1; member <= NODES; member++) {
+            if (ring[member] && member != myNumber && member != previous &&
+                !sendOwnership(member, "OWNS", myNumber, names)) {
+                log(INFO) << "sdfs/ could not tell " << member << " that " << names.size() << " files moved here";
+            }
+        }
+        log(INFO) << "sdfs/ took over " << names.size() << " files from " << previous;
+    }
+}
+
+
+bool sdfs::sendOwnership(int target, const string& type, int node, const vector<string>& fileNames,
+                         uint64_t* version) {
+    // msg: HOVR or OWNS, node, whether it is the last message, fileCount, sizeof(filename1), filename1 ...
+    size_t first = 0;
+    do {
+        char message[MAXDATASIZE];
+        memcpy(message, type.c_str(), 4);
+        int offset = 4;
+
+        int sentNode = htonl(node);
+        memcpy(message+offset, &sentNode, sizeof(sentNode));
+        offset += sizeof(sentNode);
+        auto lastOffset = offset++;
+        auto countOffset = offset;
+        offset += sizeof(int);
+
+        int fileCount = 0;
+        while (first < fileNames.size() &&
+               offset + sizeof(int) + fileNames[first].size() < static_cast<size_t>(MAXDATASIZE)) {
+            int fileNameLen = htonl(fileNames[first].size());
+            memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+            offset += sizeof(fileNameLen);
+            memcpy(message+offset, &fileNames[first][0], fileNames[first].size());
+            offset += fileNames[first].size();
+            fileCount++;
+            first++;
+        }
+        if (fileCount == 0 && first < fileNames.size()) {   // a name that cannot fit in any message
+            first++;
+        }
+        message[lastOffset] = first == fileNames.size();
+        fileCount = htonl(fileCount);
+        memcpy(message+countOffset, &fileCount, sizeof(fileCount));
+
+        auto req = conns.open(target);
+        char reply[4 + sizeof(uint64_t)];
+        if (!req || !req->write(message, offset, true) || !req->readAll(reply, sizeof(reply)) ||
+            strncmp(reply, "ACKO", 4) != 0) {
+            return false;
+        }
+        uint64_t issued;
+        memcpy(&issued, reply+4, sizeof(issued));
+        if (version) {
+            *version = max(*version, ntohll(issued));
+        }
+    } while (first < fileNames.size());
+    return true;
+}
+
+
+void sdfs::recvOwnership(request& req, char* recvBuf, int sender) {
+    bool handOver = strncmp(recvBuf, "HOVR", 4) == 0;
+    int offset = 4;
+
+    int node;
+    memcpy(&node, recvBuf+offset, sizeof(node));
+    offset += sizeof(node);
+    node = ntohl(node);
+    bool last = recvBuf[offset++];
+
+    int fileCount;
+    memcpy(&fileCount, recvBuf+offset, sizeof(fileCount));
+    offset += sizeof(fileCount);
+    fileCount = ntohl(fileCount);
+
+    vector<string> fileNames;
+    for (int i=0; i < fileCount; i++) {
+        int fileNameLen;
+        memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
+        offset += sizeof(fileNameLen);
+        fileNameLen = ntohl(fileNameLen);
+        fileNames.emplace_back(recvBuf+offset, fileNameLen);
+        offset += fileNameLen;
+    }
+    applyOwnership(handOver, sender, node, last, fileNames);
+
+    // the new primary goes on from the versions the old one handed out
+    uint64_t issued;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        issued = htonll(lastVersion);
+    }
+    char reply[4 + sizeof(uint64_t)];
+    memcpy(reply, "ACKO", 4);
+    memcpy(reply+4, &issued, sizeof(issued));
+    req.write(reply, sizeof(reply), true);
+}
+
+
+void sdfs::applyOwnership(bool handOver, int sender, int node, bool last, const vector<string>& fileNames) {
+    lock_guard<mutex> lk(handOverMutex);
+    for (auto& fileName : fileNames) {
+        if (handOver) {
+            handOvers[fileName] = sender;
+        } else {
+            handOvers.erase(fileName);
+        }
+    }
+    if (handOver && last) {
+        handOversHeard[node].insert(sender);
+    }
+}
+
+
+bool sdfs::joiningNode(int node) {
+    auto it = joiningNodes.find(node);
+    if (it == joiningNodes.end()) {
+        return false;
+    }
+    auto& heard = handOversHeard[node];
+    for (auto member : it->second) {
+        if (member != node && liveNode(member) && heard.find(member) == heard.end()) {
+            return true;
+        }
+    }
+    // every node that was up when it joined has said which of its files it keeps
+    joiningNodes.erase(it);
+    handOversHeard.erase(node);
+    return false;
+}
+
+
+void sdfs::updateFileIds() {
+    {
+        lock_guard<mutex> lk(filesMutex);
+        vector<pair<string, char>> relabeled;
+        for (auto it = files.begin(); it != files.end(); ++it) {
+            // fragments stay where they are, the primary of their file rebuilds lost ones
+            if (it->second == 'F') {
+                continue;
+            }
+            auto replicas = replicaNodes(it->first);
+            auto pos = find(replicas.begin(), replicas.end(), myNumber);
+
+            // files this node no longer replicates keep their label
+            if (pos != replicas.end() && it->second != 'A' + (pos - replicas.begin())) {
+                it->second = 'A' + (pos - replicas.begin());
+                relabeled.emplace_back(it->first, it->second);
+            }
+        }
+        meta.relabel(relabeled);
+    }
+    // one sync for the whole membership change, after lookups can go on again
+    meta.sync();
+}
+
+
+int sdfs::createUpdaMsg(char* msg, vector<string>& filenames, char fileType) {
+
+    string msgType = "UPDA";
+    msgType += fileType;
+
+    memcpy(msg, &msgType[0], msgType.size());
+    int bufferlen = msgType.size();
+
+    int fileCt = htonl(filenames.size());
+    memcpy(msg+bufferlen, &fileCt, sizeof(fileCt));
+    bufferlen += sizeof(fileCt);
+
+    for (string filename : filenames) {
+        //filename size
+        int filenameSize = htonl(filename.size());
+        memcpy(msg+bufferlen, &filenameSize, sizeof(filenameSize));
+        bufferlen += sizeof(filenameSize);
+
+        //filename
+        memcpy(msg+bufferlen, &filename[0], filename.size());
+        bufferlen += filename.size();
+
+        //version
+        uint64_t version = htonll(fileVersion(filename));
+        memcpy(msg+bufferlen, &version, sizeof(version));
+        bufferlen += sizeof(version);
+    }
+    log(DEBUG) << "update buffer size " << bufferlen;
+    return bufferlen;
+}
+
+
+void sdfs::requestUpdateMasteringFiles(int onlyNode) {
+    // every file has its own B and C, group the files by the node and label they go to
+    map<pair<int, char>, vector<string>> updates;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto it = files.begin(); it != files.end(); ++it) {
+            auto replicas = replicaNodes(it->first);
+            // the old primary tells a node that joined in front of it what it now owns
+            if (onlyNode != 0 && it->second == 'B' && replicas[0] == onlyNode) {
+                updates[make_pair(onlyNode, 'A')].push_back(it->first);
+                continue;
+            }
+            if (it->second != 'A') {
+                continue;
+            }
+            for (size_t i=1; i < replicas.size(); i++) {
+                if (onlyNode == 0 || replicas[i] == onlyNode) {
+                    updates[make_pair(replicas[i], 'A' + i)].push_back(it->first);
+                }
+            }
+        }
+    }
+
+    // send request to potential b/c
+    // msg: UPDA, fileCT, sizeof(filename1), filename1 ...
+    for (auto& update : updates) {
+        auto targetNode = update.first.first;
+        auto& fileNames = update.second;
+
+        // one message is read as a single frame of at most MAXDATASIZE bytes
+        size_t first = 0;
+        while (first < fileNames.size()) {
+            vector<string> batch;
+            size_t batchSize = 4 + 1 + sizeof(int);
+            while (first < fileNames.size() &&
+                   batchSize + sizeof(int) + fileNames[first].size() + sizeof(uint64_t) < MAXDATASIZE) {
+                batchSize += sizeof(int) + fileNames[first].size() + sizeof(uint64_t);
+                batch.push_back(fileNames[first++]);
+            }
+            if (batch.empty()) {    // a name that cannot fit in any message
+                first++;
+                continue;
+            }
+            char msg[MAXDATASIZE2];
+            auto offset = createUpdaMsg(msg, batch, update.first.second);
+            if (!conns.send(targetNode, msg, offset)) {
+                cout <<"requestUpdateMasteringFiles: Cannot connect to "<< targetNode << endl;
+            }
+        }
+    }
+}
+
+
+void sdfs::queueRepair(int source, const vector<string>& fileNames) {
+    if (fileNames.empty()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lk(repairMutex);
+        if (repairDone + repairFailed == repairQueued) {
+            repairQueued = repairDone = repairFailed = repairBytes = 0;
+            repairStart = chrono::steady_clock::now();
+        }
+        repairQueued += fileNames.size();
+    }
+    log(INFO) << "sdfs/ re-replicating " << fileNames.size() << " files from " << source;
+
+    // the names of a batch are sent in one message of at most MAXDATASIZE bytes
+    size_t first = 0;
+    while (first < fileNames.size()) {
+        vector<string> batch;
+        size_t batchSize = 4 + sizeof(int);
+        while (first < fileNames.size() && batch.size() < REPAIRBATCH &&
+               batchSize + sizeof(int) + fileNames[first].size() < MAXDATASIZE) {
+            batchSize += sizeof(int) + fileNames[first].size();
+            batch.push_back(fileNames[first++]);
+        }
+        if (batch.empty()) {    // a name that cannot fit in any message
+            log(ERROR) << "sdfs/ could not re-replicate " << fileNames[first];
+            {
+                lock_guard<mutex> lk(filesMutex);
+                missingFiles.erase(fileNames[first]);
+                filesArrived.notify_all();
+            }
+            repairFinished(0, 1, 0);
+            first++;
+            continue;
+        }
+        repairWorkers.submit([this, source, batch]{ repairBatch(source, batch); });
+    }
+}
+
+
+void sdfs::repairBatch(int source, vector<string> fileNames) {
+    // a copy left on disk from before is brought up to date instead of fetched again
+    vector<string> whole;
+    for (auto& fileName : fileNames) {
+        uint64_t transferred, version;
+        char layout;
+        string synced;
+        if (fileExists(storePath(fileName)) && deltaSync(source, fileName, transferred, version, layout, synced)) {
+            replicaArrived(fileName, version, layout, synced);
+            repairFinished(1, 0, transferred);
+        } else {
+            whole.push_back(fileName);
+        }
+    }
+
+    vector<string> missed;
+    fetchBatch(source, whole, missed);
+
+    // whatever source could not send may still be on the other replicas
+    map<int, vector<string>> retries;
+    vector<string> failed;
+    for (auto& fileName : missed) {
+        auto replicas = replicaNodes(fileName);
+        auto other = find_if(replicas.begin(), replicas.end(),
+                             [this, source](int node){ return node != source && node != myNumber; });
+        if (other == replicas.end()) {
+            failed.push_back(fileName);
+        } else {
+            retries[*other].push_back(fileName);
+        }
+    }
+    for (auto& retry : retries) {
+        fetchBatch(retry.first, retry.second, failed);
+    }
+
+    if (!failed.empty()) {
+        lock_guard<mutex> lk(filesMutex);
+        for (auto& fileName : failed) {
+            log(ERROR) << "sdfs/ could not re-replicate " << fileName;
+            missingFiles.erase(fileName);
+        }
+        filesArrived.notify_all();
+    }
+    repairFinished(0, failed.size(), 0);
+    takeOver(fileNames);
+}
+
+
+void sdfs::fetchBatch(int node, const vector<string>& fileNames, vector<string>& missed) {
+    if (fileNames.empty()) {
+        return;
+    }
+    auto req = conns.open(node);
+    if (!req) {
+        missed.insert(missed.end(), fileNames.begin(), fileNames.end());
+        return;
+    }
+
+    // msg: BGET, fileCount, sizeof(filename1), filename1 ...
+    char message[MAXDATASIZE];
+    strcpy(message, "BGET");
+    int offset = 4;
+
+    int fileCount = htonl(fileNames.size());
+    memcpy(message+offset, &fileCount, sizeof(fileCount));
+    offset += sizeof(fileCount);
+
+    for (auto& fileName : fileNames) {
+        int fileNameLen = htonl(fileName.size());
+        memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+        offset += sizeof(fileNameLen);
+        memcpy(message+offset, &fileName[0], fileName.size());
+        offset += fileName.size();
+    }
+
+    size_t received = 0;
+    if (req->write(message, offset, true)) {
+        for (; received < fileNames.size(); received++) {
+            // every file: sizeof(filename), filename, sizeof(content) and version as 64 bit, layout, content
+            int fileNameLen;
+            if (!req->readAll(reinterpret_cast<char*>(&fileNameLen), sizeof(fileNameLen))) {
+                break;
+            }
+            string fileName(ntohl(fileNameLen), '\0');
+            uint64_t length, version;
+            char layout;
+            if (!req->readAll(&fileName[0], fileName.size()) ||
+                !req->readAll(reinterpret_cast<char*>(&length), sizeof(length)) ||
+                !req->readAll(reinterpret_cast<char*>(&version), sizeof(version)) ||
+                !req->readAll(&layout, sizeof(layout))) {
+                break;
+            }
+            length = ntohll(length);
+            version = ntohll(version);
+            if (fileName.compare(fileNames[received]) != 0) {
+                log(ERROR) << "sdfs/ " << node << " sent " << fileName << " instead of " << fileNames[received];
+                break;
+            }
+            if (length == WHOLEFILE) {
+                missed.push_back(fileName);
+                continue;
+            }
+
+            // the copy is received next to the stored one, a write may land there meanwhile
+            auto fetchName = storePath(fileName) + BLOCKSEP + "fetch";
+            auto wFile = createFile(fetchName, length);
+            if (!recvFileChunks(*req, *wFile, length)) {
+                wFile.reset();
+                remove(fetchName.c_str());
+                break;
+            }
+            wFile.reset();
+            replicaArrived(fileName, version, layout, fetchName);
+            log(DEBUG) << "sdfs/ re-replicated " << fileName << " from " << node;
+            repairFinished(1, 0, length);
+        }
+    }
+    // the stream broke, nothing after the file being read has arrived
+    missed.insert(missed.end(), fileNames.begin() + received, fileNames.end());
+}
+
+
+void sdfs::sendBatch(request& req, char* recvBuf, int offset) {
+    int fileCount;
+    memcpy(&fileCount, recvBuf+offset, sizeof(fileCount));
+    offset += sizeof(fileCount);
+    fileCount = ntohl(fileCount);
+
+    for (int i=0; i < fileCount; i++) {
+        int fileNameLen;
+        memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
+        offset += sizeof(fileNameLen);
+        string fileName(recvBuf+offset, ntohl(fileNameLen));
+        offset += fileName.size();
+
+        bool stored;
+        uint64_t version;
+        char layout;
+        {
+            lock_guard<mutex> lk(filesMutex);
+            stored = files.find(fileName) != files.end();
+            version = htonll(stored ? versions[fileName] : 0);
+            layout = layoutOf(fileName);
+        }
+        auto path = storePath(fileName);
+        ifstream file(path, ios::binary);
+        uint64_t length = WHOLEFILE;
+        if (stored && file.good()) {
+            file.seekg(0, file.end);
+            length = file.tellg();
+        }
+
+        uint64_t sentLength = htonll(length);
+        char header[MAXDATASIZE];
+        int headerLen = 0;
+        memcpy(header, &fileNameLen, sizeof(fileNameLen));
+        headerLen += sizeof(fileNameLen);
+        memcpy(header+headerLen, &fileName[0], fileName.size());
+        headerLen += fileName.size();
+        memcpy(header+headerLen, &sentLength, sizeof(sentLength));
+        headerLen += sizeof(sentLength);
+        memcpy(header+headerLen, &version, sizeof(version));
+        headerLen += sizeof(version);
+        header[headerLen] = layout;
+        headerLen++;
+
+        if (!req.write(header, headerLen)) {
+            return;
+        }
+        if (length != WHOLEFILE && !sendFileRange(req, path, 0, length, &repairThrottle)) {
+            log(ERROR) << "sdfs/ re-replication of " << fileName << " to " << req.node << " broke";
+            return;
+        }
+    }
+    req.finish();
+}
+
+
+void sdfs::replicaArrived(const string& fileName, uint64_t version, char layout, const string& path) {
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = missingFiles.find(fileName);
+        if (it == missingFiles.end() || newerStored(fileName, version)) {
+            // a write that reached this node while the copy was on its way is newer than the copy
+            if (it != missingFiles.end()) {
+                log(INFO) << "sdfs/ dropped the fetched version " << version << " of " << fileName
+                          << ", a newer one was written meanwhile";
+                missingFiles.erase(it);
+                filesArrived.notify_all();
+            }
+            if (!path.empty()) {
+                remove(path.c_str());
+            }
+            return;
+        }
+        if (!path.empty() && rename(path.c_str(), storePath(fileName).c_str()) < 0) {
+            log(ERROR) << "sdfs/ could not move the fetched copy of " << fileName << " in place";
+            remove(path.c_str());
+            return;
+        }
+    }
+    blockChecksums checksums;
+    storeChecksums(fileName, checksums);
+
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = missingFiles.find(fileName);
+        if (it != missingFiles.end() && newerStored(fileName, version)) {
+            missingFiles.erase(it);
+            filesArrived.notify_all();
+        } else if (it != missingFiles.end()) {
+            files.insert(*it);
+            versions[fileName] = version;
+            setLayout(fileName, layout);
+            meta.put(fileName, fileRecord{it->second, checksums.length, fileChecksum(checksums), version, layout});
+            missingFiles.erase(it);
+            filesArrived.notify_all();
+        }
+    }
+    meta.sync();
+    if (durable) {
+        commits.sync(storePath(fileName));
+    }
+}
+
+
+bool sdfs::newerStored(const string& fileName, uint64_t version) {
+    auto it = versions.find(fileName);
+    return files.find(fileName) != files.end() && it != versions.end() && it->second > version;
+}
+
+
+void sdfs::addFile(const string& fileName, char label, uint64_t version, char layout, blockChecksums* checksums) {
+    blockChecksums computed;
+    if (!checksums) {
+        storeChecksums(fileName, computed);
+        checksums = &computed;
+    }
+
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.insert(pair<string, char>(fileName, label)).first;
+        versions[fileName] = version;
+        setLayout(fileName, layout);
+        meta.put(fileName, fileRecord{it->second, checksums->length, fileChecksum(*checksums), version, layout});
+    }
+    meta.sync();
+    // the writer hears back only after this returns, so it is answered once the group is on disk
+    if (durable && !commits.sync(storePath(fileName))) {
+        log(ERROR) << "sdfs/ could not sync " << fileName << " to disk";
+    }
+    invalidateLeases(fileName);
+}
+
+
+uint64_t sdfs::fileChecksum(const blockChecksums& checksums) {
+    return checksum(reinterpret_cast<const char*>(checksums.sums.data()), checksums.sums.size() * sizeof(uint64_t));
+}
+
+
+void sdfs::loadFiles() {
+    auto start = chrono::steady_clock::now();
+    auto records = meta.load();
+
+    // a file that changed size behind our back is left to re-replication
+    vector<string> dropped;
+    lock_guard<mutex> lk(filesMutex);
+    for (auto& record : records) {
+        // files kept in the working directory before there was a storage root move into it
+        auto path = storePath(record.first);
+        if (!fileExists(path) && fileExists(record.first) && rename(record.first.c_str(), path.c_str()) == 0) {
+            rename((record.first + SUMSUFFIX).c_str(), (path + SUMSUFFIX).c_str());
+        }
+        if (fileExists(path) && fileSize(path) == record.second.size) {
+            files[record.first] = record.second.label;
+            versions[record.first] = record.second.version;
+            setLayout(record.first, record.second.layout);
+            lastVersion = max(lastVersion, record.second.version);
+        } else {
+            dropped.push_back(record.first);
+        }
+    }
+    meta.erase(dropped);
+    meta.sync();
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    log(INFO) << "sdfs/ loaded " << files.size() << " files from the metadata store in " << elapsed.count()
+              << " ms, dropped " << dropped.size();
+}
+
+
+void sdfs::joined() {
+    {
+        // the files of this node stay where they are until each node says which of them it keeps
+        lock_guard<mutex> lk(handOverMutex);
+        auto& members = joiningNodes[myNumber];
+        for (int node = 1; node <= NODES; node++) {
+            if (ring[node] && node != myNumber) {
+                members.insert(node);
+            }
+        }
+    }
+    {
+        lock_guard<mutex> lk(filesMutex);
+        if (files.empty()) {
+            return;
+        }
+    }
+    // the files kept from before the restart may have new replicas, tell them what we have
+    thread announceThread([this]{ updateFileDistribution(); });
+    announceThread.detach();  // let this run on its own
+}
+
+
+bool sdfs::deltaSync(int node, const string& fileName, uint64_t& transferred, uint64_t& version, char& layout,
+                     string& synced) {
+    transferred = 0;
+    blockChecksums local;
+    if (!loadChecksums(fileName, local)) {
+        return false;
+    }
+    auto req = conns.open(node);
+    if (!req) {
+        return false;
+    }
+
+    // msg: DSYN, sizeof(filename), filename, length, block size and number of checksums as
+    // 64 bit, followed by the checksums
+    char message[MAXDATASIZE];
+    strcpy(message, "DSYN");
+    int offset = 4;
+
+    int fileNameLen = htonl(fileName.size());
+    memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    memcpy(message+offset, &fileName[0], fileName.size());
+    offset += fileName.size();
+
+    uint64_t fields[3] = {htonll(local.length), htonll(local.blockSize), htonll(local.sums.size())};
+    memcpy(message+offset, fields, sizeof(fields));
+    offset += sizeof(fields);
+
+    vector<uint64_t> sentSums;
+    for (auto sum : local.sums) {
+        sentSums.push_back(htonll(sum));
+    }
+    if (!req->write(message, offset) ||
+        !req->write(reinterpret_cast<char*>(sentSums.data()), sentSums.size() * sizeof(uint64_t), true)) {
+        return false;
+    }
+
+    char reply[4];
+    uint64_t length;
+    if (!req->readAll(reply, sizeof(reply)) || strncmp(reply, "DLTA", 4) != 0 ||
+        !req->readAll(reinterpret_cast<char*>(&length), sizeof(length)) ||
+        !req->readAll(reinterpret_cast<char*>(&version), sizeof(version)) || !req->readAll(&layout, sizeof(layout))) {
+        return false;
+    }
+    length = ntohll(length);
+    version = ntohll(version);
+
+    // build the new copy next to the stale one, blocks that did not change come from disk
+    auto path = storePath(fileName);
+    synced = path + BLOCKSEP + "sync";
+    ifstream stale(path, ios::binary);
+    ofstream wFile(synced, ios::binary | ios::trunc);
+    char chunk[CHUNKSIZE];
+    uint64_t written = 0;
+    bool complete = true;
+    while (complete && written < length) {
+        char type;
+        uint32_t count;
+        if (!req->readAll(&type, sizeof(type)) || !req->readAll(reinterpret_cast<char*>(&count), sizeof(count))) {
+            complete = false;
+            break;
+        }
+        auto runLength = min(static_cast<uint64_t>(ntohl(count)) * local.blockSize, length - written);
+
+        if (type == 0) {
+            stale.seekg(written);
+            for (auto left = runLength; left > 0; ) {
+                stale.read(chunk, min(left, static_cast<uint64_t>(CHUNKSIZE)));
+                auto numRead = stale.gcount();
+                if (numRead <= 0) {
+                    complete = false;
+                    break;
+                }
+                wFile.write(chunk, numRead);
+                left -= numRead;
+            }
+        } else {
+            complete = recvFileChunks(*req, wFile, runLength);
+            transferred += runLength;
+        }
+        written += runLength;
+    }
+    wFile.close();
+
+    if (!complete) {
+        remove(synced.c_str());
+        log(ERROR) << "sdfs/ could not sync " << fileName << " with " << node;
+        return false;
+    }
+    log(INFO) << "sdfs/ synced " << fileName << " with " << node << ", " << transferred << " of "
+              << length << " bytes sent";
+    return true;
+}
+
+
+void sdfs::sendDelta(request& req, char* recvBuf, int offset) {
+    int fileNameLen;
+    memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    string fileName(recvBuf+offset, ntohl(fileNameLen));
+    offset += fileName.size();
+
+    uint64_t fields[3];
+    memcpy(fields, recvBuf+offset, sizeof(fields));
+    auto staleLength = ntohll(fields[0]);
+    auto blockSize = ntohll(fields[1]);
+    vector<uint64_t> staleSums(ntohll(fields[2]));
+
+    bool stored;
+    uint64_t version;
+    char layout;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        stored = files.find(fileName) != files.end();
+        version = htonll(stored ? versions[fileName] : 0);
+        layout = layoutOf(fileName);
+    }
+    blockChecksums own;
+    if (blockSize == 0 ||
+        !req.readAll(reinterpret_cast<char*>(staleSums.data()), staleSums.size() * sizeof(uint64_t)) ||
+        !stored || !loadChecksums(fileName, own)) {
+        req.write("NFIL", 4, true);
+        return;
+    }
+
+    // a block is kept if it has the same length and checksum on both sides
+    auto blockLength = [](uint64_t length, uint64_t blockSize, uint64_t i) {
+        return i * blockSize < length ? min(blockSize, length - i * blockSize) : 0;
+    };
+    auto blocks = (own.length + blockSize - 1) / blockSize;
+    vector<bool> keep(blocks, false);
+    if (blockSize == own.blockSize) {
+        for (uint64_t i=0; i < blocks && i < staleSums.size(); i++) {
+            keep[i] = ntohll(staleSums[i]) == own.sums[i] &&
+                      blockLength(staleLength, blockSize, i) == blockLength(own.length, blockSize, i);
+        }
+    }
+
+    auto path = storePath(fileName);
+    uint64_t length = htonll(own.length);
+    if (!req.write("DLTA", 4) || !req.write(reinterpret_cast<char*>(&length), sizeof(length)) ||
+        !req.write(reinterpret_cast<char*>(&version), sizeof(version)) || !req.write(&layout, sizeof(layout))) {
+        return;
+    }
+
+    // send runs of blocks of the same kind, only changed blocks carry data
+    uint64_t i = 0;
+    while (i < blocks) {
+        auto first = i;
+        while (i < blocks && keep[i] == keep[first]) {
+            i++;
+        }
+        char run[1 + sizeof(uint32_t)];
+        run[0] = keep[first] ? 0 : 1;
+        uint32_t count = htonl(i - first);
+        memcpy(run+1, &count, sizeof(count));
+        if (!req.write(run, sizeof(run))) {
+            return;
+        }
+        if (!keep[first]) {
+            auto start = first * blockSize;
+            if (!sendFileRange(req, path, start, min(own.length, i * blockSize) - start, &repairThrottle)) {
+                log(ERROR) << "sdfs/ sync of " << fileName << " to " << req.node << " broke";
+                return;
+            }
+        }
+    }
+    req.finish();
+}
+
+
+bool sdfs::loadChecksums(const string& fileName, blockChecksums& checksums) {
+    auto path = storePath(fileName);
+    if (!fileExists(path)) {
+        return false;
+    }
+    ifstream sums(path + SUMSUFFIX);
+    string magic;
+    if (getline(sums, magic) && magic.compare(SUMSMAGIC) == 0 &&
+        sums >> checksums.length >> checksums.modified >> checksums.blockSize &&
+        checksums.length == fileSize(path) && checksums.modified == modifiedTime(path) &&
+        checksums.blockSize == DELTABLOCK) {
+
+        checksums.sums.clear();
+        uint64_t sum;
+        while (sums >> hex >> sum) {
+            checksums.sums.push_back(sum);
+        }
+        if (checksums.sums.size() == (checksums.length + DELTABLOCK - 1) / DELTABLOCK) {
+            return true;
+        }
+    }
+    // the file changed since its checksums were written
+    return storeChecksums(fileName, checksums);
+}
+
+
+bool sdfs::computeChecksums(const string& fileName, blockChecksums& checksums) {
+    ifstream file(fileName, ios::binary);
+    if (!file.good()) {
+        return false;
+    }
+    checksums.length = fileSize(fileName);
+    checksums.modified = modifiedTime(fileName);
+    checksums.blockSize = DELTABLOCK;
+    checksums.sums.clear();
+
+    vector<char> block(DELTABLOCK);
+    while (file.read(&block[0], DELTABLOCK) || file.gcount() > 0) {
+        checksums.sums.push_back(checksum(&block[0], file.gcount()));
+    }
+    return true;
+}
+
+
+bool sdfs::storeChecksums(const string& fileName, blockChecksums& checksums) {
+    if (!computeChecksums(storePath(fileName), checksums)) {
+        return false;
+    }
+    writeChecksums(fileName, checksums);
+    return true;
+}
+
+
+void sdfs::extendChecksums(const string& fileName, blockChecksums& checksums) {
+    // the last block of before may have been short, it is summed again with the new bytes
+    auto kept = checksums.length / DELTABLOCK;
+    auto path = storePath(fileName);
+    checksums.sums.resize(kept);
+    checksums.length = fileSize(path);
+    checksums.modified = modifiedTime(path);
+    checksums.blockSize = DELTABLOCK;
+
+    ifstream file(path, ios::binary);
+    file.seekg(kept * DELTABLOCK);
+    vector<char> block(DELTABLOCK);
+    while (file.read(&block[0], DELTABLOCK) || file.gcount() > 0) {
+        checksums.sums.push_back(checksum(&block[0], file.gcount()));
+    }
+    writeChecksums(fileName, checksums);
+}
+
+
+void sdfs::writeChecksums(const string& fileName, const blockChecksums& checksums) {
+    ofstream sums(storePath(fileName) + SUMSUFFIX, ios::trunc);
+    sums << SUMSMAGIC << "\n" << checksums.length << " " << checksums.modified << " "
+         << checksums.blockSize << "\n" << hex;
+    for (auto sum : checksums.sums) {
+        sums << sum << "\n";
+    }
+}
+
+
+void sdfs::removeLocalFile(const string& fileName) {
+    auto path = storePath(fileName);
+    remove(path.c_str());
+    remove((path + SUMSUFFIX).c_str());
+    hot.erase(path);
+}
+
+
+string sdfs::storePath(const string& fileName) {
+    // two levels of hashed directories keep every directory small however many files there are
+    auto hash = checksum(fileName.data(), fileName.size());
+    unsigned first = hash % STOREFANOUT, second = (hash / STOREFANOUT) % STOREFANOUT;
+    char dir[16];
+    snprintf(dir, sizeof(dir), "/%02x/%02x/", first, second);
+    string path = STOREROOT + dir;
+    {
+        lock_guard<mutex> lk(storeDirsMutex);
+        auto shard = first * STOREFANOUT + second;
+        if (!storeDirs[shard]) {
+            mkdir(path.substr(0, STOREROOT.size() + 3).c_str(), 0755);
+            mkdir(path.c_str(), 0755);
+            storeDirs[shard] = true;
+        }
+    }
+
+    // sdfs names may hold a slash, and . or .. must not name a directory
+    for (size_t i=0; i < fileName.size(); i++) {
+        auto c = fileName[i];
+        if (c == '/' || c == '%' || (c == '.' && i == 0)) {
+            char escaped[4];
+            snprintf(escaped, sizeof(escaped), "%%%02X", c);
+            path += escaped;
+        } else {
+            path += c;
+        }
+    }
+    return path;
+}
+
+
+unique_ptr<ostream> sdfs::createFile(const string& path, uint64_t length) {
+    // file times are too coarse to tell a rewrite of the same size from the copy in memory
+    hot.erase(path);
+    unique_ptr<ostream> file;
+    if (directWrites && length >= DIRECTMIN) {
+        auto direct = new directFile();
+        direct->open(path);
+        file.reset(direct);
+    } else if (zeroCopy) {
+        auto frames = new uringFile();
+        frames->open(path);
+        file.reset(frames);
+    } else {
+        file.reset(new ofstream(path, ios::binary | ios::trunc));
+    }
+    preallocate(path, length);
+    return file;
+}
+
+
+void sdfs::setZeroCopy(bool on) {
+    zeroCopy = on;
+    if (on) {
+        cout << "files are sent with sendfile and received frames are written with "
+             << (uringBuf::supported() ? "io_uring" : "pwrite") << ", without compression" << endl;
+    } else {
+        cout << "files are sent and received in chunks of " << CHUNKSIZE / 1024 << " KB" << endl;
+    }
+}
+
+
+void sdfs::setDirectWrites(bool on) {
+    directWrites = on;
+    cout << "files of " << DIRECTMIN / (1024 * 1024) << " MB or more are written " << (on ? "past" : "through")
+         << " the page cache" << endl;
+}
+
+
+void sdfs::repairFinished(uint64_t files, uint64_t failed, uint64_t bytes) {
+    lock_guard<mutex> lk(repairMutex);
+    repairDone += files;
+    repairFailed += failed;
+    repairBytes += bytes;
+    if (repairDone + repairFailed == repairQueued && (files > 0 || failed > 0)) {
+        repairEnd = chrono::steady_clock::now();
+        chrono::duration<double> elapsed = repairEnd - repairStart;
+        log(INFO) << "sdfs/ re-replication done: " << repairDone << " files, " << repairFailed
+                  << " failed, " << repairBytes << " bytes in " << elapsed.count() << " s";
+    }
+}
+
+
+void sdfs::showRepair() {
+    lock_guard<mutex> lk(repairMutex);
+    bool idle = repairDone + repairFailed == repairQueued;
+    chrono::duration<double> elapsed = (idle ? repairEnd : chrono::steady_clock::now()) - repairStart;
+    double megabytes = repairBytes / (1024.0 * 1024.0);
+    auto rate = repairThrottle.getRate();
+
+    cout << "=> re-replication: " << (idle ? "idle" : "running") << "\n"
+         << "files     " << repairDone << "/" << repairQueued << " (" << repairFailed << " failed)\n"
+         << "data      " << fixed << setprecision(1) << megabytes << " MB in " << elapsed.count() << " s";
+    if (elapsed.count() > 0) {
+        cout << " (" << megabytes / elapsed.count() << " MB/s)";
+    }
+    cout << "\n"
+         << "streams   " << repairWorkers.size() << ", " << repairWorkers.pending() << " batches waiting\n"
+         << "send cap  ";
+    if (rate == 0) {
+        cout << "none" << endl;
+    } else {
+        cout << rate / (1024.0 * 1024.0) << " MB/s" << endl;
+    }
+    cout.unsetf(ios::fixed);
+
+    lock_guard<mutex> handOffLock(handOffMutex);
+    cout << "hand-off  " << handedOff << " copies dropped after joins, " << handOffPending
+         << " waiting for their new replicas" << (handingOff ? "" : " (idle)") << endl;
+}
+
+
+void sdfs::setRepairRate(uint64_t rate) {
+    repairThrottle.setRate(rate);
+}
+
+
+void sdfs::showCache() {
+    cache.show();
+    hot.show();
+}
+
+
+void sdfs::showCompression() {
+    uint64_t raw = conns.rawBytes, wire = conns.wireBytes;
+    cout << "compressing file transfers " << (compression ? "on" : "off") << ", " << raw / 1024 << " KB sent as "
+         << wire / 1024 << " KB" << endl;
+}
+
+
+void sdfs::setDurable(bool on) {
+    // with durable stores the records of the metadata log are synced with the files they describe
+    meta.deferSync(on);
+    durable = on;
+}
+
+
+void sdfs::showDurability() {
+    cout << "durable stores " << (durable ? "on" : "off") << ", ";
+    commits.show();
+}
+
+
+void sdfs::updateFileDistribution() {
+    lock_guard<mutex> lck (updateFileDistMutex);
+    updateFileIds();
+    requestUpdateMasteringFiles();
+    rebuildFragments();
+}
+
+
+void sdfs::peerPinged(int node, uint64_t micros) {
+    peers.pinged(node, micros);
+}
+
+
+void sdfs::showPeers() {
+    peers.show();
+}
+
+
+void sdfs::nodeFailure(int node) {
+    if (!ring[node]) {
+        return;
+    }
+    ring[node] = false;
+    placement.remove(node);
+    {
+        // files a failed node kept for a new one are served by the new one, or their next replica
+        lock_guard<mutex> lk(handOverMutex);
+        joiningNodes.erase(node);
+        handOversHeard.erase(node);
+        for (auto it = handOvers.begin(); it != handOvers.end(); ) {
+            it = it->second == node ? handOvers.erase(it) : next(it);
+        }
+    }
+
+    // with virtual nodes any failure can move files this node stores
+    log(INFO) << "node " << node << " fails, updated file ids." << endl;
+    updateFileDistribution();
+}
+
+
+void sdfs::showStore() {
+    cout<<"=> showStore: \n";
+    const char separator    = ' ';
+    const int nameWidth     = 20;
+    const int charWidth      = 1;
+    lock_guard<mutex> lk(filesMutex);
+    for (auto it=files.begin(); it!=files.end(); ++it) {
+        cout << left << setw(nameWidth) << setfill(separator) << it->first;
+        cout << left << setw(charWidth) << setfill(separator) << it->second << endl;
+    }
+}
+
+
+void sdfs::showReply(const string& operation, const sdfsReply& reply) {
+    ostringstream out;
+    for (size_t i=0; i < reply.replicas.size(); i++) {
+        struct in_addr tmp;
+        tmp.s_addr = htonl(fd->IPAddrs[reply.replicas[i].first]);
+        auto IP = inet_ntoa(tmp);
+        out << IP << "      " << reply.replicas[i].second;
+        if (i < reply.versions.size()) {
+            out << "      version " << reply.versions[i];
+        }
+        out << "\n";
+    }
+    out << "[" << reply.id << "] " << operation << (reply.ok ? " done" : " failed") << "\n";
+    cout << out.str() << flush;
+}
+
+
+vector<pair<int, char>> sdfs::locateFile(const string& fileName, vector<uint64_t>* replicaVersions) {
+    char message[MAXDATASIZE];
+    strcpy(message, "LABL");
+    int offset = 4;
+
+    int fileNameLen = htonl(fileName.size());
+    memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+
+    memcpy(message+offset, &fileName[0], fileName.size());
+    offset += fileName.size();
+
+    // every replica is asked at once, the labels are read in ring order
+    vector<pair<int, shared_ptr<request>>> reqs;
+    for (auto node : replicaNodes(fileName)) {
+        if (node == myNumber) {
+            reqs.emplace_back(node, nullptr);
+            continue;
+        }
+        auto req = conns.open(node);
+        if (!req || !req->write(message, offset, true)) {
+            cout << "locateFile: Cannot connect to " << node << endl;
+            continue;
+        }
+        reqs.emplace_back(node, req);
+    }
+
+    vector<pair<int, char>> replicas;
+    for (auto& sent : reqs) {
+        // reply: LABL, the label, 0 if the node does not store the file, and the version as 64 bit
+        char reply[13] = {};
+        uint64_t version = 0;
+        if (!sent.second) {
+            lock_guard<mutex> lk(filesMutex);
+            auto it = files.find(fileName);
+            if (it != files.end()) {
+                reply[4] = it->second;
+                version = versions[fileName];
+            }
+        } else if (!sent.second->readAll(reply, sizeof(reply)) || strncmp(reply, "LABL", 4) != 0) {
+            continue;
+        } else {
+            memcpy(&version, reply+5, sizeof(version));
+            version = ntohll(version);
+        }
+        if (reply[4]) {
+            replicas.emplace_back(sent.first, reply[4]);
+            if (replicaVersions) {
+                replicaVersions->push_back(version);
+            }
+        }
+    }
+    return replicas;
+}
+
+
+bool sdfs::requestLabel(int node, const string& fileName, char& label, uint64_t& version, char* layout) {
+    label = 0;
+    version = 0;
+    if (node == myNumber) {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.find(fileName);
+        if (it != files.end()) {
+            label = it->second;
+            version = versions[fileName];
+        }
+        if (layout) {
+            *layout = layoutOf(fileName);
+        }
+        return true;
+    }
+    auto req = conns.open(node);
+    if (!req) {
+        return false;
+    }
+    char message[MAXDATASIZE];
+    strcpy(message, "LABL");
+    int offset = 4;
+
+    int fileNameLen = htonl(fileName.size());
+    memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    memcpy(message+offset, &fileName[0], fileName.size());
+    offset += fileName.size();
+
+    char reply[14];
+    if (!req->write(message, offset, true) || !req->readAll(reply, sizeof(reply)) ||
+        strncmp(reply, "LABL", 4) != 0) {
+        return false;
+    }
+    label = reply[4];
+    memcpy(&version, reply+5, sizeof(version));
+    version = ntohll(version);
+    if (layout) {
+        *layout = reply[13];
+    }
+    return true;
+}
+
+
+uint64_t sdfs::newVersion(const string& fileName, uint64_t seen) {
+    lock_guard<mutex> lk(filesMutex);
+    auto it = versions.find(fileName);
+    lastVersion = max({lastVersion, seen, it != versions.end() ? it->second : 0}) + 1;
+    return lastVersion;
+}
+
+
+uint64_t sdfs::issueVersion(const string& fileName, uint64_t seen) {
+    // a primary that just joined or took over has not seen the writes of the one before it,
+    // the replicas have
+    uint64_t held = 0;
+    readVersion(fileName, held);
+    return newVersion(fileName, max(seen, held));
+}
+
+
+uint64_t sdfs::requestNewVersion(const string& fileName, uint64_t seen) {
+    auto primary = location(fileName);
+    if (primary == myNumber) {
+        return issueVersion(fileName, seen);
+    }
+    auto req = conns.open(primary);
+    if (!req) {
+        return 0;
+    }
+    char message[MAXDATASIZE];
+    strcpy(message, "NVER");
+    int offset = 4;
+
+    uint64_t seenVersion = htonll(seen);
+    memcpy(message+offset, &seenVersion, sizeof(seenVersion));
+    offset += sizeof(seenVersion);
+
+    int fileNameLen = htonl(fileName.size());
+    memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    memcpy(message+offset, &fileName[0], fileName.size());
+    offset += fileName.size();
+
+    char reply[4 + sizeof(uint64_t)];
+    if (!req->write(message, offset, true) || !req->readAll(reply, sizeof(reply)) ||
+        strncmp(reply, "NVER", 4) != 0) {
+        return 0;
+    }
+    uint64_t version;
+    memcpy(&version, reply+4, sizeof(version));
+    return ntohll(version);
+}
+
+
+uint64_t sdfs::fileVersion(const string& fileName) {
+    lock_guard<mutex> lk(filesMutex);
+    auto it = versions.find(fileName);
+    return it != versions.end() ? it->second : 0;
+}
+
+
+char sdfs::fileLayout(const string& fileName) {
+    lock_guard<mutex> lk(filesMutex);
+    return layoutOf(fileName);
+}
+
+
+char sdfs::layoutOf(const string& fileName) {
+    auto it = layouts.find(fileName);
+    return it != layouts.end() ? it->second : LAYOUTWHOLE;
+}
+
+
+void sdfs::setLayout(const string& fileName, char layout) {
+    // only manifests are kept, files of older logs without a layout are whole
+    if (layout == LAYOUTBLOCKS || layout == LAYOUTCODED) {
+        layouts[fileName] = layout;
+    } else {
+        layouts.erase(fileName);
+    }
+}
+
+
+bool sdfs::waitQuorum(const vector<function<bool()>>& tasks, size_t needed) {
+    struct tally {
+        mutex countMutex;
+        condition_variable counted;
+        size_t succeeded = 0;
+        size_t finished = 0;
+    };
+    auto count = make_shared<tally>();
+    for (auto& task : tasks) {
+        thread runner([count, task]{
+            bool ok = task();
+            lock_guard<mutex> lk(count->countMutex);
+            count->succeeded += ok ? 1 : 0;
+            count->finished++;
+            count->counted.notify_all();
+        });
+        runner.detach();  // let this run on its own, it may outlive the quorum
+    }
+    auto total = tasks.size();
+    needed = min(needed, total);
+    unique_lock<mutex> lk(count->countMutex);
+    count->counted.wait(lk, [&count, needed, total]{
+        return count->succeeded >= needed || count->finished - count->succeeded > total - needed;
+    });
+    return count->succeeded >= needed;
+}
+
+
+bool sdfs::readVersion(const string& sdfsName, uint64_t& version, char* layout) {
+    struct answers {
+        mutex answersMutex;
+        vector<pair<int, uint64_t>> versions;
+        map<uint64_t, char> layouts;
+    };
+    auto found = make_shared<answers>();
+    vector<function<bool()>> asks;
+    for (auto node : replicaNodes(sdfsName)) {
+        asks.push_back([this, found, sdfsName, node]{
+            char label, layout;
+            uint64_t version;
+            if (!requestLabel(node, sdfsName, label, version, &layout) || label == 0) {
+                return false;
+            }
+            lock_guard<mutex> lk(found->answersMutex);
+            found->versions.emplace_back(node, version);
+            found->layouts[version] = layout;
+            return true;
+        });
+    }
+    uint64_t displacedVersion = 0;
+    char displacedLayout = LAYOUTWHOLE;
+    if (!waitQuorum(asks, readQuorum)) {
+        // right after a join the node that lost its place may still hold the copy a new
+        // replica is fetching, it counts until the hand-off is done
+        auto displaced = placement.replicas(sdfsName, asks.size() + 1);
+        size_t answers;
+        {
+            lock_guard<mutex> lk(found->answersMutex);
+            answers = found->versions.size();
+        }
+        char label;
+        if (displaced.size() <= asks.size() || answers + 1 < readQuorum ||
+            !requestLabel(displaced.back(), sdfsName, label, displacedVersion, &displacedLayout) || label == 0) {
+            log(ERROR) << "sdfs/ fewer than " << readQuorum << " replicas have " << sdfsName;
+            return false;
+        }
+    }
+
+    vector<pair<int, uint64_t>> answered;
+    map<uint64_t, char> layouts;
+    {
+        lock_guard<mutex> lk(found->answersMutex);
+        answered = found->versions;
+        layouts = found->layouts;
+    }
+    version = displacedVersion;
+    layouts.emplace(displacedVersion, displacedLayout);
+    for (auto& answer : answered) {
+        version = max(version, answer.second);
+    }
+    if (layout) {
+        *layout = layouts[version];
+    }
+    for (auto& answer : answered) {
+        if (answer.second < version) {
+            sendCatchUp(answer.first, sdfsName, version);
+        }
+    }
+    return true;
+}
+
+
+void sdfs::sendCatchUp(int node, const string& fileName, uint64_t version) {
+    char message[MAXDATASIZE];
+    strcpy(message, "CTCH");
+    int offset = 4;
+
+    uint64_t sentVersion = htonll(version);
+    memcpy(message+offset, &sentVersion, sizeof(sentVersion));
+    offset += sizeof(sentVersion);
+
+    int fileNameLen = htonl(fileName.size());
+    memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    memcpy(message+offset, &fileName[0], fileName.size());
+    offset += fileName.size();
+
+    // a node that cannot be reached catches up through UPDA once it is back
+    if (!conns.send(node, message, offset)) {
+        log(INFO) << "sdfs/ could not tell " << node << " to catch up on " << fileName;
+    }
+}
+
+
+void sdfs::catchUp(const string& fileName, uint64_t version) {
+    auto replicas = replicaNodes(fileName);
+    auto pos = find(replicas.begin(), replicas.end(), myNumber);
+    auto source = find_if(replicas.begin(), replicas.end(), [this](int node){ return node != myNumber; });
+    if (pos == replicas.end() || source == replicas.end()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = versions.find(fileName);
+        if ((it != versions.end() && it->second >= version) ||
+            !missingFiles.insert(make_pair(fileName, 'A' + (pos - replicas.begin()))).second) {
+            return;
+        }
+    }
+    queueRepair(*source, vector<string>{fileName});
+}
+
+
+void sdfs::sendNewVersion(request& req, char* recvBuf, int offset) {
+    uint64_t seen;
+    memcpy(&seen, recvBuf+offset, sizeof(seen));
+    offset += sizeof(seen);
+    seen = ntohll(seen);
+
+    int fileNameLen;
+    memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    fileNameLen = ntohl(fileNameLen);
+
+    string fileName(recvBuf+offset, fileNameLen);
+
+    char reply[4 + sizeof(uint64_t)];
+    memcpy(reply, "NVER", 4);
+    uint64_t version = htonll(issueVersion(fileName, seen));
+    memcpy(reply+4, &version, sizeof(version));
+    req.write(reply, sizeof(reply), true);
+}
+
+
+void sdfs::sendLabel(request& req, char* recvBuf, int offset) {
+    int fileNameLen;
+    memcpy(&fileNameLen, recvBuf+offset, sizeof(fileNameLen));
+    offset += sizeof(fileNameLen);
+    fileNameLen = ntohl(fileNameLen);
+
+    string fileName(recvBuf+offset, fileNameLen);
+
+    char reply[14];
+    memcpy(reply, "LABL", 4);
+    reply[4] = 0;
+    uint64_t version = 0;
+    {
+        lock_guard<mutex> lk(filesMutex);
+        auto it = files.find(fileName);
+        if (it != files.end()) {
+            reply[4] = it->second;
+            version = htonll(versions[fileName]);
+        }
+        reply[13] = layoutOf(fileName);
+    }
+    memcpy(reply+5, &version, sizeof(version));
+    req.write(reply, sizeof(reply), true);
+}
+
+
+future<sdfsReply> sdfs::startOp(const string& description, uint64_t& id, function<bool(sdfsReply&)> op,
+                                function<void(const sdfsReply&)> done) {
+    {
+        lock_guard<mutex> lk(opsMutex);
+        id = nextOp++;
+        pendingOps[id] = description;
+    }
+    auto result = make_shared<promise<sdfsReply>>();
+    auto opId = id;
+    clientWorkers.submit([this, result, opId, op, done]{
+        sdfsReply reply;
+        reply.id = opId;
+        // the caller waits on the future, an op that throws must still answer it
+        try {
+            reply.ok = op(reply);
+        } catch (const exception& e) {
+            log(ERROR) << "sdfs/ operation " << opId << " failed: " << e.what();
+            reply.ok = false;
+        } catch (...) {
+            log(ERROR) << "sdfs/ operation " << opId << " failed";
+            reply.ok = false;
+        }
+        {
+            lock_guard<mutex> lk(opsMutex);
+            pendingOps.erase(opId);
+        }
+        if (done) {
+            done(reply);
         }
-    }
+        result->set_value(move(reply));
+    });
+    return result->get_future();
 }
 
 
-void sdfs::updateFileDistribution() {
-    lock_guard<mutex> lck (updateFileDistMutex);
-    updateFileIds();
-    requestUpdateMasteringFiles();
+future<sdfsReply> sdfs::putAsync(const string& localName, const string& sdfsName, uint64_t& id,
+                                 function<void(const sdfsReply&)> done) {
+    return startOp("put " + localName + " " + sdfsName, id, [this, localName, sdfsName](sdfsReply&) {
+        return storeFile(localName, sdfsName);
+    }, done);
 }
 
 
-void sdfs::nodeFailure(int node) {
-    if (!ring[node]) {
-        return;
-    }
-
-    if ( node == predecessorNode(myNumber) ||
-         node == successorNode(myNumber) ||
-         node == successorNode( successorNode(myNumber) ) ) {
-
-        ring[node] = false;
-        log(INFO) << "node " << node << " fails, updated file ids." << endl;
-        updateFileDistribution();
-    }
-    ring[node] = false;
+future<sdfsReply> sdfs::appendAsync(const string& localName, const string& sdfsName, uint64_t& id,
+                                    function<void(const sdfsReply&)> done) {
+    return startOp("append " + localName + " " + sdfsName, id, [this, localName, sdfsName](sdfsReply&) {
+        return appendFile(localName, sdfsName);
+    }, done);
 }
 
 
-void sdfs::showStore() {
-    cout<<"=> showStore: \n";
-    const char separator    = ' ';
-    const int nameWidth     = 20;
-    const int charWidth      = 1;
-    for (auto it=files.begin(); it!=files.end(); ++it) {
-        cout << left << setw(nameWidth) << setfill(separator) << it->first;
-        cout << left << setw(charWidth) << setfill(separator) << it->second << endl;
-    }
+future<sdfsReply> sdfs::getAsync(const string& sdfsName, const string& localName, uint64_t& id,
+                                 function<void(const sdfsReply&)> done) {
+    return startOp("get " + sdfsName + " " + localName, id, [this, sdfsName, localName](sdfsReply&) {
+        return fetchFile(sdfsName, localName);
+    }, done);
 }
 
 
-void sdfs::showFileLocations(string fileName){
-    auto node = location(fileName);
-    if (node == myNumber) {
-        auto it = files.find(fileName);
-        if (it != files.end()) {
-            struct in_addr tmp;
-            tmp.s_addr = htonl(fd->IPAddrs[node]);
-            auto IP = inet_ntoa(tmp);
-            cout << IP << "      " << it->second << endl;
-            if (it->second == 'C') {
-                return;
-            }
-            sendQueryMessage(myNumber, successorNode(myNumber), fileName);
-        }
-        return;
-    }
-    sendQueryMessage(myNumber, node, fileName);
+future<sdfsReply> sdfs::getRangeAsync(const string& sdfsName, const string& localName, uint64_t start,
+                                      uint64_t length, uint64_t& id, function<void(const sdfsReply&)> done) {
+    return startOp("getrange " + sdfsName + " " + localName, id,
+                   [this, sdfsName, localName, start, length](sdfsReply&) {
+        return fetchRange(sdfsName, localName, start, length);
+    }, done);
 }
 
 
-void sdfs::sendQueryMessage(int requestNode, int hostNode, string fileName) {
-    int connToServer;
-    int status = connectToServer(hostNode, &connToServer);
-    if(status) {
-        cout << "sendQueryMessage: Cannot connect to "<< hostNode << endl;
+future<sdfsReply> sdfs::deleteAsync(const string& sdfsName, uint64_t& id,
+                                    function<void(const sdfsReply&)> done) {
+    return startOp("delete " + sdfsName, id, [this, sdfsName](sdfsReply&) {
+        return deleteFile(sdfsName);
+    }, done);
+}
 
-    } else {
-        char message[MAXDATASIZE];
-        strcpy(message, "QURY");
-        int offset = 4;
 
-        requestNode = htonl(requestNode);
-        memcpy(message+offset, &requestNode, sizeof(requestNode));
-        offset += sizeof(requestNode);
+future<sdfsReply> sdfs::locateAsync(const string& sdfsName, uint64_t& id,
+                                    function<void(const sdfsReply&)> done) {
+    return startOp("ls " + sdfsName, id, [this, sdfsName](sdfsReply& reply) {
+        reply.replicas = locateFile(sdfsName, &reply.versions);
+        return !reply.replicas.empty();
+    }, done);
+}
 
-        int fileNameLen = htonl(fileName.size());
-        memcpy(message+offset, &fileNameLen, sizeof(fileNameLen));
-        offset += sizeof(fileNameLen);
 
-        memcpy(message+offset, &fileName[0], fileName.size());
-        offset += fileName.size();
-        log(INFO) << "sending Query message " << offset << endl;
-        write(connToServer, message, offset);
-        close(connToServer);
+void sdfs::showOps() {
+    lock_guard<mutex> lk(opsMutex);
+    cout << nextOp - 1 << " operations started, " << pendingOps.size() << " running or queued" << endl;
+    for (auto& op : pendingOps) {
+        cout << "[" << op.first << "] " << op.second << endl;
     }
 }
 
@@ -1128,17 +4110,43 @@ void sdfs::handleInput() {
         } else if (input.compare("put") == 0) {
             string localFileName, sdfsFileName;
             cin >> localFileName >> sdfsFileName;
-            storeFile(localFileName, sdfsFileName);
+            uint64_t id;
+            putAsync(localFileName, sdfsFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                showReply("put " + sdfsFileName, reply);
+            });
+
+        } else if (input.compare("append") == 0) {
+            string localFileName, sdfsFileName;
+            cin >> localFileName >> sdfsFileName;
+            uint64_t id;
+            appendAsync(localFileName, sdfsFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                showReply("append " + sdfsFileName, reply);
+            });
 
         } else if (input.compare("get") == 0) {
             string localFileName, sdfsFileName;
             cin >> sdfsFileName >> localFileName;
-            fetchFile(sdfsFileName, localFileName);
+            uint64_t id;
+            getAsync(sdfsFileName, localFileName, id, [this, sdfsFileName](const sdfsReply& reply) {
+                showReply("get " + sdfsFileName, reply);
+            });
+
+        } else if (input.compare("getrange") == 0) {
+            string localFileName, sdfsFileName;
+            uint64_t start, length;
+            cin >> sdfsFileName >> localFileName >> start >> length;
+            uint64_t id;
+            getRangeAsync(sdfsFileName, localFileName, start, length, id, [this, sdfsFileName](const sdfsReply& reply) {
+                showReply("getrange " + sdfsFileName, reply);
+            });
 
         } else if (input.compare("delete") == 0) {
             string fileName;
             cin >> fileName;
-            deleteFile(fileName);
+            uint64_t id;
+            deleteAsync(fileName, id, [this, fileName](const sdfsReply& reply) {
+                showReply("delete " + fileName, reply);
+            });
 
         } else if (input.compare("store") == 0) {
             showStore();
@@ -1146,8 +4154,71 @@ void sdfs::handleInput() {
         } else if (input.compare("ls") == 0) {
             string fileName;
             cin >> fileName;
+            uint64_t id;
+            locateAsync(fileName, id, [this, fileName](const sdfsReply& reply) {
+                showReply("ls " + fileName, reply);
+            });
+
+        } else if (input.compare("ops") == 0) {
+            showOps();
+
+        } else if (input.compare("layout") == 0) {
+            string layout;
+            cin >> layout;
+            blockLayout = layout.compare("blocks") == 0;
+            codedLayout = layout.compare("coded") == 0;
+            cout << "storing large files " << (blockLayout ? "in blocks" : codedLayout ? "erasure coded" : "whole")
+                 << endl;
+
+        } else if (input.compare("blocks") == 0) {
+            string fileName;
+            cin >> fileName;
+            showBlocks(fileName);
+
+        } else if (input.compare("repair") == 0) {
+            showRepair();
+
+        } else if (input.compare("repairrate") == 0) {
+            double megabytes;
+            cin >> megabytes;
+            setRepairRate(static_cast<uint64_t>(megabytes * 1024 * 1024));
+
+        } else if (input.compare("cache") == 0) {
+            showCache();
+
+        } else if (input.compare("peers") == 0) {
+            showPeers();
 
-            showFileLocations(fileName);
+        } else if (input.compare("compress") == 0) {
+            string mode;
+            cin >> mode;
+            compression = mode.compare("on") == 0;
+            showCompression();
+
+        } else if (input.compare("durable") == 0) {
+            string mode;
+            cin >> mode;
+            setDurable(mode.compare("on") == 0);
+            showDurability();
+
+        } else if (input.compare("direct") == 0) {
+            string mode;
+            cin >> mode;
+            setDirectWrites(mode.compare("on") == 0);
+
+        } else if (input.compare("zerocopy") == 0) {
+            string mode;
+            cin >> mode;
+            setZeroCopy(mode.compare("on") == 0);
+
+        } else if (input.compare("quorum") == 0) {
+            cin >> writeQuorum >> readQuorum;
+            cout << "PUT waits for " << writeQuorum << " replicas, GET for " << readQuorum << endl;
+
+        } else if (input.compare("dir") == 0) {
+            string dirPrefix;
+            cin >> dirPrefix;
+            showFileNames(dirPrefix);
 
         } else if (input.compare("ring") == 0) {
             printRing();
@@ -1162,9 +4233,24 @@ void sdfs::handleInput() {
                  << "[leave] to leave the system\n"
                  << "[join] <introducer vm's number> to join the system\n"
                  << "[put] <localFileName> <remoteFile> to add put file to sdfs\n"
+                 << "[append] <localFileName> <remoteFile> to append a local file to a file in sdfs\n"
+                 << "[getrange] <remoteFile> <localFileName> <offset> <length> to get part of a file\n"
                  << "[delete] <remoteFile> to delete file to sdfs\n"
                  << "[store] to show all files at this location\n"
-                 << "[ls] <remoteFile> to show file replica locations\n";
+                 << "[ls] <remoteFile> to show file replica locations\n"
+                 << "[dir] <prefix> to list the sdfs files whose names start with prefix\n"
+                 << "[ops] to show the put, get, delete and ls operations still running\n"
+                 << "[layout] <whole|blocks|coded> to store large files whole, striped in blocks or erasure coded\n"
+                 << "[blocks] <remoteFile> to show the blocks of a striped file or the fragments of a coded one\n"
+                 << "[repair] to show the progress of re-replication after a failure\n"
+                 << "[repairrate] <MB/s> to cap the re-replication traffic this node sends, 0 for no cap\n"
+                 << "[cache] to show the files cached from other nodes\n"
+                 << "[peers] to show how fast the other nodes answered reads\n"
+                 << "[compress] <on|off> to compress file transfers to nodes that support it\n"
+                 << "[durable] <on|off> to sync stored files to disk, in groups, before writers are answered\n"
+                 << "[direct] <on|off> to write large stored files with O_DIRECT\n"
+                 << "[zerocopy] <on|off> to move files with sendfile and io_uring\n"
+                 << "[quorum] <W> <R> to wait for W replicas on put and R replicas on get\n";
         }
     }
 }
@@ -1199,188 +4285,454 @@ void sdfs::createSocket() {
 
 
 int sdfs::getNodeNumber(uint32_t IP) {
-    for(int i = 1; i <= NODES; ++i) {
-        if (fd->IPAddrs[i]==IP)
-            return i;
-    }
-    return 0;
+    return fd->getNodeNumber(IP);
 }
 
 
-int sdfs::connectToServer(int targetNode, int *connectionFd) {
+int sdfs::createFileHeader(char* header, const string& code, const string& remoteFile, uint64_t length,
+                           uint64_t version, char layout) {
+    uint64_t sentLength = htonll(length);
+    int fileNameSize = remoteFile.size();
+    int sentFileNameSize = htonl(fileNameSize);
+
+    // header: PUTA, version, layout, sizeof(filename), sizeof(content), filename
+    int offset = 4;
+    memcpy(header, &code[0], 4);
+
+    uint64_t sentVersion = htonll(version);
+    memcpy(header+offset, &sentVersion, sizeof(sentVersion));
+    offset += sizeof(sentVersion);
 
-    struct in_addr tmp;
-    tmp.s_addr = htonl(fd->IPAddrs[targetNode]);
-    auto IP = inet_ntoa(tmp);
+    header[offset] = layout;
+    offset++;
 
-    //create client skt
-    *connectionFd = socket(AF_INET, SOCK_STREAM, 0);
+    memcpy(header+offset, &sentFileNameSize, sizeof(sentFileNameSize));
+    offset += sizeof(sentFileNameSize);
+
+    memcpy(header+offset, &sentLength, sizeof(sentLength));
+    offset += sizeof(sentLength);
+
+    memcpy(header+offset, &remoteFile[0], fileNameSize);
+    offset += fileNameSize;
+
+    return offset;
+}
+
+
+bool sdfs::sendFileRange(request& req, const string& path, uint64_t start, uint64_t length, throttle* limit) {
+    if (zeroCopy) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        bool sent = true;
+        while (sent && length > 0) {
+            auto frameLen = min(length, static_cast<uint64_t>(MAXFRAMESIZE));
+            if (limit) {
+                limit->acquire(frameLen);
+            }
+            sent = req.sendFile(fd, start, frameLen);
+            start += frameLen;
+            length -= frameLen;
+        }
+        close(fd);
+        return sent;
+    }
+
+    ifstream file(path, ios::binary);
+    file.seekg(start);
+    char chunk[CHUNKSIZE];
+    while (length > 0) {
+        auto toRead = min(length, static_cast<uint64_t>(CHUNKSIZE));
+        file.read(chunk, toRead);
+        auto numRead = file.gcount();
+        if (numRead <= 0) {
+            return false;
+        }
+        if (limit) {
+            limit->acquire(numRead);
+        }
+        if (!req.write(chunk, numRead)) {
+            return false;
+        }
+        length -= numRead;
+    }
+    return true;
+}
 
-    // allow address reuse
-    int YES = 1;
-    setsockopt(sockFd, SOL_SOCKET, SO_REUSEADDR, &YES, sizeof(int));
 
-    // open socket
-    if(*connectionFd < 0) {
-        cout << "Cannot open socket" << endl;
-        exit(1);
+bool sdfs::sendStored(request& req, const string& path, uint64_t start, uint64_t length) {
+    auto cached = hot.get(path);
+    // a file that changed since the caller measured it is sent as it is on disk
+    if (!cached || start + length > cached->length) {
+        return sendFileRange(req, path, start, length);
     }
+    return req.write(cached->data + start, length);
+}
+
+
+bool sdfs::recvFileChunks(request& req, ostream& wFile, uint64_t length) {
+    bool forwarded = false;
+    return recvFileChunks(req, wFile, length, nullptr, forwarded);
+}
 
-    //Variables Declaration
-    struct addrinfo hints, * res;
-    int status;
 
-    //clear hints
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-    auto portStr = to_string(PORT2);
-    status = getaddrinfo(IP, portStr.c_str(), &hints, &res);
-    if (status != 0) {
-        fprintf(stderr, "Error getaddrinfo\n");
-        exit(1);
+bool sdfs::recvFileChunks(request& req, ostream& wFile, uint64_t length, request* forward, bool& forwarded) {
+    if (zeroCopy) {
+        // whole frames go to the file as they came off the connection
+        auto frames = dynamic_cast<uringFile*>(&wFile);
+        string frame;
+        while (length > 0) {
+            auto numBytes = req.readFrame(frame, length);
+            if (numBytes <= 0) {
+                return false;
+            }
+            if (forwarded && !forward->write(frame.data(), numBytes)) {
+                log(ERROR) << "sdfs/ lost the next node of the replication chain";
+                forwarded = false;
+            }
+            if (frames) {
+                frames->writeBuffer(move(frame));
+            } else {
+                wFile.write(frame.data(), numBytes);
+            }
+            length -= numBytes;
+        }
+        return true;
     }
 
-    status = connect(*connectionFd, res->ai_addr, res->ai_addrlen);
-    if (status < 0) {
-        cout << "Cannot connect to: " << targetNode << endl;
-        cout.flush();
-        return -1;
+    char chunk[CHUNKSIZE];
+    while (length > 0) {
+        auto toRead = min(length, static_cast<uint64_t>(CHUNKSIZE));
+        auto numBytes = req.read(chunk, toRead);
+        if (numBytes <= 0) {
+            return false;
+        }
+        // forward first so the next node of the chain works while we hit the disk
+        if (forwarded && !forward->write(chunk, numBytes)) {
+            log(ERROR) << "sdfs/ lost the next node of the replication chain";
+            forwarded = false;
+        }
+        wFile.write(chunk, numBytes);
+        length -= numBytes;
     }
-    return 0;
+    return true;
 }
 
 
-bool sdfs::pushFileToNode(int targetNode, string localFile, string remoteFile, string code) {
-    int connectionToServer;
+int sdfs::createChainHeader(char* header, char label, const vector<int>& nodes, const vector<char>& labels,
+                            size_t quorum, const string& remoteFile, uint64_t length, uint64_t version,
+                            char layout) {
+    strcpy(header, "CHN");
+    header[3] = label;
+    int offset = 4;
 
-    std::ifstream file(localFile, ios::binary);
+    int hops = htonl(nodes.size());
+    memcpy(header+offset, &hops, sizeof(hops));
+    offset += sizeof(hops);
 
-    if (!file.good()) {
-        cout << "pushFileToNode: Could not open file: " << localFile << endl;
-        return false;
+    int sentQuorum = htonl(min(quorum, nodes.size() + 1));
+    memcpy(header+offset, &sentQuorum, sizeof(sentQuorum));
+    offset += sizeof(sentQuorum);
+
+    for (size_t i=0; i < nodes.size(); i++) {
+        int node = htonl(nodes[i]);
+        memcpy(header+offset, &node, sizeof(node));
+        offset += sizeof(node);
+
+        header[offset] = labels[i];
+        offset++;
     }
 
-    log(INFO) << "pushFileToNode: Connecting to "<< targetNode << "..." << endl;
+    uint64_t sentLength = htonll(length);
+    int fileNameSize = remoteFile.size();
+    int sentFileNameSize = htonl(fileNameSize);
 
-    int ret = connectToServer(targetNode, &connectionToServer);
+    memcpy(header+offset, &sentFileNameSize, sizeof(sentFileNameSize));
+    offset += sizeof(sentFileNameSize);
 
-    if(ret!=0) {
-        cout <<"ERROR pushFileToNode: Cannot connect to " << targetNode << endl;
-        file.close();
-        return false;
+    memcpy(header+offset, &sentLength, sizeof(sentLength));
+    offset += sizeof(sentLength);
 
-    } else {
+    uint64_t sentVersion = htonll(version);
+    memcpy(header+offset, &sentVersion, sizeof(sentVersion));
+    offset += sizeof(sentVersion);
 
-        // Read the file, store in buffer
-        file.seekg (0, file.end);
-        int length = file.tellg();
-        file.seekg (0, file.beg);
-      //  char * buffer = new char [length];
-      //  file.read (buffer,length);
+    header[offset] = layout;
+    offset++;
 
-        int sentLength = htonl(length);
-        int fileNameSize = remoteFile.size();
-        int sentFileNameSize = htonl(fileNameSize);
+    memcpy(header+offset, &remoteFile[0], fileNameSize);
+    offset += fileNameSize;
+
+    return offset;
+}
 
-        // header: PUTA, sizeof(filename), sizeof(content), filename
-        char header[MAXDATASIZE];
-        int offset = 4;
-        memcpy(header, &code[0], 4);
 
-        memcpy(header+offset, &sentFileNameSize, sizeof(sentFileNameSize));
-        offset += sizeof(sentFileNameSize);
+void sdfs::recvChainFile(string header, request& req, char label) {
+    char* recvBuf = &header[0];
+    int numBytes = header.size();
+    int offset = 4;
 
-        memcpy(header+offset, &sentLength, sizeof(sentLength));
-        offset += sizeof(sentLength);
+    int hops;
+    memcpy(&hops, recvBuf+offset, sizeof(hops));
+    offset += sizeof(hops);
+    hops = ntohl(hops);
 
-        memcpy(header+offset, &remoteFile[0], fileNameSize);
-        offset += fileNameSize;
+    int quorum;
+    memcpy(&quorum, recvBuf+offset, sizeof(quorum));
+    offset += sizeof(quorum);
+    quorum = ntohl(quorum);
+
+    vector<int> nodes;
+    vector<char> labels;
+    for (int i=0; i < hops; i++) {
+        int node;
+        memcpy(&node, recvBuf+offset, sizeof(node));
+        offset += sizeof(node);
+        nodes.push_back(ntohl(node));
+
+        labels.push_back(recvBuf[offset]);
+        offset++;
+    }
 
-        header[offset] = '\0';
+    int fileNameSize;
+    memcpy(&fileNameSize, recvBuf+offset, sizeof(fileNameSize));
+    offset += sizeof(fileNameSize);
+    fileNameSize = ntohl(fileNameSize);
 
-        char* message = new char[offset + length];
+    uint64_t length;
+    memcpy(&length, recvBuf+offset, sizeof(length));
+    offset += sizeof(length);
+    length = ntohll(length);
 
-        memcpy(message, header, offset);
+    uint64_t version;
+    memcpy(&version, recvBuf+offset, sizeof(version));
+    offset += sizeof(version);
+    version = ntohll(version);
 
-        file.read(&message[offset], length);
+    char layout = recvBuf[offset];
+    offset++;
 
-        write(connectionToServer, message, offset + length );
-        close(connectionToServer);
-        file.close();
-        delete[] message;
-        return true;
+    string fileName(recvBuf+offset, fileNameSize);
+    offset += fileNameSize;
+
+    log(INFO) << "sdfs/ receiving " << fileName << " (" << length << " bytes) as " << label
+              << ", " << hops << " more nodes in the chain";
+
+    // open the next hop before any data arrives so every chunk is passed on immediately
+    shared_ptr<request> next;
+    bool forwarded = false;
+    if (hops > 0) {
+        next = conns.open(nodes[0]);
+        if (!next) {
+            cout << "recvChainFile: Cannot connect to " << nodes[0] << endl;
+        } else {
+            char nextHeader[MAXDATASIZE];
+            int nextOffset = createChainHeader(nextHeader, labels[0],
+                                               vector<int>(nodes.begin()+1, nodes.end()),
+                                               vector<char>(labels.begin()+1, labels.end()),
+                                               quorum > 0 ? quorum - 1 : 0, fileName, length, version, layout);
+            next->compress(compression);
+            forwarded = next->write(nextHeader, nextOffset);
+        }
+    }
+
+    // a newer version stored here already wins, the older one is only passed on
+    auto storedVersion = fileVersion(fileName);
+    bool stale = version != 0 && version < storedVersion;
+    auto wFile = stale ? unique_ptr<ostream>(new ofstream()) : createFile(storePath(fileName), length);
+    uint64_t firstChunk = numBytes - offset;
+    if (forwarded && firstChunk > 0) {
+        forwarded = next->write(recvBuf+offset, firstChunk);
     }
+    wFile->write(recvBuf+offset, firstChunk);
+
+    bool received = recvFileChunks(req, *wFile, length - firstChunk, next.get(), forwarded);
+    wFile.reset();
+
+    if (received && stale) {
+        log(INFO) << "sdfs/ dropped version " << version << " of " << fileName << ", a newer one is stored";
+    } else if (received) {
+        addFile(fileName, label, version, layout);
+        log(INFO) << "stored file on local disk";
+    } else {
+        log(ERROR) << "sdfs/ connection closed while receiving " << fileName;
+    }
+
+    // the copy that completes the quorum is acked at once, the rest of the chain gets the file
+    // in the background and a node that missed it is told to catch up
+    bool early = quorum <= 1;
+    if (early) {
+        if (!received) {
+            log(ERROR) << "sdfs/ replication chain for " << fileName << " broke at " << label;
+        }
+        if (received && stale) {
+            sendStale(req, storedVersion);
+        } else {
+            req.write(received ? "ACKC" : "NAKC", 4, true);
+        }
+    }
+
+    // wait for the rest of the chain before acking upstream
+    uint64_t newer = 0;
+    if (forwarded) {
+        forwarded = next->finish() && readAck(*next, newer);
+    }
+
+    if (early) {
+        if (received && hops > 0 && !forwarded && newer == 0) {
+            log(INFO) << "sdfs/ " << nodes[0] << " missed version " << version << " of " << fileName
+                      << ", it catches up";
+            sendCatchUp(nodes[0], fileName, version);
+        }
+        return;
+    }
+
+    // a node of the chain that holds a newer version dropped the write, the writer is told
+    // which version it lost to so it can store the file again under a later one
+    newer = max(newer, stale ? storedVersion : 0);
+    if (received && newer != 0) {
+        sendStale(req, newer);
+        return;
+    }
+    bool chainDone = received && (hops == 0 || forwarded);
+    if (!chainDone) {
+        log(ERROR) << "sdfs/ replication chain for " << fileName << " broke after " << label;
+    }
+    req.write(chainDone ? "ACKC" : "NAKC", 4, true);
+}
+
+
+void sdfs::sendStale(request& req, uint64_t newer) {
+    char reply[4 + sizeof(uint64_t)];
+    memcpy(reply, "STAL", 4);
+    uint64_t sentVersion = htonll(newer);
+    memcpy(reply+4, &sentVersion, sizeof(sentVersion));
+    req.write(reply, sizeof(reply), true);
+}
+
+
+bool sdfs::readAck(request& req, uint64_t& newer) {
+    char ack[4];
+    if (!req.readAll(ack, sizeof(ack))) {
+        return false;
+    }
+    uint64_t sentVersion;
+    if (strncmp(ack, "STAL", 4) == 0 && req.readAll(reinterpret_cast<char*>(&sentVersion), sizeof(sentVersion))) {
+        newer = ntohll(sentVersion);
+        return false;
+    }
+    return strncmp(ack, "ACKC", 4) == 0;
 }
 
 
-bool sdfs::pushFileToNodes(vector<int> nodes, string localFile, string remoteFile, vector<string> codes) {
+bool sdfs::pushFileToNode(int targetNode, string localFile, string remoteFile, string code,
+                          uint64_t start, uint64_t count, uint64_t version, char layout) {
     std::ifstream file(localFile, ios::binary);
 
     if (!file.good()) {
-        cout << "pushFileToNodes: Could not open file: " << localFile << endl;
+        cout << "pushFileToNode: Could not open file: " << localFile << endl;
         return false;
     }
-         
-    // Read the file, store in buffer
-    file.seekg (0, file.end);
-    int length = file.tellg();
-    file.seekg (0, file.beg);
 
-    int sentLength = htonl(length);
-    int fileNameSize = remoteFile.size();
-    int sentFileNameSize = htonl(fileNameSize);
+    log(INFO) << "pushFileToNode: Connecting to "<< targetNode << "..." << endl;
 
-    // header: PUTA, sizeof(filename), sizeof(content), filename
-    char header[MAXDATASIZE];
-    int offset = 4;
-    string code = codes[0];
-    strcpy(header, code.data());
+    auto req = conns.open(targetNode);
 
-    memcpy(header+offset, &sentFileNameSize, sizeof(sentFileNameSize));
-    offset += sizeof(sentFileNameSize);
+    if(!req) {
+        cout <<"ERROR pushFileToNode: Cannot connect to " << targetNode << endl;
+        file.close();
+        return false;
 
-    memcpy(header+offset, &sentLength, sizeof(sentLength));
-    offset += sizeof(sentLength);
+    }
 
-    memcpy(header+offset, &remoteFile[0], fileNameSize);
-    offset += fileNameSize;
+    file.seekg (0, file.end);
+    uint64_t length = file.tellg();
+    start = min(start, length);
+    length = min(length - start, count);
 
-    header[offset] = '\0';
+    char header[MAXDATASIZE];
+    int offset = createFileHeader(header, code, remoteFile, length, version, layout);
+
+    req->compress(compression);
+    bool sent = req->write(header, offset) &&
+                sendStored(*req, localFile, start, length) &&
+                req->finish();
+
+    // the receiver ends the request once it has handled the file, wait for that so a
+    // message sent after this one cannot overtake the file on another worker. A receiver
+    // that holds a newer version drops the file and says so with STAL
+    char buf[4 + sizeof(uint64_t)];
+    string reply;
+    ssize_t numBytes = 0;
+    while (sent && (numBytes = req->read(buf, sizeof(buf))) > 0) {
+        reply.append(buf, numBytes);
+    }
+    sent = sent && numBytes == 0;
+    if (sent && reply.compare(0, 4, "STAL") == 0) {
+        log(ERROR) << "pushFileToNode: " << targetNode << " holds a newer version of " << remoteFile;
+        sent = false;
+    }
 
-    char* message = new char[offset + length];
+    if (!sent) {
+        log(ERROR) << "pushFileToNode: transfer of " << localFile << " to " << targetNode << " failed";
+    }
+    file.close();
+    return sent;
+}
 
-    memcpy(message, header, offset);
 
-    file.read(&message[offset], length);
+bool sdfs::pushFileToNodes(vector<int> nodes, string localFile, string remoteFile, vector<string> codes,
+                           uint64_t start, uint64_t count, uint64_t version, char layout, size_t quorum,
+                           uint64_t* newer) {
+    std::ifstream file(localFile, ios::binary);
 
-    for (size_t i=0; i < nodes.size(); i++) {
-        code = codes[i];
-        strcpy(message, code.data());
-        int connectionToServer;
-        int ret = connectToServer(nodes[i], &connectionToServer);
-        if(ret!=0) {
-            cout <<"ERROR pushFileToNodes: Cannot connect to " << nodes[i] << endl;
-            file.close();
-            return false;
+    if (!file.good()) {
+        cout << "pushFileToNodes: Could not open file: " << localFile << endl;
+        return false;
+    }
 
-        } else {
+    file.seekg (0, file.end);
+    uint64_t length = file.tellg();
+    start = min(start, length);
+    length = min(length - start, count);
 
-            int ret = write(connectionToServer, message, offset + length);
-            if (ret !=0) {
-                close(connectionToServer);
-                file.close();
-                delete[] message;
-                return false;
-            }
-            close(connectionToServer);
-        }
-    
-    }           
+    vector<char> labels;
+    for (auto& code : codes) {
+        labels.push_back(code[3]);
+    }
+
+    // only the head of the chain is sent the file, it tells each node who comes next
+    char header[MAXDATASIZE];
+    int offset = createChainHeader(header, labels[0],
+                                   vector<int>(nodes.begin()+1, nodes.end()),
+                                   vector<char>(labels.begin()+1, labels.end()),
+                                   quorum, remoteFile, length, version, layout);
+
+    auto req = conns.open(nodes[0]);
+    if(!req) {
+        cout <<"ERROR pushFileToNodes: Cannot connect to " << nodes[0] << endl;
+        file.close();
+        return false;
+    }
+
+    req->compress(compression);
+    bool sent = req->write(header, offset) &&
+                sendFileRange(*req, localFile, start, length) &&
+                req->finish();
+
+    uint64_t newerVersion = 0;
+    bool acked = sent && readAck(*req, newerVersion);
     file.close();
-    delete[] message;
-    return true;
+    if (newer) {
+        *newer = newerVersion;
+    }
+
+    if (!acked) {
+        log(ERROR) << "pushFileToNodes: replication chain for " << remoteFile << " starting at "
+                   << nodes[0] << " failed";
+    }
+    return acked;
 }
 
 
@@ -1394,21 +4746,35 @@ void sdfs::printRing() {
 
 
 int sdfs::location(const string &filename) {
-    int node =  hash<string>{}(filename) % 10;
-    if (node == 0) {
-        node = 10;
-    }
-    if (!ring[node]) {
-        node = successorNode(node);
+    auto node = placement.owner(filename);
+    {
+        // a file stays with the node it was on until its copy reached the node that joined in front of it
+        lock_guard<mutex> lk(handOverMutex);
+        auto it = handOvers.find(filename);
+        if (it != handOvers.end() && liveNode(it->second)) {
+            return it->second;
+        }
+        if (node != 0 && joiningNode(node)) {
+            for (auto replica : placement.replicas(filename, placement.size())) {
+                if (!joiningNode(replica)) {
+                    return replica;
+                }
+            }
+        }
     }
-    return node;
+    return node != 0 ? node : myNumber;
+}
+
+
+bool sdfs::liveNode(int node) {
+    return node > 0 && node <= NODES && ring[node];
 }
 
 
 int sdfs::successorNode(int node) {
     int pos = 0;
     for (int i = node+1; ; ++i) {
-        pos = i % 11;
+        pos = i % (NODES+1);
         if (ring[pos]) {
             return pos;
         }
@@ -1416,16 +4782,3 @@ int sdfs::successorNode(int node) {
 }
 
 
-int sdfs::predecessorNode(int node) {
-    int pos = node -1;
-    while(1) {
-        if (pos == 0) {
-            pos = 10;
-        }
-        if (ring[pos]) {
-            return pos;
-        }
-        --pos;
-    }
-}
-
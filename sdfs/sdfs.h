@@ -6,18 +6,35 @@
 
 #pragma once
 
+#include "../connection/connection.h"
 #include "../failure_detector/failure_detector.h"
 #include "../logger/logger.h"
+#include "../util/direct_file.h"
+#include "../util/uring_file.h"
+#include "../util/reed_solomon.h"
+#include "../util/throttle.h"
 #include "../util/util.h"
+#include "../util/worker_pool.h"
+#include "group_commit.h"
+#include "hash_ring.h"
+#include "metadata_store.h"
+#include "pack_file.h"
+#include "read_cache.h"
+#include "hot_cache.h"
+#include "peer_stats.h"
 
 #include <algorithm>
 #include <array>
 #include <arpa/inet.h>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
 #include <errno.h>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <mutex>
 #include <netinet/in.h>
@@ -26,6 +43,7 @@
 #include <string>
 #include <stdlib.h>
 #include <signal.h>
+#include <sstream>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -35,15 +53,126 @@
 #include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace std;
 
 constexpr int MAXDATASIZE2 = 5000;
 constexpr uint16_t PORT2 = 6666;
+constexpr int CHUNKSIZE = 64 * 1024;  // bytes read from disk and sent per write() in file transfers
+constexpr uint64_t BLOCKSIZE = 4 * 1024 * 1024;  // size of the blocks large files are striped into
+constexpr char BLOCKSEP = '#';        // block i of file f is stored in sdfs as f#i
+constexpr size_t PARALLELBLOCKS = 4;  // blocks stored or fetched at the same time
+constexpr uint64_t MINRANGE = 1024 * 1024;  // files up to this size are read from one replica
+#ifndef SDFS_VNODES
+#define SDFS_VNODES 64
+#endif
+constexpr int VNODES = SDFS_VNODES;   // points of every node on the hash ring, make VNODES=<n> to change
+constexpr size_t REPAIRSTREAMS = 4;    // batches of missing files fetched at the same time after a failure
+constexpr size_t REPAIRBATCH = 64;     // most files asked for in one re-replication stream
+constexpr uint64_t REPAIRRATE = 20 * 1024 * 1024;  // default cap on re-replication bytes a node sends per second
+constexpr uint32_t HANDOFFPOLLMS = 2000;        // how often a node checks whether its surplus copies arrived
+constexpr int HANDOFFTRIES = 150;               // checks before surplus copies are left where they are
+constexpr uint32_t HANDOFFWAITMS = 30 * 1000;   // an append waits this long for its file to reach a new primary
+constexpr uint64_t DELTABLOCK = 64 * 1024;  // blocks compared when a stale replica is brought up to date
+constexpr uint64_t WHOLEFILE = numeric_limits<uint64_t>::max();
+const string MANIFESTMAGIC = "#sdfs-blocks 1";  // first line of a block manifest
+const string SUMSMAGIC = "#sdfs-sums 1";        // first line of a checksum file
+const string SUMSUFFIX = "#sum";                // checksums of file f are kept next to it in f#sum
+const string METALOG = "#sdfs.wal";             // metadata store of the files of this node
+const string METASNAPSHOT = "#sdfs.snapshot";
+const string CACHEDIR = "#sdfs.cache";          // copies of files this node fetched from others
+constexpr uint64_t CACHEBYTES = 256 * 1024 * 1024;  // most bytes of fetched files kept in CACHEDIR
+constexpr uint32_t LEASEMS = 10 * 1000;         // a cached copy is used this long before it is validated again
+constexpr uint64_t HOTBYTES = 128 * 1024 * 1024;    // most bytes of stored files served from memory
+constexpr uint64_t HOTFILEMAX = 16 * 1024 * 1024;   // larger stored files are always read from disk
+constexpr size_t HOTGHOSTS = 1024;              // files read once that are remembered, see hotCache
+constexpr double PEERWEIGHT = 0.2;              // weight of a new sample in the estimates of peerStats
+constexpr uint64_t RATESAMPLE = 256 * 1024;     // reads this large measure throughput, smaller ones latency
+constexpr uint64_t BROKENPENALTY = 1000 * 1000; // microseconds added to a node whose last read broke off
+constexpr uint64_t BROKENFOR = 10 * 1000 * 1000;    // and for how long
+constexpr double SLOWREPLICA = 4;               // a replica this much slower than the best reads no range
+constexpr size_t LISTPAGE = 4096;               // bytes of file names sent per page of a listing
+constexpr size_t CLIENTSTREAMS = 16;            // operations of the async calls running at the same time
+constexpr int CODEDDATA = 6;                    // data fragments of an erasure coded file
+constexpr int CODEDPARITY = 3;                  // parity fragments, any CODEDDATA fragments rebuild the file
+constexpr uint64_t CODEDMIN = 1024 * 1024;      // smaller files are replicated in the coded layout as well
+const string CODEDMAGIC = "#sdfs-coded 1";      // first line of the manifest of an erasure coded file
+constexpr char LAYOUTWHOLE = 'W';               // layout of a file stored as it is
+constexpr char LAYOUTBLOCKS = 'B';              // the stored file is the block manifest of a striped file
+constexpr char LAYOUTCODED = 'C';               // the stored file is the manifest of an erasure coded file
+constexpr size_t WRITEQUORUM = 2;               // replicas that must have a PUT before it returns
+constexpr size_t READQUORUM = 1;                // replicas asked for their version before a GET reads
+constexpr int STALETRIES = 3;                   // times a PUT that lost to a newer version is stored again
+constexpr uint32_t GROUPCOMMITMS = 5;           // files stored within this window are synced together
+constexpr size_t GROUPCOMMITFILES = 256;        // a group this large is synced right away
+constexpr size_t SYNCFSFILES = 32;              // groups this large are synced with one syncfs
+const string STOREROOT = "#sdfs.store";         // stored files live under here, never in the working directory
+constexpr unsigned STOREFANOUT = 256;           // subdirectories of every level of STOREROOT
+constexpr uint64_t DIRECTMIN = 16 * 1024 * 1024;  // smaller files are never written with O_DIRECT
 
 class failureDetector;  // forward declaration
 
 
+/*
+ * Where the blocks of a striped file live. It is stored in sdfs under the name of the
+ * file as text: MANIFESTMAGIC, a line with length and block size, then a line with
+ * name and length for every block. Each block is placed by location() like any file.
+ *
+ */
+struct blockManifest {
+    uint64_t length;
+    uint64_t blockSize;
+    vector<pair<string, uint64_t>> blocks;
+};
+
+
+/*
+ * Where the fragments of an erasure coded file live, stored in sdfs under the name of
+ * the file as text: CODEDMAGIC, a line with length, fragment size and the number of data
+ * and parity fragments, then a line with name and node for every fragment, data first.
+ * Data fragment i holds bytes [i * fragmentSize, (i + 1) * fragmentSize) of the file,
+ * the last one may be short and is read as if padded with zeros. Fragments are stored
+ * once, with label F, on distinct nodes where the ring has enough of them.
+ *
+ */
+struct codedManifest {
+    uint64_t length;
+    uint64_t fragmentSize;
+    int dataFragments;
+    int parityFragments;
+    vector<pair<string, int>> fragments;
+};
+
+
+/*
+ * Checksums of the DELTABLOCK sized blocks of a stored file, kept next to it as text:
+ * SUMSMAGIC, a line with length, modification time and block size, then one checksum
+ * in hex per line. They are rebuilt whenever length or modification time no longer
+ * match the file.
+ *
+ */
+struct blockChecksums {
+    uint64_t length;
+    uint64_t modified;
+    uint64_t blockSize;
+    vector<uint64_t> sums;
+};
+
+
+/*
+ * Outcome of an operation started with one of the async calls of sdfs, id is the
+ * number the call returned it under.
+ *
+ */
+struct sdfsReply {
+    uint64_t id;
+    bool ok;
+    vector<pair<int, char>> replicas;  // nodes storing the file and their labels, for locate
+    vector<uint64_t> versions;         // version of the file at each of them
+};
+
+
 /*
  * This class implements a Simple Distributed File System (SDFS). Data stored in sdfs is tolerant
  * to failures of two machines at a time. Following operations are supported.
@@ -72,35 +201,157 @@ sdfs(int number, logger& logg);
  */
 void recvMessages();
 
+/*
+ * handle one request opened by another node
+ *
+ */
+void handleMessage(shared_ptr<request> req);
+
 /*
  * Store a local file in sdfs.
  * @param localName name of the file to be stored
  * @param sdfsName name of the file in sdfs
+ * @param whole store it whole whatever the layout, e.g. a maple container that is read by key
+ *
+ */
+bool storeFile(string localName, string sdfsName, bool whole = false);
+
+/*
+ * Append a local file to the end of a file in sdfs, creating it if there is none. Only
+ * the local file is sent, to the primary, which applies the appends of a file one at
+ * a time and passes each on to the other replicas in the same order.
+ * @return false if the primary could not be reached or fewer than writeQuorum copies
+ * have the appended bytes
+ *
+ */
+bool appendFile(const string& localName, const string& sdfsName);
+
+/*
+ * when set, files larger than BLOCKSIZE are striped into blocks across the ring
+ * and sdfs stores a blockManifest under their name
+ *
+ */
+bool blockLayout;
+
+/*
+ * when set, files larger than CODEDMIN are stored as CODEDDATA + CODEDPARITY Reed-Solomon
+ * fragments and sdfs stores a codedManifest under their name. Takes the place of blockLayout.
+ *
+ */
+bool codedLayout;
+
+/*
+ * when set, files are sent compressed chunk by chunk to nodes that can decode them
+ *
+ */
+bool compression;
+
+/*
+ * when set, a stored file and its metadata record are synced to disk before the writer
+ * is answered. Syncs go through commits, so files stored at about the same time share one.
+ *
+ */
+bool durable;
+
+/*
+ * when set, stored files of DIRECTMIN bytes or more are written with O_DIRECT
+ *
+ */
+bool directWrites;
+
+/*
+ * when set, files are sent with sendfile straight from the page cache and received
+ * frames are handed to the file whole (see uringFile) instead of being copied through
+ * chunk buffers. Such transfers are not compressed.
+ *
+ */
+bool zeroCopy;
+
+/*
+ * W and R: a PUT goes down the replication chain and returns once writeQuorum replicas
+ * stored it, the rest of the chain gets it in the background. A GET asks the replicas
+ * for their version, waits for readQuorum answers and reads the newest version among them.
+ *
+ */
+size_t writeQuorum;
+size_t readQuorum;
+
+/*
+ * show the blocks of a striped file or the fragments of an erasure coded file and the
+ * nodes storing them
  *
  */
-bool storeFile(string localName, string sdfsName);
+void showBlocks(string fileName);
 
 /*
- * get a local file from sdfs.
+ * get a local file from sdfs, returns once the file is on local disk. Large files are
+ * read from all replicas at once.
  * @param sdfsName name of the file stored in sdfs
  * @param localName name of the file in local directory
+ * @return false if no replica could send the file
  *
  */
-void fetchFile(string sdfsName, string localName);
+bool fetchFile(string sdfsName, string localName);
 
 /*
- * Delete a file in sdfs.
+ * get length bytes of an sdfs file from start, only those bytes are read. Of a striped
+ * or coded file only the blocks or data fragments holding the range are read.
+ * @param localName set to the range, shorter than length if the file ends before
+ * @return false if no replica could send the range
+ *
+ */
+bool fetchRange(const string& sdfsName, const string& localName, uint64_t start, uint64_t length);
+
+/*
+ * Delete a file in sdfs, returns once the primary removed it.
  * @param filename of the file stored in sdfs
+ * @return false if the primary could not be reached or did not have the file
  *
  */
-void deleteFile(string filename);
+bool deleteFile(string filename);
 
 /*
  * remove file if it is stored at this node.
  * @param filename of the file stored in sdfs
+ * @return false if this node did not store it
+ *
+ */
+bool removeFile(string filename);
+
+/*
+ * ask the nodes that should store a copy of a file for its label
+ * @param replicaVersions if given, set to the version of the file at each of them
+ * @return nodes storing the file and their labels in ring order
+ *
+ */
+vector<pair<int, char>> locateFile(const string& fileName, vector<uint64_t>* replicaVersions = nullptr);
+
+/*
+ * Async versions of storeFile, appendFile, fetchFile, fetchRange, deleteFile and locateFile. They return at
+ * once with a future of the outcome, up to CLIENTSTREAMS operations run at the same
+ * time and the rest wait in order. done, if given, is called with the outcome on the
+ * thread that ran the operation before the future is ready, id is set to the number
+ * of the operation before any of it runs.
+ *
+ */
+future<sdfsReply> putAsync(const string& localName, const string& sdfsName, uint64_t& id,
+                           function<void(const sdfsReply&)> done = nullptr);
+future<sdfsReply> appendAsync(const string& localName, const string& sdfsName, uint64_t& id,
+                              function<void(const sdfsReply&)> done = nullptr);
+future<sdfsReply> getAsync(const string& sdfsName, const string& localName, uint64_t& id,
+                           function<void(const sdfsReply&)> done = nullptr);
+future<sdfsReply> getRangeAsync(const string& sdfsName, const string& localName, uint64_t start,
+                                uint64_t length, uint64_t& id, function<void(const sdfsReply&)> done = nullptr);
+future<sdfsReply> deleteAsync(const string& sdfsName, uint64_t& id,
+                              function<void(const sdfsReply&)> done = nullptr);
+future<sdfsReply> locateAsync(const string& sdfsName, uint64_t& id,
+                              function<void(const sdfsReply&)> done = nullptr);
+
+/*
+ * show the operations of the async calls that have not completed
  *
  */
-void removeFile(string filename);
+void showOps();
 
 /*
  * update file distribution given the new successor
@@ -121,17 +372,75 @@ void handleInput();
 void showStore();
 
 /*
- * show all the nodes storing copies of a file
+ * show the outcome of an operation started from the command line, for ls the nodes
+ * storing copies of the file
+ *
+ */
+void showReply(const string& operation, const sdfsReply& reply);
+
+/*
+ * show how far re-replication after the last failure, and the hand-off of files after
+ * the last join, have come
+ *
+ */
+void showRepair();
+
+/*
+ * cap the re-replication traffic this node sends, 0 for no cap
+ * @param rate bytes per second
+ *
+ */
+void setRepairRate(uint64_t rate);
+
+/*
+ * show the files cached from other nodes, the stored files held in memory and how reads were served
+ *
+ */
+void showCache();
+
+/*
+ * show whether file transfers are compressed and how much that saved
  *
  */
-void showFileLocations(string fileName);
+void showCompression();
 
 /*
+ * turn durable stores on or off, see durable
  *
- * new Node joined
+ */
+void setDurable(bool on);
+
+/*
+ * show whether stores are durable and how well their syncs were grouped
+ *
+ */
+void showDurability();
+
+/*
+ * turn O_DIRECT writes of large files on or off, see directWrites
+ *
+ */
+void setDirectWrites(bool on);
+
+/*
+ * turn the zero-copy transfer paths on or off, see zeroCopy
+ *
+ */
+void setZeroCopy(bool on);
+
+/*
+ * print the sdfs files whose names start with dirPrefix as they arrive
+ *
+ */
+void showFileNames(const string& dirPrefix);
+
+/*
+ *
+ * new Node joined, the files it should replicate are announced to it
+ * @param joining node joined after this one, false for the members a joining node is told of
  *
  */
-void newNode(int node);
+void newNode(int node, bool joining = true);
 
 /*
  *
@@ -140,6 +449,24 @@ void newNode(int node);
  */
 void nodeFailure(int node);
 
+/*
+ * a ping of the failure detector to node came back after micros
+ *
+ */
+void peerPinged(int node, uint64_t micros);
+
+/*
+ * show how fast the other nodes answered reads, see peers
+ *
+ */
+void showPeers();
+
+/*
+ * this node joined the system, announce the files it kept from before a restart
+ *
+ */
+void joined();
+
 /*
  * instance of failureDetector
  *
@@ -168,11 +495,19 @@ void printRing();
 
 
 /*
- * successor of a node
+ * next live node by number, used to hand out maple and juice tasks. File placement
+ * goes through the hash ring instead.
  *
  */
 int successorNode(int node);
 
+/*
+ * whether node is a node number of the ring and alive. Node numbers read from a
+ * manifest are checked with this before they are used.
+ *
+ */
+bool liveNode(int node);
+
 /*
  *
  * my VM Number
@@ -181,12 +516,20 @@ int successorNode(int node);
 int myNumber;
 
 /*
- * getFileName stored in sdfs with preifx dirPrefix
- * @return a pointer to vector of fileNames
+ * getFileName stored in sdfs with preifx dirPrefix into fileNames
  *
  */
 void getFileNames(string dirPrefix);
 
+/*
+ * call found for every sdfs file whose name starts with dirPrefix. Every node streams
+ * the names it is primary of in pages of LISTPAGE bytes, so memory does not grow with
+ * the size of the listing.
+ * @return false if a node could not be asked or its reply broke off
+ *
+ */
+bool listFiles(const string& dirPrefix, const function<void(const string&)>& found);
+
 /*
  * set to store the file names recvd from other nodes
  *
@@ -195,57 +538,70 @@ set<string> fileNames;
 
 /*
  *
- * maple files to be fetched from sdfs;
+ * get all input files for juice phase
  *
  */
-unordered_set<string> mapleFiles;
-mutex mapleFilesMutex;
+void fetchJuiceInputFiles();
 
 /*
  *
- * maple files received from sdfs;
+ * juice files to be fetched from sdfs;
  *
  */
-unordered_set<string> recvdMapleFiles;
+unordered_set<string> juiceFiles;
 
 /*
- * return when all maple files are received
+ *
+ * send file to targetNode to store in sdfs. Only count bytes from start are sent if given.
  *
  */
-void recvMapleFiles();
+
+bool pushFileToNode(int targetNode, string localFile, string remoteFile, string node,
+                    uint64_t start = 0, uint64_t count = WHOLEFILE, uint64_t version = 0,
+                    char layout = LAYOUTWHOLE);
 
 /*
- *
- * get all input files for juice phase
+ * store a file on nodes through chain replication. The file is streamed once to nodes[0],
+ * which forwards it to nodes[1] and so on. codes[i] (PUTA, PUTB or PUTC) gives the label
+ * nodes[i] stores the file with. Only count bytes from start are sent if given.
+ * @param quorum copies the chain must store before it acks, the nodes after them get the file in the background
+ * @param newer set to the version a node of the chain holds if it dropped the file as older
+ * @return true when quorum nodes of the chain have acknowledged the file
  *
  */
-void fetchJuiceInputFiles();
+bool pushFileToNodes(vector<int> nodes, string localFile, string remoteFile, vector<string> codes,
+                     uint64_t start = 0, uint64_t count = WHOLEFILE, uint64_t version = 0,
+                     char layout = LAYOUTWHOLE, size_t quorum = NODES, uint64_t* newer = nullptr);
 
 /*
- *
- * juice files to be fetched from sdfs;
+ * reply STAL to a write that was dropped because newer is stored
  *
  */
-unordered_set<string> juiceFiles;
+void sendStale(request& req, uint64_t newer);
 
 /*
- *
- * send file to targetNode to store in sdfs
+ * read the ACKC of a chain, STAL sets newer to the version the write lost to
+ * @return true on ACKC
  *
  */
-
-bool pushFileToNode(int targetNode, string localFile, string remoteFile, string node);
-
-bool pushFileToNodes(vector<int> nodes, string localFile, string remoteFile, vector<string> codes);
+bool readAck(request& req, uint64_t& newer);
 
 /*
  * location of the file
  * @param filename of the file
- * @return number of node for the file based on hash function
+ * @return node owning the file on the consistent hash ring, or the node it was on while
+ * its copy is on the way to a node that joined
  *
  */
 int location(const string &filename);
 
+/*
+ * live nodes that should store sdfsName in chain order: the owner (A) and the next
+ * two distinct nodes clockwise on the hash ring (B and C)
+ *
+ */
+vector<int> replicaNodes(const string& sdfsName);
+
 /*
  *
  * send input files to juicer nodes
@@ -260,6 +616,12 @@ void sendJuiceFilesToJuicers(string prefix, int countJuices, unordered_map<int,
  */
 unordered_set<int> juiceFilesNotifications;
 
+/*
+ * expect juice input files from every node in the ring
+ *
+ */
+void expectJuiceFiles();
+
 /*
  * send delete intermediate files message
  *
@@ -282,13 +644,6 @@ void deleteIntermediateFiles(string prefix);
  */
 void createSocket();
 
-/*
- * replicate a file on successor
- * @param fileName
- *
- */
-void sendFileToSuccessor(string fileName, char label);
-
 /*
  * send file to a node
  * @param node target VM number to send file
@@ -298,205 +653,912 @@ void sendFileToSuccessor(string fileName, char label);
 void sendFile(int requestNode, string localName, string sdfsName, char label);
 
 /*
- * receive file from a buf
+ * receive file from a buf. A PUT older than the copy stored here is read and dropped.
+ * @param version set to the version the file was sent with
+ * @param fetched the file answers a GET, a block manifest is replaced by the file it describes
+ * @param newer set to the version stored here if the file was dropped because it is older
+ * @return name of the file, empty if it was dropped
  *
  */
-string recvFile(char * recvBuf, int connFd, int numBytes, int offset);
+string recvFile(char * recvBuf, request& req, int numBytes, int offset, uint64_t& version, char& layout,
+                bool fetched = false, uint64_t* newer = nullptr);
 
 /*
- * receive Juice Input files
+ * store length bytes of localName starting at start as sdfsName on its three replicas
+ * down the replication chain under a version from the primary, waiting for writeQuorum of them
+ * @param layout recorded with the file, LAYOUTBLOCKS or LAYOUTCODED for a manifest
  *
  */
-void recvJuiceFile(char * recvBuf, int connFd, int numBytes, int offset);
+bool storeReplicas(const string& localName, const string& sdfsName, uint64_t start, uint64_t length,
+                   char layout = LAYOUTWHOLE);
 
 /*
- * send files names with dirPrefix and label A
+ * the next version of fileName, handed out by its primary: one more than the version
+ * stored here, than seen and than any version this node handed out, so the versions of a
+ * file follow the order its primary saw the writes in, whatever the clocks of the writers
  *
  */
-void sendFileNames(string dirPrefix, int node);
+uint64_t newVersion(const string& fileName, uint64_t seen = 0);
 
 /*
- * send a message to all nodes to get FileNames with dirPrefix
+ * newVersion at the primary of fileName, above the newest version the read quorum of its
+ * replicas holds as well
  *
  */
-void sendGetFileNamesMessage(string dirPrefix);
+uint64_t issueVersion(const string& fileName, uint64_t seen);
 
 /*
+ * ask the primary of fileName for a new version of it with NVER
+ * @param seen a version of the file a replica holds, the new one is above it
+ * @return the version, 0 if the primary could not be reached
  *
- * send message to request input files for juice
+ */
+uint64_t requestNewVersion(const string& fileName, uint64_t seen = 0);
+
+/*
+ * reply to NVER with a new version of a file this node is the primary of
  *
  */
-void sendGetJuiceInputMessages(string prefix, int countJuices, int juiceNumber);
+void sendNewVersion(request& req, char* recvBuf, int offset);
 
 /*
+ * version of a file stored at this node, 0 if it is not stored or was written without one
  *
- * handle send juice input files
+ */
+uint64_t fileVersion(const string& fileName);
+
+/*
+ * layout of a file stored at this node, LAYOUTWHOLE if it is not stored
  *
  */
-void handleSendJuiceInputFiles(char* buf);
+char fileLayout(const string& fileName);
 
 /*
+ * layout of fileName, filesMutex must be held
  *
- * send input files for juice phase
+ */
+char layoutOf(const string& fileName);
+
+/*
+ * record the layout a stored file arrived with, filesMutex must be held
  *
  */
-void sendJuiceInputFiles(string prefix, int countJuices, unordered_map<int, int> juiceIDs);
+void setLayout(const string& fileName, char layout);
 
 /*
+ * run every task on a thread of its own
+ * @return true once needed of them succeeded, false once too many failed. Tasks that
+ * are still running carry on in the background.
  *
- * indicator to check if all juice files have been recvd.
+ */
+bool waitQuorum(const vector<function<bool()>>& tasks, size_t needed);
+
+/*
+ * ask the replicas of sdfsName for their version and wait for readQuorum answers.
+ * Replicas that answered with an older version are told to catch up.
+ * @param version set to the newest version among the answers
+ * @param layout if given, set to the layout of the file at that version
+ * @return false if fewer than readQuorum replicas have the file
  *
  */
-bool isAllJuiceFilesRecvd;
+bool readVersion(const string& sdfsName, uint64_t& version, char* layout = nullptr);
 
 /*
- * condition variable to notify that all juice files have been recvd
+ * ask node for its label and version of fileName with LABL
+ * @param label set to the label, 0 if node does not store the file
+ * @param layout if given, set to the layout of the file at node
  *
  */
-condition_variable cvJuiceFiles;
-mutex cvJuiceFilesMutex;
+bool requestLabel(int node, const string& fileName, char& label, uint64_t& version, char* layout = nullptr);
 
 /*
+ * tell node with CTCH that its copy of fileName is older than version
  *
- * handle all juice input files are sent
+ */
+void sendCatchUp(int node, const string& fileName, uint64_t version);
+
+/*
+ * the copy of fileName here is older than version, queue it for re-replication from
+ * another replica. Only the blocks that differ are sent.
  *
  */
-void handleAllJuiceFilesSent(int node);
+void catchUp(const string& fileName, uint64_t version);
 
+/*
+ * stripe localName into blocks, store every block and then the manifest as sdfsName
+ *
+ */
+bool storeBlocks(const string& localName, const string& sdfsName, uint64_t length);
 
 /*
+ * copy length bytes of localName starting at start to sdfsName on local disk
  *
- * helper method to extract fileNames from a char*
+ */
+void copyRange(const string& localName, const string& sdfsName, uint64_t start, uint64_t length);
+
+/*
+ * parse a block manifest
+ * @return false if fileName is not a manifest
  *
  */
-void recvFileNames(char* recvBuf, int senderNode);
+bool readManifest(const string& fileName, blockManifest& manifest);
 
 /*
- * send a message to delete a file
+ * write manifest to fileName
  *
  */
-void sendDeleteMessage(int node, string fileName);
+bool writeManifest(const string& fileName, const blockManifest& manifest);
 
 /*
- * send a message to get a file
+ * true if sdfsName is a block of a striped file, f#i, and not a file of its own
  *
  */
-void sendGetMessage(int requestNode, int hostNode, string sdfsName, string localName, char label);
+bool isBlock(const string& sdfsName);
 
 /*
- * send exist message in response to query message
+ * replace the manifest in localName by the blocks it lists
  *
  */
-void sendExistMessage(int node, char label);
+bool assembleBlocks(const string& localName);
 
 /*
- * send Query message to check if a file exits
+ * replace a block or coded manifest in localName by the file it describes
+ * @param layout of the file localName was fetched from, a whole file is left as it is
+ * @return false if a part of the file could not be read
  *
  */
-void sendQueryMessage(int requestNode, int hostNode, string fileName);
+bool assembleFile(const string& localName, char layout);
 
 /*
- * update file distribution after a node failure
+ * encode localName into fragments, store each of them once and then the manifest as sdfsName
  *
  */
-void updateFileDistribution();
+bool storeFragments(const string& localName, const string& sdfsName, uint64_t length);
 
+/*
+ * parse and write a coded manifest
+ * @return false if fileName is not a coded manifest
+ *
+ */
+bool readCodedManifest(const string& fileName, codedManifest& manifest);
+bool writeCodedManifest(const string& fileName, const codedManifest& manifest);
 
 /*
- * create UPDA messages containing updated file type and filenames
+ * nodes for the fragments of sdfsName, distinct ones in ring order as long as there are enough
  *
  */
-int createUpdaMsg(char* msg, vector<string>& filenames, char fileType);
+vector<int> fragmentNodes(const string& sdfsName, size_t count);
 
 /*
- * send messages to check distribution correctness of mastering files (fileA)
+ * replace the coded manifest in localName by the file, data fragments that cannot be
+ * read are rebuilt from parity
  *
  */
-void requestUpdateMasteringFiles();
+bool assembleFragments(const string& localName);
+
 /*
- * connect to server at targetNode
+ * read the fragments of manifest into parts, the data ones first and as many parity
+ * ones as fragments failed, every round at once
+ * @param present set for the fragments that were read
+ * @return false if fewer than dataFragments could be read
  *
  */
+bool readFragments(const codedManifest& manifest, const vector<string>& parts, vector<bool>& present);
 
-int connectToServer(int targetNode, int *connectionFd);
+/*
+ * rebuild the wanted fragments, which are not present in parts, from the others chunk by chunk
+ *
+ */
+bool decodeFragments(const codedManifest& manifest, const vector<string>& parts, const vector<bool>& present,
+                     const vector<bool>& wanted);
 
 /*
- * predecessor of a node
+ * store the fragment in localName as fragmentName on node
  *
  */
-int predecessorNode(int node);
+bool storeFragment(int node, const string& localName, const string& fragmentName, uint64_t start, uint64_t length);
 
+/*
+ * rebuild the fragments of the coded files this node is the primary of that were on
+ * failed nodes, store them on live nodes and the updated manifests
+ *
+ */
+void rebuildFragments();
+bool rebuildFragments(const string& sdfsName);
 
 /*
- * hash all files to update the ids, call when membership list changes
+ * read sdfsName from one of its replicas and write it to out at offset
  *
  */
-void updateFileIds();
+bool fetchBlock(const string& sdfsName, ofstream& out, uint64_t offset);
 
 /*
- * socket file descriptor
+ * write the range of a striped or coded file whose manifest is in localName to localName,
+ * reading only the blocks or data fragments that hold it
+ * @param layout LAYOUTBLOCKS or LAYOUTCODED, tells which manifest localName holds
  *
  */
-int sockFd;
+bool assembleRange(const string& localName, char layout, uint64_t start, uint64_t length);
 
 /*
- * files (and their label) stored at this machine.
+ * read length bytes of sdfsName from start with a READ request to node and write them to out
+ * @param fileLength set to the length of the whole file
+ * @param version if not 0, node only answers if it has this version of the file
  *
  */
-map<string, char> files;
+bool readRange(int node, const string& sdfsName, ofstream& out, uint64_t start, uint64_t length,
+               uint64_t& fileLength, uint64_t version = 0);
 
 /*
- * missing files (and their label) after a node failure
+ * reply to READ: DATA, length of the file and of the range as 64 bit and the range, or NFIL
+ * if the file is not stored here or has another version than the one asked for
  *
  */
-map<string, char> missingFiles;
+void sendData(request& req, const string& fileName, uint64_t start, uint64_t length, uint64_t version);
 
 /*
- * instance of logger class to write logs to the logFile
+ * the replica after this node in the chain of sdfsName
+ * @return 0 if this node is the last replica or no replica at all
  *
  */
-logger& log;
+int nextReplica(const string& sdfsName);
 
 /*
- * indicator for update thread
+ * read version of sdfsName into localName. Once the first MINRANGE bytes give its length,
+ * the rest is split into one range per replica and all ranges are read at the same time.
+ * A replica with another version refuses its range and the next replica is asked.
  *
  */
-mutex updateFileDistMutex;
+bool fetchRanges(const string& sdfsName, const string& localName, uint64_t version);
+
+/*
+ * give an operation of the async calls a number and queue it on clientWorkers. An op that throws
+ * is answered as failed
+ *
+ */
+future<sdfsReply> startOp(const string& description, uint64_t& id, function<bool(sdfsReply&)> op,
+                          function<void(const sdfsReply&)> done);
+
+/*
+ * reply to LABL with the label of a file, 0 if this node does not store it, its version
+ * and its layout
+ *
+ */
+void sendLabel(request& req, char* recvBuf, int offset);
+
+/*
+ * build the header of a file transfer.
+ * header: code, version as 64 bit, layout, sizeof(filename), sizeof(content) as 64 bit, filename
+ * @return size of the header
+ *
+ */
+int createFileHeader(char* header, const string& code, const string& remoteFile, uint64_t length,
+                     uint64_t version = 0, char layout = LAYOUTWHOLE);
+
+/*
+ * stream length bytes of path from start over req, in chunks of CHUNKSIZE or with
+ * sendfile when zeroCopy is set
+ * @param limit if given every chunk waits for its share of the bandwidth
+ *
+ */
+bool sendFileRange(request& req, const string& path, uint64_t start, uint64_t length, throttle* limit = nullptr);
+
+/*
+ * like sendFileRange for a file read by other nodes, which is sent from memory if it is hot
+ *
+ */
+bool sendStored(request& req, const string& path, uint64_t start, uint64_t length);
 
 /*
- * condition variable to notify getFileNamesThread when all files are recvd
+ * read length bytes from req and write them to wFile as they arrive
  *
  */
-condition_variable cv;
-mutex cvMutex;
+bool recvFileChunks(request& req, ostream& wFile, uint64_t length);
 
 /*
+ * read length bytes from req, forward every chunk to forward as soon as it
+ * arrives and then write it to wFile. forwarded is cleared if forward fails.
  *
- * indicator to check if all filenames have been recvd.
+ */
+bool recvFileChunks(request& req, ostream& wFile, uint64_t length, request* forward, bool& forwarded);
+
+/*
+ * build the header of a chain replicated PUT.
+ * header: CHN<label>, hops, quorum, (node, label) for every hop, sizeof(filename),
+ * sizeof(content) and version as 64 bit, layout, filename
+ * @param quorum copies the receiver and the hops after it must store before the chain acks
+ * @return size of the header
  *
  */
-bool isAllFileNamesRecvd;
+int createChainHeader(char* header, char label, const vector<int>& nodes, const vector<char>& labels,
+                      size_t quorum, const string& remoteFile, uint64_t length, uint64_t version,
+                      char layout);
 
 /*
- * condition variable to notify that all maple files have been recvd
+ * receive a file sent down a replication chain, store it with label and forward it to
+ * the next node of the chain. ACKC is sent back once the rest of the quorum has the file;
+ * the node whose copy completes the quorum acks at once and tells a next node that
+ * misses the file to catch up.
  *
  */
-condition_variable cvMapleFiles;
-mutex cvMapleFilesMutex;
+void recvChainFile(string header, request& req, char label);
 
 /*
+ * receive Juice Input files
  *
- * indicator to check if all filenames have been recvd.
+ */
+void recvJuiceFile(char * recvBuf, request& req, int numBytes, int offset);
+
+/*
+ * send files names with dirPrefix and label A in pages
  *
  */
-bool isAllMapleFilesRecvd;
+void sendFileNames(request& req, char* recvBuf, int offset);
 
 /*
  *
- * set to store the node ids to which a file name request has been sent;
+ * send message to request input files for juice
+ *
+ */
+void sendGetJuiceInputMessages(string prefix, int countJuices, int juiceNumber);
+
+/*
+ *
+ * handle send juice input files
+ *
+ */
+void handleSendJuiceInputFiles(char* buf);
+
+/*
+ *
+ * send input files for juice phase
+ *
+ */
+void sendJuiceInputFiles(string prefix, int countJuices, unordered_map<int, int> juiceIDs);
+
+/*
+ *
+ * indicator to check if all juice files have been recvd.
+ *
+ */
+bool isAllJuiceFilesRecvd;
+
+/*
+ * condition variable to notify that all juice files have been recvd
+ *
+ */
+condition_variable cvJuiceFiles;
+mutex cvJuiceFilesMutex;
+
+/*
+ * numbers the parts juice files are received in, guarded by cvJuiceFilesMutex
+ *
+ */
+uint64_t juiceParts;
+
+/*
+ *
+ * handle all juice input files are sent
+ *
+ */
+void handleAllJuiceFilesSent(int node);
+
+
+/*
+ * send a message to delete a file
+ * @param acked wait until node replied whether it removed the file
+ *
+ */
+bool sendDeleteMessage(int node, string fileName, bool acked = false);
+
+/*
+ * send a message to get a file
+ *
+ */
+void sendGetMessage(int requestNode, int hostNode, string sdfsName, string localName, char label);
+
+/*
+ * update file distribution after a node failure
+ *
+ */
+void updateFileDistribution();
+
+
+/*
+ * create UPDA messages containing updated file type and filenames
+ *
+ */
+int createUpdaMsg(char* msg, vector<string>& filenames, char fileType);
+
+/*
+ * send messages to check distribution correctness of mastering files (fileA). Every
+ * file goes with its version so a replica with an older copy fetches it again.
+ * @param onlyNode if given, only the files that node should replicate are sent
+ *
+ */
+void requestUpdateMasteringFiles(int onlyNode = 0);
+
+/*
+ * drop the copies of files this node no longer replicates once every replica has the
+ * file at the version of the copy, so a join moves data instead of adding to it. Runs in
+ * the background until no such copy is left or HANDOFFTRIES checks passed, a join while
+ * it runs makes it start over.
+ *
+ */
+void handOff();
+
+/*
+ * loop of handOff
+ *
+ */
+void runHandOff();
+
+/*
+ * remove the copy of fileName if it still has version
+ *
+ */
+bool dropCopy(const string& fileName, uint64_t version);
+
+/*
+ * fetch files missing here from source, the node that asked us to replicate them.
+ * They are split into batches of REPAIRBATCH files and up to REPAIRSTREAMS batches
+ * stream at the same time.
+ *
+ */
+void queueRepair(int source, const vector<string>& fileNames);
+
+/*
+ * fetch one batch of missing files, files source does not have are tried on
+ * their other replicas
+ *
+ */
+void repairBatch(int source, vector<string> fileNames);
+
+/*
+ * fetch fileNames from node over a single BGET request and store them as replicas
+ * @param missed set to the files that did not arrive
+ *
+ */
+void fetchBatch(int node, const vector<string>& fileNames, vector<string>& missed);
+
+/*
+ * reply to BGET: for every requested file its name, its length and version as 64 bit
+ * (length WHOLEFILE if it is not stored here), its layout and its content, sent at the pace of
+ * repairThrottle
+ *
+ */
+void sendBatch(request& req, char* recvBuf, int offset);
+
+/*
+ * tell every node with HOVR which files this node keeps serving as their primary until
+ * node, which joined in front of it, has them
+ *
+ */
+void announceHandOvers(int node);
+
+/*
+ * the copies of fileNames are here, those this node is the new primary of are taken over
+ * from the node that kept them, with OWNS to that node first and then to the others
+ *
+ */
+void takeOver(const vector<string>& fileNames);
+
+/*
+ * send HOVR or OWNS about fileNames and node to target, in messages of at most MAXDATASIZE
+ * bytes that are each answered with ACKO and the last version target handed out
+ * @param version set to the highest version target handed out
+ * @return false if target did not answer
+ *
+ */
+bool sendOwnership(int target, const string& type, int node, const vector<string>& fileNames,
+                   uint64_t* version = nullptr);
+
+/*
+ * reply to HOVR and OWNS from sender, see applyOwnership
+ *
+ */
+void recvOwnership(request& req, char* recvBuf, int sender);
+
+/*
+ * record that sender keeps serving fileNames until node has them (HOVR), or that they
+ * moved to their new primary (OWNS)
+ * @param last sender has said which files it keeps for node
+ *
+ */
+void applyOwnership(bool handOver, int sender, int node, bool last, const vector<string>& fileNames);
+
+/*
+ * whether node joined and not every node told it yet which files it keeps, handOverMutex must be held
+ *
+ */
+bool joiningNode(int node);
+
+/*
+ * a missing file is on local disk now, store it with the label UPDA gave it. It is dropped
+ * if a newer version was written here while it was on its way.
+ * @param path where the copy was received, empty if it was written to the store already
+ *
+ */
+void replicaArrived(const string& fileName, uint64_t version, char layout, const string& path = "");
+
+/*
+ * whether a version of fileName newer than version is stored here, filesMutex must be held
+ *
+ */
+bool newerStored(const string& fileName, uint64_t version);
+
+/*
+ * bring the stale copy of fileName on local disk up to date with the one on node,
+ * only the blocks whose checksums differ are sent
+ * @param transferred set to the bytes that came over the network
+ * @param version set to the version of the copy on node
+ * @param layout set to the layout of the copy on node
+ * @param synced set to the up to date copy, built next to the stale one for replicaArrived
+ * @return false if node does not have the file or the transfer broke
+ *
+ */
+bool deltaSync(int node, const string& fileName, uint64_t& transferred, uint64_t& version, char& layout,
+               string& synced);
+
+/*
+ * reply to DSYN: DLTA, length and version of the file as 64 bit, its layout, then runs of blocks, each
+ * a type (0 keep, 1 data follows), a count and for type 1 the blocks. NFIL if the file
+ * is not stored here.
+ *
+ */
+void sendDelta(request& req, char* recvBuf, int offset);
+
+/*
+ * block checksums of fileName, from its checksum file if it is still current
+ * @return false if the file does not exist
+ *
+ */
+bool loadChecksums(const string& fileName, blockChecksums& checksums);
+
+/*
+ * compute the block checksums of fileName
+ * @return false if the file does not exist
+ *
+ */
+bool computeChecksums(const string& fileName, blockChecksums& checksums);
+
+/*
+ * compute the block checksums of fileName and keep them next to it
+ *
+ */
+bool storeChecksums(const string& fileName, blockChecksums& checksums);
+
+/*
+ * fileName grew since checksums were taken, checksum only the last block of before and
+ * the new ones and keep them next to it
+ *
+ */
+void extendChecksums(const string& fileName, blockChecksums& checksums);
+
+/*
+ * write checksums to the checksum file of fileName
+ *
+ */
+void writeChecksums(const string& fileName, const blockChecksums& checksums);
+
+/*
+ * reply to APND: receive the bytes to append, apply them with appendDelta and answer
+ * APOK, APNK if fewer than writeQuorum copies have them or NFIL if this node is not
+ * the primary of the file
+ *
+ */
+void recvAppend(char* recvBuf, request& req, int numBytes, int offset);
+
+/*
+ * append deltaFile to fileName at the primary, then send it to the other replicas and
+ * wait for writeQuorum copies. deltaFile is removed once every replica has answered.
+ * @param primary set to whether this node is the primary of fileName
+ *
+ */
+bool appendDelta(const string& fileName, const string& deltaFile, bool& primary);
+
+/*
+ * the work of appendDelta once it holds the append slot of fileName
+ * @param delta the bytes to append, the file is removed when the last copy of delta goes
+ *
+ */
+bool applyAppend(const string& fileName, shared_ptr<string> delta, bool& primary);
+
+/*
+ * send the bytes appended to fileName at offset with APR<label> to a replica
+ * header: APR<label>, version and offset as 64 bit, sizeof(filename), sizeof(content)
+ * as 64 bit, filename
+ * @return true if the replica applied them
+ *
+ */
+bool pushAppend(int node, const string& deltaFile, const string& fileName, char label, uint64_t offset,
+                uint64_t version);
+
+/*
+ * reply to APR<label>: append the bytes if the copy here ends at their offset and answer
+ * APOK. A copy that missed an earlier append answers APNK and catches up.
+ *
+ */
+void recvAppendReplica(char* recvBuf, request& req, int numBytes, int offset, char label);
+
+/*
+ * checksum of a whole file recorded in the metadata store
+ *
+ */
+uint64_t fileChecksum(const blockChecksums& checksums);
+
+/*
+ * a stored file is on local disk, compute its checksums (unless given) and record it with
+ * label, version and layout. A file stored already keeps its label.
+ *
+ */
+void addFile(const string& fileName, char label, uint64_t version = 0, char layout = LAYOUTWHOLE,
+             blockChecksums* checksums = nullptr);
+
+/*
+ * fill files from the metadata store, files missing on disk or of the wrong size are dropped
+ *
+ */
+void loadFiles();
+
+/*
+ * copy sdfsName to localName from the read cache, validating the copy with the primary
+ * if its lease ran out
+ * @return false if it has to be fetched
+ *
+ */
+bool readCached(const string& sdfsName, const string& localName);
+
+/*
+ * keep the fetched file localName in the read cache if the primary still has version
+ *
+ */
+void cacheFetched(const string& sdfsName, const string& localName, uint64_t version, char layout);
+
+/*
+ * ask the primary of sdfsName for its version and a lease on it with VERS
+ * @param expiry set to the end of the lease, counted from when the request was sent
+ * @return false if the primary does not have the file
+ *
+ */
+bool requestVersion(const string& sdfsName, uint64_t& version, chrono::steady_clock::time_point& expiry);
+
+/*
+ * reply to VERS: VRSN, the version of the file as 64 bit and the lease in ms
+ * as 32 bit, NFIL if it is not stored here. Only the primary grants a lease, other
+ * replicas answer with a lease of 0 so the copy is validated on every read.
+ *
+ */
+void sendVersion(request& req, char* recvBuf, int offset);
+
+/*
+ * fileName changed or was deleted, send INVL to every node holding a lease on it and
+ * wait for their ACKI so no node reads its old copy once this returns
+ *
+ */
+void invalidateLeases(const string& fileName);
+
+/*
+ * remove a stored file and its checksums from local disk
+ *
+ */
+void removeLocalFile(const string& fileName);
+
+/*
+ * where the stored file fileName is kept: STOREROOT/xx/yy/fileName with xx and yy picked by
+ * a hash of the name, creating the directories the first time one is used. A slash, a % and
+ * a leading dot of the name are written as %2F, %25 and %2E.
+ *
+ */
+string storePath(const string& fileName);
+
+/*
+ * create or truncate path for writing length bytes and reserve them on disk, with
+ * O_DIRECT when directWrites is set and the file is large enough
+ *
+ */
+unique_ptr<ostream> createFile(const string& path, uint64_t length);
+
+/*
+ * missing files finished (or given up) and whether re-replication is now done
+ *
+ */
+void repairFinished(uint64_t files, uint64_t failed, uint64_t bytes);
+
+/*
+ * long lived connections to the sdfs servers of other nodes
+ *
+ */
+connectionManager conns;
+
+
+/*
+ * hash all files to update the ids, call when membership list changes
+ *
+ */
+void updateFileIds();
+
+/*
+ * socket file descriptor
+ *
+ */
+int sockFd;
+
+/*
+ * files (and their label) stored at this machine.
+ *
+ */
+map<string, char> files;
+
+/*
+ * missing files (and their label) after a node failure
+ *
+ */
+map<string, char> missingFiles;
+
+/*
+ * version of every stored file, and the last version this node handed out
+ *
+ */
+map<string, uint64_t> versions;
+uint64_t lastVersion;
+
+/*
+ * layout of every stored file that is the manifest of a striped or coded file, the
+ * others are whole. It is kept with the file's metadata, never read from its content.
+ *
+ */
+map<string, char> layouts;
+
+/*
+ * guards files, missingFiles, versions and layouts, requests are handled by several workers at once
+ *
+ */
+mutex filesMutex;
+
+/*
+ * notified when files leave missingFiles, fetched or given up
+ *
+ */
+condition_variable filesArrived;
+
+/*
+ * files, their label, size, checksum and version on disk so that a restarted node knows what it stores
+ *
+ */
+metadataStore meta;
+
+/*
+ * files fetched from other nodes
+ *
+ */
+readCache cache;
+
+/*
+ * stored files read often, served from memory
+ *
+ */
+hotCache hot;
+
+/*
+ * latency, throughput and load of the other nodes, reads go to the fastest replica
+ *
+ */
+peerStats peers;
+
+/*
+ * syncs the files of durable stores in groups
+ *
+ */
+groupCommit commits;
+
+/*
+ * directories of STOREROOT known to exist, STOREFANOUT per level
+ *
+ */
+vector<bool> storeDirs;
+mutex storeDirsMutex;
+
+/*
+ * nodes holding a lease on a file this node is the primary of, and when it ends.
+ * A new primary after a failure starts without leases, the old ones run out within LEASEMS.
+ *
+ */
+map<string, map<int, chrono::steady_clock::time_point>> leases;
+mutex leaseMutex;
+
+/*
+ * streams fetching missing files after a failure
+ *
+ */
+workerPool repairWorkers;
+
+/*
+ * run the operations of the async calls
+ *
+ */
+workerPool clientWorkers;
+
+/*
+ * number of the next operation of the async calls, and what the ones that have not
+ * completed are doing
+ *
+ */
+uint64_t nextOp;
+map<uint64_t, string> pendingOps;
+mutex opsMutex;
+
+/*
+ * bandwidth of the files this node sends to re-replicate them, shared by all streams
+ * so that GET and PUT traffic is not starved
+ *
+ */
+throttle repairThrottle;
+
+/*
+ * progress of re-replication since it last went idle
+ *
+ */
+uint64_t repairQueued;
+uint64_t repairDone;
+uint64_t repairFailed;
+uint64_t repairBytes;
+chrono::steady_clock::time_point repairStart;
+chrono::steady_clock::time_point repairEnd;
+mutex repairMutex;
+
+/*
+ * copies this node dropped after a join moved their files to other nodes, and those
+ * whose new replicas do not all have them yet
+ *
+ */
+uint64_t handedOff;
+uint64_t handOffPending;
+bool handingOff;
+bool handOffAgain;
+mutex handOffMutex;
+
+/*
+ * instance of logger class to write logs to the logFile
+ *
+ */
+logger& log;
+
+/*
+ * consistent hash ring of the live nodes placing every file
+ *
+ */
+hashRing placement;
+
+/*
+ * indicator for update thread
+ *
+ */
+mutex updateFileDistMutex;
+
+/*
+ * files that moved to a node that joined and the node they were on, which stays their
+ * primary until their copy reached the new one, see location
+ *
+ */
+map<string, int> handOvers;
+
+/*
+ * nodes that joined and the nodes that were up when they did. The files of a joined node
+ * stay where they were until each of those said with HOVR which of them it keeps
+ *
+ */
+map<int, set<int>> joiningNodes;
+map<int, set<int>> handOversHeard;
+mutex handOverMutex;
+
+/*
+ * files an append is being applied to, the next append of a file waits for appendDone
  *
  */
-set<int> fileNameRequestSent;
+set<string> appending;
+mutex appendMutex;
+condition_variable appendDone;
 
 };
 
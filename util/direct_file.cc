@@ -0,0 +1,120 @@
+/*
+ * @file direct_file.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "direct_file.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+
+
+directBuf::directBuf()
+: direct{false}, fd{-1}, buffer{nullptr}, used{0}, failed{false} {
+}
+
+
+directBuf::~directBuf() {
+    close();
+    free(buffer);
+}
+
+
+bool directBuf::open(const string& fileName) {
+    close();
+    if (!buffer && posix_memalign(reinterpret_cast<void**>(&buffer), DIRECTALIGN, DIRECTBUFFER) != 0) {
+        buffer = nullptr;
+        return false;
+    }
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    direct = fd >= 0;
+    if (fd < 0 && errno == EINVAL) {
+        fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    used = 0;
+    failed = false;
+    return fd >= 0;
+}
+
+
+bool directBuf::close() {
+    if (fd < 0) {
+        return !failed;
+    }
+    // whole blocks still go direct, the tail cannot
+    drain(used - used % DIRECTALIGN);
+    if (used > 0 && direct) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    }
+    drain(used);
+    ::close(fd);
+    fd = -1;
+    return !failed;
+}
+
+
+int directBuf::overflow(int c) {
+    if (c == traits_type::eof()) {
+        return traits_type::not_eof(c);
+    }
+    char byte = c;
+    return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+}
+
+
+streamsize directBuf::xsputn(const char* s, streamsize n) {
+    if (fd < 0 || failed) {
+        return 0;
+    }
+    streamsize copied = 0;
+    while (copied < n) {
+        auto room = min(static_cast<size_t>(n - copied), DIRECTBUFFER - used);
+        memcpy(buffer + used, s + copied, room);
+        used += room;
+        copied += room;
+        if (used == DIRECTBUFFER && !drain(used)) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+
+bool directBuf::drain(size_t length) {
+    if (length == 0) {
+        return !failed;
+    }
+    if (!failed && !writeAll(fd, buffer, length)) {
+        failed = true;
+    }
+    memmove(buffer, buffer + length, used - length);
+    used -= length;
+    return !failed;
+}
+
+
+directFile::directFile()
+: ostream(&buf) {
+    setstate(ios::badbit);
+}
+
+
+directFile::~directFile() {
+    close();
+}
+
+
+void directFile::open(const string& fileName) {
+    if (buf.open(fileName)) {
+        clear();
+    } else {
+        setstate(ios::failbit);
+    }
+}
+
+
+void directFile::close() {
+    if (!buf.close()) {
+        setstate(ios::badbit);
+    }
+}
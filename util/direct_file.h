@@ -0,0 +1,102 @@
+/*
+ * @file direct_file.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+constexpr size_t DIRECTALIGN = 4096;            // O_DIRECT writes are made of blocks this large
+constexpr size_t DIRECTBUFFER = 1024 * 1024;    // bytes collected before they are written
+
+
+/*
+ * Writes a file with O_DIRECT, past the page cache, for large sequential writes that
+ * would otherwise push everything else out of it. Bytes are collected in an aligned
+ * buffer and written DIRECTBUFFER at a time; the tail that does not fill a block is
+ * written without O_DIRECT when the file is closed. Where the file system does not
+ * support O_DIRECT the file is written the usual way.
+ *
+ */
+class directBuf : public streambuf {
+
+public:
+
+directBuf();
+
+~directBuf();
+
+/*
+ * create or truncate fileName
+ * @return false if it cannot be opened
+ *
+ */
+bool open(const string& fileName);
+
+/*
+ * write what is left and close the file
+ * @return false if some write failed
+ *
+ */
+bool close();
+
+/*
+ * true if the file was opened with O_DIRECT
+ *
+ */
+bool direct;
+
+protected:
+
+int overflow(int c) override;
+
+streamsize xsputn(const char* s, streamsize n) override;
+
+private:
+
+/*
+ * write the first length bytes of the buffer and move the rest to its start
+ *
+ */
+bool drain(size_t length);
+
+int fd;
+
+char* buffer;
+
+size_t used;
+
+bool failed;
+};
+
+
+/*
+ * output stream over a directBuf
+ *
+ */
+class directFile : public ostream {
+
+public:
+
+directFile();
+
+~directFile();
+
+void open(const string& fileName);
+
+void close();
+
+private:
+
+directBuf buf;
+};
@@ -0,0 +1,188 @@
+/*
+ * @file lz.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "lz.h"
+
+constexpr int HASHBITS = 12;            // positions remembered while looking for matches
+constexpr size_t MINMATCH = 4;
+constexpr size_t MAXOFFSET = 65535;
+constexpr size_t LASTLITERALS = 5;      // a block always ends with a few literals
+constexpr int SKIPSTRENGTH = 6;         // after 2^SKIPSTRENGTH misses the search takes larger steps
+
+
+static uint32_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+
+static uint32_t hashOf(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASHBITS);
+}
+
+
+/*
+ * the length bytes that follow a nibble of 15
+ *
+ */
+static bool putLength(char*& op, const char* end, size_t length) {
+    while (length >= 255) {
+        if (op >= end) {
+            return false;
+        }
+        *op++ = static_cast<char>(255);
+        length -= 255;
+    }
+    if (op >= end) {
+        return false;
+    }
+    *op++ = static_cast<char>(length);
+    return true;
+}
+
+
+static bool getLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+
+/*
+ * write a sequence, matchLength 0 for the last one
+ *
+ */
+static bool putSequence(char*& op, const char* end, const char* literals, size_t literalLength,
+                        size_t offset, size_t matchLength) {
+    if (op >= end) {
+        return false;
+    }
+    size_t extraMatch = matchLength > 0 ? matchLength - MINMATCH : 0;
+    char* token = op++;
+    *token = static_cast<char>((min(literalLength, static_cast<size_t>(15)) << 4) |
+                               min(extraMatch, static_cast<size_t>(15)));
+    if (literalLength >= 15 && !putLength(op, end, literalLength - 15)) {
+        return false;
+    }
+    if (static_cast<size_t>(end - op) < literalLength) {
+        return false;
+    }
+    memcpy(op, literals, literalLength);
+    op += literalLength;
+
+    if (matchLength == 0) {
+        return true;
+    }
+    if (end - op < 2) {
+        return false;
+    }
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    return extraMatch < 15 || putLength(op, end, extraMatch - 15);
+}
+
+
+size_t lzBound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+
+size_t lzCompress(const char* src, size_t len, char* dst, size_t capacity) {
+    uint32_t table[1 << HASHBITS] = {};  // position + 1 of the last place a hash was seen
+    const char* end = src + len;
+    const char* anchor = src;
+    const char* ip = src;
+    char* op = dst;
+    const char* opEnd = dst + capacity;
+    size_t misses = 0;
+
+    while (len >= MINMATCH + LASTLITERALS && ip + MINMATCH + LASTLITERALS <= end) {
+        auto hash = hashOf(read32(ip));
+        auto candidate = table[hash];
+        table[hash] = ip - src + 1;
+
+        const char* match = src + candidate - 1;
+        if (candidate == 0 || static_cast<size_t>(ip - match) > MAXOFFSET || read32(match) != read32(ip)) {
+            ip += 1 + (misses++ >> SKIPSTRENGTH);
+            continue;
+        }
+        misses = 0;
+
+        size_t matchLength = MINMATCH;
+        while (ip + matchLength < end - LASTLITERALS && ip[matchLength] == match[matchLength]) {
+            matchLength++;
+        }
+        if (!putSequence(op, opEnd, anchor, ip - anchor, ip - match, matchLength)) {
+            return 0;
+        }
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    if (!putSequence(op, opEnd, anchor, end - anchor, 0, 0)) {
+        return 0;
+    }
+    return op - dst;
+}
+
+
+bool lzDecompress(const char* src, size_t len, char* dst, size_t rawLen) {
+    auto ip = reinterpret_cast<const uint8_t*>(src);
+    auto end = ip + len;
+    char* op = dst;
+    char* opEnd = dst + rawLen;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !getLength(ip, end, literalLength)) {
+            return false;
+        }
+        if (static_cast<size_t>(end - ip) < literalLength || static_cast<size_t>(opEnd - op) < literalLength) {
+            return false;
+        }
+        memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        if (ip == end) {    // the last sequence has no match
+            break;
+        }
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !getLength(ip, end, matchLength)) {
+            return false;
+        }
+        matchLength += MINMATCH;
+
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+            static_cast<size_t>(opEnd - op) < matchLength) {
+            return false;
+        }
+        // matches may overlap the bytes they produce, those are copied forward one at a time
+        const char* match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+        } else {
+            for (size_t i = 0; i < matchLength; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += matchLength;
+    }
+    return op == opEnd;
+}
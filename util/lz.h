@@ -0,0 +1,42 @@
+/*
+ * @file lz.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+/*
+ * Byte oriented LZ77 block codec in the spirit of LZ4, fast enough to run on every
+ * chunk of a file transfer. A block is a list of sequences: a token (high 4 bits
+ * literal count, low 4 bits match length - 4, 15 means more length bytes of up to
+ * 255 follow), the literals, then a 16 bit little endian offset back into the output
+ * and the extra match length bytes. The last sequence has literals only.
+ *
+ */
+
+/*
+ * largest block lzCompress can produce for len bytes
+ *
+ */
+size_t lzBound(size_t len);
+
+/*
+ * compress len bytes of src into dst
+ * @return size of the block, 0 if it does not fit in capacity
+ *
+ */
+size_t lzCompress(const char* src, size_t len, char* dst, size_t capacity);
+
+/*
+ * decompress a block of len bytes into exactly rawLen bytes of dst
+ * @return false if the block is corrupt or does not decode to rawLen bytes
+ *
+ */
+bool lzDecompress(const char* src, size_t len, char* dst, size_t rawLen);
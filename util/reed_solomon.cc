@@ -0,0 +1,283 @@
+/*
+ * @file reed_solomon.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "reed_solomon.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF_X86 1
+#endif
+
+constexpr unsigned GFPOLY = 0x11d;
+
+
+/*
+ * log, exp and product tables, built once
+ *
+ */
+struct gfTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+
+    gfTables() {
+        unsigned x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp[i] = exp[i + 255] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= GFPOLY;
+            }
+        }
+        exp[510] = exp[511] = 0;
+        log[0] = 0;
+        for (int a = 0; a < 256; a++) {
+            for (int b = 0; b < 256; b++) {
+                mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+            }
+        }
+    }
+};
+
+
+static const gfTables& tables() {
+    static gfTables t;
+    return t;
+}
+
+
+uint8_t gfMul(uint8_t a, uint8_t b) {
+    return tables().mul[a][b];
+}
+
+
+uint8_t gfInverse(uint8_t a) {
+    return a == 0 ? 0 : tables().exp[255 - tables().log[a]];
+}
+
+
+static void mulAddScalar(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    auto row = tables().mul[c];
+    for (size_t i = 0; i < len; i++) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+
+#ifdef GF_X86
+__attribute__((target("ssse3")))
+static void mulAddSsse3(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    auto row = tables().mul[c];
+    uint8_t low[16], high[16];
+    for (int i = 0; i < 16; i++) {
+        low[i] = row[i];
+        high[i] = row[i << 4];
+    }
+    auto lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low));
+    auto highTable = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high));
+    auto mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        auto lo = _mm_and_si128(in, mask);
+        auto hi = _mm_and_si128(_mm_srli_epi64(in, 4), mask);
+        auto product = _mm_xor_si128(_mm_shuffle_epi8(lowTable, lo), _mm_shuffle_epi8(highTable, hi));
+        auto out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(out, product));
+    }
+    mulAddScalar(c, src + i, dst + i, len - i);
+}
+
+
+__attribute__((target("avx2")))
+static void mulAddAvx2(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    auto row = tables().mul[c];
+    uint8_t low[16], high[16];
+    for (int i = 0; i < 16; i++) {
+        low[i] = row[i];
+        high[i] = row[i << 4];
+    }
+    auto lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low)));
+    auto highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(high)));
+    auto mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        auto lo = _mm256_and_si256(in, mask);
+        auto hi = _mm256_and_si256(_mm256_srli_epi64(in, 4), mask);
+        auto product = _mm256_xor_si256(_mm256_shuffle_epi8(lowTable, lo), _mm256_shuffle_epi8(highTable, hi));
+        auto out = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(out, product));
+    }
+    mulAddScalar(c, src + i, dst + i, len - i);
+}
+#endif
+
+
+typedef void (*mulAddKernel)(uint8_t, const uint8_t*, uint8_t*, size_t);
+
+
+static mulAddKernel pickKernel(const char*& name) {
+#ifdef GF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return mulAddAvx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        name = "ssse3";
+        return mulAddSsse3;
+    }
+#endif
+    name = "scalar";
+    return mulAddScalar;
+}
+
+
+static const char* kernelName;
+static const mulAddKernel kernel = pickKernel(kernelName);
+
+
+void gfMulAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len) {
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (size_t i = 0; i < len; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    kernel(c, src, dst, len);
+}
+
+
+const char* gfKernel() {
+    return kernelName;
+}
+
+
+reedSolomon::reedSolomon(int dataShards, int parityShards)
+: dataShards{dataShards}, parityShards{parityShards},
+  parityRows(parityShards, vector<uint8_t>(dataShards)) {
+    for (int i = 0; i < parityShards; i++) {
+        for (int j = 0; j < dataShards; j++) {
+            parityRows[i][j] = gfInverse((dataShards + i) ^ j);
+        }
+    }
+}
+
+
+void reedSolomon::encode(const vector<const uint8_t*>& data, const vector<uint8_t*>& parity, size_t len) {
+    for (int i = 0; i < parityShards; i++) {
+        memset(parity[i], 0, len);
+        for (int j = 0; j < dataShards; j++) {
+            gfMulAdd(parityRows[i][j], data[j], parity[i], len);
+        }
+    }
+}
+
+
+bool reedSolomon::reconstruct(const vector<uint8_t*>& shards, const vector<bool>& present, size_t len, bool parity) {
+    vector<int> used;
+    auto matrix = decodeMatrix(present, used);
+    if (!matrix) {
+        return false;
+    }
+
+    // missing data shards are rows of the inverse times the shards used
+    for (int j = 0; j < dataShards; j++) {
+        if (present[j]) {
+            continue;
+        }
+        memset(shards[j], 0, len);
+        for (int r = 0; r < dataShards; r++) {
+            gfMulAdd((*matrix)[j][r], shards[used[r]], shards[j], len);
+        }
+    }
+    // missing parity is encoded again from the complete data
+    for (int i = 0; i < parityShards && parity; i++) {
+        if (present[dataShards + i]) {
+            continue;
+        }
+        auto out = shards[dataShards + i];
+        memset(out, 0, len);
+        for (int j = 0; j < dataShards; j++) {
+            gfMulAdd(parityRows[i][j], shards[j], out, len);
+        }
+    }
+    return true;
+}
+
+
+const vector<vector<uint8_t>>* reedSolomon::decodeMatrix(const vector<bool>& present, vector<int>& used) {
+    // the rows of the encoding matrix of the first dataShards shards present
+    vector<vector<uint8_t>> matrix;
+    for (int i = 0; i < dataShards + parityShards && static_cast<int>(used.size()) < dataShards; i++) {
+        if (!present[i]) {
+            continue;
+        }
+        used.push_back(i);
+        if (i < dataShards) {
+            vector<uint8_t> row(dataShards, 0);
+            row[i] = 1;
+            matrix.push_back(row);
+        } else {
+            matrix.push_back(parityRows[i - dataShards]);
+        }
+    }
+
+    // entries are never removed, the matrix stays where it is once built
+    lock_guard<mutex> lk(decodeMutex);
+    auto it = decodeMatrices.find(present);
+    if (it == decodeMatrices.end()) {
+        if (static_cast<int>(used.size()) < dataShards || !invert(matrix)) {
+            matrix.clear();
+        }
+        it = decodeMatrices.emplace(present, matrix).first;
+    }
+    return it->second.empty() ? nullptr : &it->second;
+}
+
+
+bool reedSolomon::invert(vector<vector<uint8_t>>& matrix) {
+    int n = matrix.size();
+    vector<vector<uint8_t>> inverse(n, vector<uint8_t>(n, 0));
+    for (int i = 0; i < n; i++) {
+        inverse[i][i] = 1;
+    }
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        while (pivot < n && matrix[pivot][col] == 0) {
+            pivot++;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        swap(matrix[col], matrix[pivot]);
+        swap(inverse[col], inverse[pivot]);
+
+        auto scale = gfInverse(matrix[col][col]);
+        for (int k = 0; k < n; k++) {
+            matrix[col][k] = gfMul(matrix[col][k], scale);
+            inverse[col][k] = gfMul(inverse[col][k], scale);
+        }
+        for (int row = 0; row < n; row++) {
+            auto factor = matrix[row][col];
+            if (row == col || factor == 0) {
+                continue;
+            }
+            for (int k = 0; k < n; k++) {
+                matrix[row][k] ^= gfMul(factor, matrix[col][k]);
+                inverse[row][k] ^= gfMul(factor, inverse[col][k]);
+            }
+        }
+    }
+    matrix.swap(inverse);
+    return true;
+}
@@ -0,0 +1,105 @@
+/*
+ * @file reed_solomon.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d).
+ * Addition is xor, products come from log and exp tables.
+ *
+ */
+uint8_t gfMul(uint8_t a, uint8_t b);
+uint8_t gfInverse(uint8_t a);
+
+/*
+ * dst[i] ^= c * src[i] for len bytes. Runs 32 bytes at a time with AVX2 or 16 with
+ * SSSE3 when the processor has them (products of the low and high nibble of every
+ * byte are looked up with a byte shuffle), one byte at a time from a product table
+ * otherwise. The kernel is picked on the first call.
+ *
+ */
+void gfMulAdd(uint8_t c, const uint8_t* src, uint8_t* dst, size_t len);
+
+/*
+ * name of the kernel gfMulAdd runs with: avx2, ssse3 or scalar
+ *
+ */
+const char* gfKernel();
+
+
+/*
+ * Systematic Reed-Solomon code of dataShards data shards and parityShards parity shards
+ * of equal length. Parity shard i is the sum of c(i, j) * data shard j with a Cauchy
+ * matrix c(i, j) = 1 / ((dataShards + i) ^ j), every square submatrix of which is
+ * invertible, so any dataShards of the shards are enough to rebuild the others.
+ *
+ */
+class reedSolomon {
+
+public:
+
+reedSolomon(int dataShards, int parityShards);
+
+/*
+ * compute parity from data, len bytes of every shard
+ *
+ */
+void encode(const vector<const uint8_t*>& data, const vector<uint8_t*>& parity, size_t len);
+
+/*
+ * rebuild the shards that are not present from the ones that are, len bytes of every
+ * shard. shards has dataShards + parityShards entries, data first.
+ * @param parity rebuild missing parity shards as well, not only data
+ * @return false if fewer than dataShards shards are present
+ *
+ */
+bool reconstruct(const vector<uint8_t*>& shards, const vector<bool>& present, size_t len, bool parity = true);
+
+const int dataShards;
+const int parityShards;
+
+private:
+
+/*
+ * the inverse of the encoding rows of the first dataShards shards present, inverted on
+ * the first call for a pattern of present shards and reused for every later chunk
+ * @param used set to the shards the rows belong to
+ * @return nullptr if fewer than dataShards shards are present
+ *
+ */
+const vector<vector<uint8_t>>* decodeMatrix(const vector<bool>& present, vector<int>& used);
+
+/*
+ * invert a square matrix in place by Gauss-Jordan elimination
+ * @return false if it is singular
+ *
+ */
+static bool invert(vector<vector<uint8_t>>& matrix);
+
+/*
+ * rows of the parity shards, parityShards x dataShards
+ *
+ */
+vector<vector<uint8_t>> parityRows;
+
+/*
+ * decode matrices by the shards present when they were built, an empty matrix for a
+ * pattern that cannot be decoded
+ *
+ */
+map<vector<bool>, vector<vector<uint8_t>>> decodeMatrices;
+
+mutex decodeMutex;
+};
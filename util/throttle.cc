@@ -0,0 +1,52 @@
+/*
+ * @file throttle.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "throttle.h"
+
+
+throttle::throttle(uint64_t rate)
+: rate{rate}, tokens{static_cast<double>(rate)}, lastRefill{chrono::steady_clock::now()} {
+}
+
+
+void throttle::acquire(uint64_t bytes) {
+    chrono::duration<double> wait;
+    {
+        lock_guard<mutex> lk(rateMutex);
+        if (rate == 0) {
+            return;
+        }
+        refill();
+        // take the tokens now so that concurrent callers queue up behind each other
+        tokens -= bytes;
+        if (tokens >= 0) {
+            return;
+        }
+        wait = chrono::duration<double>(-tokens / rate);
+    }
+    this_thread::sleep_for(wait);
+}
+
+
+void throttle::setRate(uint64_t rate) {
+    lock_guard<mutex> lk(rateMutex);
+    refill();
+    this->rate = rate;
+    tokens = min(tokens, static_cast<double>(rate));
+}
+
+
+uint64_t throttle::getRate() {
+    lock_guard<mutex> lk(rateMutex);
+    return rate;
+}
+
+
+void throttle::refill() {
+    auto now = chrono::steady_clock::now();
+    chrono::duration<double> elapsed = now - lastRefill;
+    lastRefill = now;
+    tokens = min(tokens + elapsed.count() * rate, static_cast<double>(rate));
+}
@@ -0,0 +1,66 @@
+/*
+ * @file throttle.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+
+/*
+ * Token bucket shared by every transfer of one kind. Each byte sent takes a token,
+ * tokens come back at rate bytes per second and at most one second of them is saved
+ * up, so all transfers together stay under rate however many run at once.
+ *
+ */
+class throttle {
+
+public:
+
+/*
+ * @param rate bytes per second, 0 for no limit
+ *
+ */
+throttle(uint64_t rate);
+
+/*
+ * wait until bytes may be sent
+ *
+ */
+void acquire(uint64_t bytes);
+
+/*
+ * change the limit, 0 for no limit
+ *
+ */
+void setRate(uint64_t rate);
+
+uint64_t getRate();
+
+private:
+
+/*
+ * add the tokens earned since the last refill, rateMutex must be held
+ *
+ */
+void refill();
+
+uint64_t rate;
+
+/*
+ * tokens available now, negative while transfers wait for their share
+ *
+ */
+double tokens;
+
+chrono::steady_clock::time_point lastRefill;
+
+mutex rateMutex;
+};
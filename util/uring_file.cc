@@ -0,0 +1,261 @@
+/*
+ * @file uring_file.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "uring_file.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+
+
+uringBuf::uringBuf()
+: fd{-1}, offset{0}, failed{false}, ringFd{-1}, sqRing{MAP_FAILED}, cqRing{MAP_FAILED}, sqRingSize{0},
+  cqRingSize{0}, sqes{static_cast<io_uring_sqe*>(MAP_FAILED)}, sqesSize{0}, inFlight{0} {
+}
+
+
+uringBuf::~uringBuf() {
+    close();
+    teardownRing();
+}
+
+
+bool uringBuf::supported() {
+    static bool ringWorks = [] {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int probe = syscall(__NR_io_uring_setup, 1, &params);
+        if (probe < 0) {
+            return false;
+        }
+        ::close(probe);
+        return true;
+    }();
+    return ringWorks;
+}
+
+
+bool uringBuf::open(const string& fileName) {
+    close();
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    offset = 0;
+    failed = false;
+    if (fd >= 0 && ringFd < 0 && supported()) {
+        setupRing();
+    }
+    return fd >= 0;
+}
+
+
+bool uringBuf::close() {
+    if (fd < 0) {
+        return !failed;
+    }
+    while (inFlight > 0) {
+        reap(inFlight);
+    }
+    ::close(fd);
+    fd = -1;
+    return !failed;
+}
+
+
+bool uringBuf::setupRing() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, URINGDEPTH, &params);
+    if (ringFd < 0) {
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+        IORING_OFF_SQ_RING);
+    cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ringFd, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ringFd, IORING_OFF_SQES));
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        teardownRing();
+        return false;
+    }
+
+    auto sq = static_cast<char*>(sqRing);
+    auto cq = static_cast<char*>(cqRing);
+    sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    unsigned depth = min(params.sq_entries, URINGDEPTH);
+    buffers.assign(depth, string());
+    offsets.assign(depth, 0);
+    freeSlots.clear();
+    for (unsigned slot = 0; slot < depth; slot++) {
+        freeSlots.push_back(slot);
+    }
+    return true;
+}
+
+
+void uringBuf::teardownRing() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    sqRing = cqRing = MAP_FAILED;
+    if (ringFd >= 0) {
+        ::close(ringFd);
+        ringFd = -1;
+    }
+}
+
+
+bool uringBuf::writeBuffer(string&& buffer) {
+    if (fd < 0 || failed) {
+        return false;
+    }
+    if (buffer.empty()) {
+        return true;
+    }
+    if (ringFd < 0) {
+        if (pwrite(fd, buffer.data(), buffer.size(), offset) != static_cast<ssize_t>(buffer.size())) {
+            // a short pwrite of a regular file means the disk is full or failing
+            failed = true;
+            return false;
+        }
+        offset += buffer.size();
+        return true;
+    }
+
+    if (freeSlots.empty()) {
+        reap(1);
+    }
+    auto slot = freeSlots.back();
+    freeSlots.pop_back();
+    buffers[slot] = move(buffer);
+    offsets[slot] = offset;
+    offset += buffers[slot].size();
+
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    auto sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffers[slot].data());
+    sqe->len = buffers[slot].size();
+    sqe->off = offsets[slot];
+    sqe->user_data = slot;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    inFlight++;
+
+    if (syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, nullptr, 0) < 0) {
+        // never submitted, it will not complete
+        inFlight--;
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        finishWrite(slot, 0);
+    }
+    return !failed;
+}
+
+
+void uringBuf::reap(unsigned minComplete) {
+    while (syscall(__NR_io_uring_enter, ringFd, 0, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+            && errno == EINTR) {
+    }
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        auto& cqe = cqes[head & *cqMask];
+        finishWrite(cqe.user_data, cqe.res);
+        inFlight--;
+        head++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+
+void uringBuf::finishWrite(unsigned slot, int64_t written) {
+    // short writes and kernels without IORING_OP_WRITE are finished synchronously
+    auto& buffer = buffers[slot];
+    size_t done = max(written, static_cast<int64_t>(0));
+    while (!failed && done < buffer.size()) {
+        auto numWritten = pwrite(fd, buffer.data() + done, buffer.size() - done, offsets[slot] + done);
+        if (numWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numWritten <= 0) {
+            failed = true;
+        } else {
+            done += numWritten;
+        }
+    }
+    buffer = string();
+    freeSlots.push_back(slot);
+}
+
+
+int uringBuf::overflow(int c) {
+    if (c == traits_type::eof()) {
+        return traits_type::not_eof(c);
+    }
+    char byte = c;
+    return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+}
+
+
+streamsize uringBuf::xsputn(const char* s, streamsize n) {
+    return writeBuffer(string(s, n)) ? n : 0;
+}
+
+
+uringFile::uringFile()
+: ostream(&buf) {
+    setstate(ios::badbit);
+}
+
+
+uringFile::~uringFile() {
+    close();
+}
+
+
+void uringFile::open(const string& fileName) {
+    if (buf.open(fileName)) {
+        clear();
+    } else {
+        setstate(ios::failbit);
+    }
+}
+
+
+void uringFile::close() {
+    if (!buf.close()) {
+        setstate(ios::badbit);
+    }
+}
+
+
+void uringFile::writeBuffer(string&& buffer) {
+    if (!buf.writeBuffer(std::move(buffer))) {
+        setstate(ios::badbit);
+    }
+}
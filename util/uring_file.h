@@ -0,0 +1,169 @@
+/*
+ * @file uring_file.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+constexpr unsigned URINGDEPTH = 8;              // writes a file keeps in flight
+
+
+/*
+ * Writes a file from whole buffers that it takes over, e.g. frames as they come off a
+ * connection, so nothing is copied into a stream buffer on the way. With io_uring the
+ * writes are queued to the kernel and up to URINGDEPTH of them are in flight while the
+ * caller receives the next frames; where io_uring is not available (old kernels,
+ * seccomp filters) every buffer is written with pwrite instead.
+ *
+ */
+class uringBuf : public streambuf {
+
+public:
+
+uringBuf();
+
+~uringBuf();
+
+/*
+ * create or truncate fileName
+ * @return false if it cannot be opened
+ *
+ */
+bool open(const string& fileName);
+
+/*
+ * wait for the writes in flight and close the file
+ * @return false if some write failed
+ *
+ */
+bool close();
+
+/*
+ * append buffer to the file, the buffer is owned by the file until it is written
+ * @return false if a write failed
+ *
+ */
+bool writeBuffer(string&& buffer);
+
+/*
+ * true if io_uring can be used in this process
+ *
+ */
+static bool supported();
+
+protected:
+
+int overflow(int c) override;
+
+streamsize xsputn(const char* s, streamsize n) override;
+
+private:
+
+/*
+ * set up the ring and map its queues
+ *
+ */
+bool setupRing();
+
+void teardownRing();
+
+/*
+ * wait for at least minComplete writes and check their results
+ *
+ */
+void reap(unsigned minComplete);
+
+/*
+ * write what a queued write left out, or all of it if it failed, with pwrite
+ *
+ */
+void finishWrite(unsigned slot, int64_t written);
+
+int fd;
+
+uint64_t offset;
+
+bool failed;
+
+int ringFd;
+
+void* sqRing;
+
+void* cqRing;
+
+size_t sqRingSize;
+
+size_t cqRingSize;
+
+struct io_uring_sqe* sqes;
+
+size_t sqesSize;
+
+unsigned* sqTail;
+
+unsigned* sqMask;
+
+unsigned* sqArray;
+
+unsigned* cqHead;
+
+unsigned* cqTail;
+
+unsigned* cqMask;
+
+struct io_uring_cqe* cqes;
+
+/*
+ * buffers of the writes in flight and where they go, by slot
+ *
+ */
+vector<string> buffers;
+
+vector<uint64_t> offsets;
+
+vector<unsigned> freeSlots;
+
+unsigned inFlight;
+};
+
+
+/*
+ * output stream over a uringBuf
+ *
+ */
+class uringFile : public ostream {
+
+public:
+
+uringFile();
+
+~uringFile();
+
+void open(const string& fileName);
+
+void close();
+
+/*
+ * append buffer without copying it
+ *
+ */
+void writeBuffer(string&& buffer);
+
+private:
+
+uringBuf buf;
+};
@@ -5,8 +5,13 @@
  *
  */
 #include "util.h"
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 uint64_t htonll(uint64_t host_longlong) {
@@ -50,6 +55,90 @@ bool fileExists(const std::string& name) {
 }
 
 
+uint64_t fileSize(const string& name) {
+    struct stat st;
+    if (stat(name.c_str(), &st) < 0) {
+        return 0;
+    }
+    return st.st_size;
+}
+
+
+uint64_t modifiedTime(const string& name) {
+    struct stat st;
+    if (stat(name.c_str(), &st) < 0) {
+        return 0;
+    }
+    return st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+
+void preallocate(const string& name, uint64_t length) {
+    if (length == 0) {
+        return;
+    }
+    int fd = open(name.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return;
+    }
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, length);
+    close(fd);
+}
+
+
+uint64_t checksum(const char* data, size_t len) {
+    const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = len * prime;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data+i, sizeof(word));
+        h = (h ^ (word * 0xc2b2ae3d27d4eb4fULL)) * prime;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++) {
+        h = (h ^ static_cast<unsigned char>(data[i])) * prime;
+    }
+    // spread the last words over all bits
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+bool writeAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        auto written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+
+bool readAll(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        auto numRead = read(fd, buf, len);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
+            return false;
+        }
+        buf += numRead;
+        len -= numRead;
+    }
+    return true;
+}
+
+
 string exec(const char* cmd) {
     char buffer[2000];
     string result;
@@ -25,6 +25,45 @@ bool isPrefix(const string& prefix, const string& str);
 
 bool fileExists(const std::string& name);
 
+/*
+ * size of a file in bytes, 0 if it does not exist
+ *
+ */
+uint64_t fileSize(const string& name);
+
+/*
+ * last modification of a file in nanoseconds, 0 if it does not exist
+ *
+ */
+uint64_t modifiedTime(const string& name);
+
+/*
+ * reserve disk space for the first length bytes of a file without changing its size,
+ * so that writing it does not fragment it. Does nothing where fallocate is not supported.
+ *
+ */
+void preallocate(const string& name, uint64_t length);
+
+/*
+ * 64 bit checksum of len bytes of data, reads 8 bytes at a time
+ *
+ */
+uint64_t checksum(const char* data, size_t len);
+
+/*
+ * write all len bytes of buf to fd, retrying on short writes
+ * @return true if every byte was written
+ *
+ */
+bool writeAll(int fd, const char* buf, size_t len);
+
+/*
+ * read exactly len bytes from fd into buf, retrying on short reads
+ * @return true if len bytes were read before the connection closed
+ *
+ */
+bool readAll(int fd, char* buf, size_t len);
+
 
 /**
  * Return a hash for some given string
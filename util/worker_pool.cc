@@ -0,0 +1,113 @@
+/*
+ * @file worker_pool.cc
+ * @date Oct 18, 2026
+ *
+ */
+#include "worker_pool.h"
+
+
+thread_local workerPool* workerPool::current = nullptr;
+
+
+workerPool::workerPool(size_t threads, string name, bool growWhenBlocked)
+: name{name}, threads{threads}, growWhenBlocked{growWhenBlocked}, idle{0}, waiting{0}, extras{0}, stopping{false} {
+    for (size_t i=0; i < threads; i++) {
+        workers.emplace_back(&workerPool::run, this, false);
+    }
+}
+
+
+workerPool::~workerPool() {
+    unique_lock<mutex> lk(tasksMutex);
+    stopping = true;
+    cv.notify_all();
+    lk.unlock();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    lk.lock();
+    extraExited.wait(lk, [this]{ return extras == 0; });
+}
+
+
+void workerPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> lk(tasksMutex);
+        tasks.push_back(move(task));
+        grow();
+    }
+    cv.notify_one();
+}
+
+
+void workerPool::blocked() {
+    auto pool = current;
+    if (!pool || !pool->growWhenBlocked) {
+        return;
+    }
+    lock_guard<mutex> lk(pool->tasksMutex);
+    pool->waiting++;
+    pool->grow();
+}
+
+
+void workerPool::unblocked() {
+    auto pool = current;
+    if (!pool || !pool->growWhenBlocked) {
+        return;
+    }
+    lock_guard<mutex> lk(pool->tasksMutex);
+    pool->waiting--;
+    if (pool->extras > 0 && pool->surplus()) {
+        pool->cv.notify_all();
+    }
+}
+
+
+size_t workerPool::pending() {
+    lock_guard<mutex> lk(tasksMutex);
+    return tasks.size();
+}
+
+
+size_t workerPool::size() {
+    return workers.size();
+}
+
+
+void workerPool::grow() {
+    if (stopping || tasks.empty() || idle > 0 || workers.size() + extras - waiting >= threads) {
+        return;
+    }
+    extras++;
+    thread extraThread(&workerPool::run, this, true);
+    extraThread.detach();  // ends on its own once the blocked workers are back
+}
+
+
+bool workerPool::surplus() {
+    return workers.size() + extras - waiting > threads;
+}
+
+
+void workerPool::run(bool extra) {
+    current = this;
+    unique_lock<mutex> lk(tasksMutex);
+    while (1) {
+        idle++;
+        cv.wait(lk, [this, extra]{ return stopping || !tasks.empty() || (extra && surplus()); });
+        idle--;
+        if (tasks.empty() || (extra && surplus())) {
+            break;
+        }
+        auto task = move(tasks.front());
+        tasks.pop_front();
+        lk.unlock();
+        task();
+        lk.lock();
+    }
+    if (extra) {
+        extras--;
+        extraExited.notify_all();
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * @file worker_pool.h
+ * @date Oct 18, 2026
+ *
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+/*
+ * A fixed number of threads running submitted tasks in order. A pool that grows when
+ * blocked does not count workers waiting for other nodes: while one waits, another
+ * worker is started for the queued tasks, so the pools of nodes waiting for each other
+ * cannot all fill up with waiting tasks.
+ *
+ */
+class workerPool {
+
+public:
+
+/*
+ * @param threads number of worker threads
+ * @param name used in the logs of the owner
+ * @param growWhenBlocked start extra workers while some wait for other nodes
+ *
+ */
+workerPool(size_t threads, string name, bool growWhenBlocked = false);
+
+/*
+ * finish queued tasks and join the workers
+ *
+ */
+~workerPool();
+
+/*
+ * queue a task, it runs on the first free worker
+ *
+ */
+void submit(function<void()> task);
+
+/*
+ * the worker on the calling thread waits for another node until unblocked() is called.
+ * Does nothing outside a pool that grows when blocked.
+ *
+ */
+static void blocked();
+
+static void unblocked();
+
+/*
+ * number of tasks waiting for a worker
+ *
+ */
+size_t pending();
+
+/*
+ * number of worker threads
+ *
+ */
+size_t size();
+
+string name;
+
+private:
+
+/*
+ * loop of every worker thread
+ * @param extra the worker was started for a blocked one and ends once there are enough
+ *
+ */
+void run(bool extra);
+
+/*
+ * start an extra worker if queued tasks only wait for blocked ones, tasksMutex is held
+ *
+ */
+void grow();
+
+/*
+ * more workers than threads are not blocked, tasksMutex is held
+ *
+ */
+bool surplus();
+
+/*
+ * the pool the calling thread works for
+ *
+ */
+static thread_local workerPool* current;
+
+vector<thread> workers;
+
+deque<function<void()>> tasks;
+
+mutex tasksMutex;
+
+condition_variable cv;
+
+size_t threads;
+
+bool growWhenBlocked;
+
+/*
+ * workers waiting for tasks, blocked on other nodes and started for blocked ones
+ *
+ */
+size_t idle;
+
+size_t waiting;
+
+size_t extras;
+
+condition_variable extraExited;
+
+bool stopping;
+};